@@ -0,0 +1,407 @@
+#include "anemo_record.h"
+#include "../timestamp/timestamp.h"
+#include "../task/buffer_task/buffer_task.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* memcmp, memcpy */
+
+
+/* Max digits of a mantissa (fits int32_t) */
+#define _MAX_DIGITS                 (9)
+
+#define _IS_DIGIT(c)                ((c) >= '0' && (c) <= '9')
+#define _IS_SPACE(c)                \
+    ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+
+/* LOCALS *********************************************************************/
+
+static const char *value_keys[] = {ANEMO_RECORD_VALUE_KEYS};
+
+
+/* PROTOTYPES *****************************************************************/
+
+static const char *_skip_space (const char *p, const char *end);
+static const char *_parse_string (const char *p, const char *end,
+    const char **str, uint32_t *str_len);
+static const char *_parse_key (const char *p, const char *end,
+    const char **key, uint32_t *key_len);
+static const char *_parse_number (const char *p, const char *end,
+    int32_t *mantissa, uint8_t *decimals);
+static const char *_parse_data (anemo_record_t *record, const char *p,
+    const char *end);
+static int8_t _is_key (const char *key, uint32_t key_len, const char *name);
+static int8_t _write (char *dst, uint32_t size, uint32_t *pos,
+    const char *src, uint32_t len);
+static int8_t _write_number (char *dst, uint32_t size, uint32_t *pos,
+    int32_t mantissa, uint8_t decimals);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Decode object member by member. Every member has to be known, strings
+ *  can't hold escapes and numbers can't have exponents.
+ */
+int8_t anemo_record_parse (anemo_record_t *record, const char *json,
+        uint32_t len) {
+    const char *end = json + len;
+    const char *p = _skip_space(json, end);
+    const char *key;
+    const char *station;
+    uint32_t key_len;
+    uint32_t station_len;
+    int8_t is_station_set = 0;
+    int8_t is_data_set = 0;
+
+    memset(record, 0, sizeof(anemo_record_t));
+    record->magic = ANEMO_RECORD_MAGIC;
+
+    if (p == end || *p != '{') {
+        return 1;
+    }
+    p = _skip_space(p + 1, end);
+
+    while (p != NULL && p < end && *p != '}') {
+        p = _parse_key(p, end, &key, &key_len);
+        if (p == NULL) {
+            return 1;
+        }
+
+        if (is_station_set == 0 &&
+                _is_key(key, key_len, ANEMO_RECORD_STATION_KEY) == 1) {
+            p = _parse_string(p, end, &station, &station_len);
+            if (p == NULL || station_len > ANEMO_RECORD_STATION_SIZE - 1) {
+                return 1;
+            }
+            memcpy(record->station, station, station_len);
+            is_station_set = 1;
+        }
+        else if (is_data_set == 0 &&
+                _is_key(key, key_len, ANEMO_RECORD_DATA_KEY) == 1) {
+            p = _parse_data(record, p, end);
+            is_data_set = 1;
+        }
+        else {
+            return 1;
+        }
+
+        /* Next member, or end of object */
+        if (p == NULL) {
+            return 1;
+        }
+        p = _skip_space(p, end);
+        if (p < end && *p == ',') {
+            p = _skip_space(p + 1, end);
+            if (p < end && *p == '}') {
+                return 1;
+            }
+        }
+        else if (p < end && *p != '}') {
+            return 1;
+        }
+    }
+
+    if (p == NULL || p == end || is_station_set == 0 || is_data_set == 0) {
+        return 1;
+    }
+    /* Nothing but space after closing braces */
+    if (_skip_space(p + 1, end) != end) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*  Serialize record in the same field order as JSON from the buffer task.
+ */
+int anemo_record_to_json (const anemo_record_t *record, char *dst,
+        uint32_t size) {
+    char delay[JSON_DELAY_STRING_SIZE];
+    const char *key;
+    uint32_t pos = 1;
+    int delay_len;
+    int i;
+
+    if (size < 1 + TIMESTAMP_JSON_W_COMMA_LEN + 1) {
+        return -1;
+    }
+    dst[0] = '{';
+    if (get_timestamp_json_w_comma_at(&dst[pos], record->arrival_ns) != 0) {
+        return -1;
+    }
+    pos += TIMESTAMP_JSON_W_COMMA_LEN;
+
+    delay_len = snprintf(delay, JSON_DELAY_STRING_SIZE,
+        JSON_DELAY_FORMAT_W_COMMA, (unsigned long long)record->delay_us);
+    if (delay_len < 0 || delay_len >= JSON_DELAY_STRING_SIZE ||
+            _write(dst, size, &pos, delay, delay_len) != 0 ||
+            _write(dst, size, &pos, "\"" ANEMO_RECORD_STATION_KEY "\":\"",
+                sizeof(ANEMO_RECORD_STATION_KEY) + 3) != 0 ||
+            _write(dst, size, &pos, record->station,
+                strnlen(record->station, ANEMO_RECORD_STATION_SIZE)) != 0 ||
+            _write(dst, size, &pos, "\",\"" ANEMO_RECORD_DATA_KEY "\":{",
+                sizeof(ANEMO_RECORD_DATA_KEY) + 5) != 0) {
+        return -1;
+    }
+
+    for (i=0; i<record->num_of_values; i++) {
+        key = anemo_record_get_key(record->keys[i]);
+        if (key == NULL) {
+            return -1;
+        }
+        if ((i > 0 && _write(dst, size, &pos, ",", 1) != 0) ||
+                _write(dst, size, &pos, "\"", 1) != 0 ||
+                _write(dst, size, &pos, key, strlen(key)) != 0 ||
+                _write(dst, size, &pos, "\":", 2) != 0 ||
+                _write_number(dst, size, &pos,
+                    record->values[i], record->decimals[i]) != 0) {
+            return -1;
+        }
+    }
+
+    /* Space for '\0' is left by '_write' */
+    if (_write(dst, size, &pos, "}}", 2) != 0) {
+        return -1;
+    }
+    dst[pos] = '\0';
+
+    return pos;
+}
+
+/*  Get key from known sensor value keys.
+ */
+const char *anemo_record_get_key (uint8_t key) {
+    if (key >= ANEMO_RECORD_NUM_OF_KEYS) {
+        return NULL;
+    }
+    return value_keys[key];
+}
+
+/*  Records start with magic byte, JSON strings with opening braces.
+ */
+int8_t anemo_record_is_record (const char *data, uint32_t len) {
+    if (len == sizeof(anemo_record_t) &&
+            (uint8_t)data[0] == ANEMO_RECORD_MAGIC) {
+        return 1;
+    }
+    return 0;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Skip JSON white space.
+ *  return: pointer to first other char (or end)
+ */
+static const char *_skip_space (const char *p, const char *end) {
+    while (p < end && _IS_SPACE(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/*  Parse string without escapes.
+ *   p3: pointer to where string start is kept (within JSON)
+ *   p4: pointer to where string length is kept
+ *  return: pointer past closing quotes, NULL if not a plain string
+ */
+static const char *_parse_string (const char *p, const char *end,
+        const char **str, uint32_t *str_len) {
+    if (p == end || *p != '"') {
+        return NULL;
+    }
+    *str = ++p;
+    while (p < end && *p != '"') {
+        if (*p == '\\') {
+            return NULL;
+        }
+        p++;
+    }
+    if (p == end) {
+        return NULL;
+    }
+    *str_len = p - *str;
+    return p + 1;
+}
+
+/*  Parse member's key, including colon.
+ *  return: pointer to value, NULL on syntax error
+ */
+static const char *_parse_key (const char *p, const char *end,
+        const char **key, uint32_t *key_len) {
+    p = _parse_string(p, end, key, key_len);
+    if (p == NULL) {
+        return NULL;
+    }
+    p = _skip_space(p, end);
+    if (p == end || *p != ':') {
+        return NULL;
+    }
+    return _skip_space(p + 1, end);
+}
+
+/*  Parse number with optional fraction ("-12.05"). Only numbers, which are
+ *  written back unchanged, are accepted (no exponent, leading zeros or "-0").
+ *  return: pointer past number, NULL if not supported
+ */
+static const char *_parse_number (const char *p, const char *end,
+        int32_t *mantissa, uint8_t *decimals) {
+    int32_t value = 0;
+    int8_t is_negative = 0;
+    int8_t is_fraction = 0;
+    uint8_t num_of_digits = 0;
+    uint8_t num_of_decimals = 0;
+
+    if (p < end && *p == '-') {
+        is_negative = 1;
+        p++;
+    }
+    if (p + 1 < end && p[0] == '0' && _IS_DIGIT(p[1])) {
+        return NULL;
+    }
+
+    for (; p < end; p++) {
+        if (_IS_DIGIT(*p)) {
+            if (++num_of_digits > _MAX_DIGITS) {
+                return NULL;
+            }
+            value = value * 10 + (*p - '0');
+            num_of_decimals += is_fraction;
+        }
+        else if (*p == '.' && is_fraction == 0 && num_of_digits > 0) {
+            is_fraction = 1;
+        }
+        else {
+            break;
+        }
+    }
+
+    /* Needs digits on both sides of the point */
+    if (num_of_digits == 0 || (is_fraction == 1 && num_of_decimals == 0)) {
+        return NULL;
+    }
+    if (is_negative == 1 && value == 0) {
+        return NULL;
+    }
+    /* Number has to end here */
+    if (p < end && !_IS_SPACE(*p) && *p != ',' && *p != '}') {
+        return NULL;
+    }
+
+    *mantissa = (is_negative == 1) ? -value : value;
+    *decimals = num_of_decimals;
+    return p;
+}
+
+/*  Parse 'data' object of known sensor values.
+ *  return: pointer past closing braces, NULL if not supported
+ */
+static const char *_parse_data (anemo_record_t *record, const char *p,
+        const char *end) {
+    const char *key;
+    uint32_t key_len;
+    uint8_t n;
+    uint8_t i;
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+    p = _skip_space(p + 1, end);
+    if (p < end && *p == '}') {
+        return p + 1;
+    }
+
+    while (p < end) {
+        n = record->num_of_values;
+        if (n == ANEMO_RECORD_MAX_VALUES) {
+            return NULL;
+        }
+
+        p = _parse_key(p, end, &key, &key_len);
+        if (p == NULL) {
+            return NULL;
+        }
+        for (i=0; i<ANEMO_RECORD_NUM_OF_KEYS; i++) {
+            if (_is_key(key, key_len, value_keys[i]) == 1) {
+                break;
+            }
+        }
+        if (i == ANEMO_RECORD_NUM_OF_KEYS) {
+            return NULL;
+        }
+        record->keys[n] = i;
+
+        p = _parse_number(p, end, &record->values[n], &record->decimals[n]);
+        if (p == NULL) {
+            return NULL;
+        }
+        record->num_of_values++;
+
+        p = _skip_space(p, end);
+        if (p < end && *p == '}') {
+            return p + 1;
+        }
+        if (p == end || *p != ',') {
+            return NULL;
+        }
+        p = _skip_space(p + 1, end);
+    }
+
+    return NULL;
+}
+
+/*  Compare parsed key with name.
+ *  return: 1 if equal, else 0
+ */
+static int8_t _is_key (const char *key, uint32_t key_len, const char *name) {
+    if (strlen(name) == key_len && memcmp(key, name, key_len) == 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/*  Append bytes to destination, always leaving space for '\0'.
+ *  return: 0 on success, -1 if destination is full
+ */
+static int8_t _write (char *dst, uint32_t size, uint32_t *pos,
+        const char *src, uint32_t len) {
+    if (*pos + len > size - 1) {
+        return -1;
+    }
+    memcpy(&dst[*pos], src, len);
+    *pos += len;
+    return 0;
+}
+
+/*  Append mantissa with decimal point inserted (2105, 2 -> "21.05").
+ *  return: 0 on success, -1 if destination is full
+ */
+static int8_t _write_number (char *dst, uint32_t size, uint32_t *pos,
+        int32_t mantissa, uint8_t decimals) {
+    /* Sign, digits, point and leading zero */
+    char digits[_MAX_DIGITS + 4];
+    uint32_t value = (mantissa < 0) ? -(uint32_t)mantissa : mantissa;
+    int i = sizeof(digits);
+    int num_of_digits = 0;
+
+    if (decimals > _MAX_DIGITS) {
+        return -1;
+    }
+
+    /* Digits from last one on, at least one in front of the point */
+    do {
+        if (num_of_digits == decimals && decimals > 0) {
+            digits[--i] = '.';
+        }
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+        num_of_digits++;
+    } while (value > 0 || num_of_digits <= decimals);
+
+    if (mantissa < 0) {
+        digits[--i] = '-';
+    }
+
+    return _write(dst, size, pos, &digits[i], sizeof(digits) - i);
+}
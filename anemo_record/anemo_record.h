@@ -0,0 +1,94 @@
+#ifndef ANEMO_RECORD_H
+#define ANEMO_RECORD_H
+
+/*
+ *  Compact binary form of Anemo measurements. A framed JSON object with the
+ *  known layout ({"station":"...","data":{"<key>":<number>,...}}) is decoded
+ *  into a fixed size record, which is carried through fifo buffers instead
+ *  of the string. Storage and requests serialize it back to JSON at the edge.
+ *
+ *  Numbers are kept as decimal mantissa and number of decimals, so JSON
+ *  written from a record is the same as the received one. Objects, which
+ *  don't fit the schema, are not records and stay JSON strings.
+ */
+
+#include <stdint.h>         /* Data types */
+
+
+/* First byte of every record, JSON strings start with '{' instead */
+#define ANEMO_RECORD_MAGIC                  (0xA7)
+
+/* Station id, including '\0' */
+#define ANEMO_RECORD_STATION_SIZE           (16)
+/* Max sensor values per measurement */
+#define ANEMO_RECORD_MAX_VALUES             (8)
+
+/* Top level keys */
+#define ANEMO_RECORD_STATION_KEY            "station"
+#define ANEMO_RECORD_DATA_KEY               "data"
+
+/* Known sensor value keys within 'data' (index is kept in record) */
+#ifndef ANEMO_RECORD_VALUE_KEYS
+#define ANEMO_RECORD_VALUE_KEYS             \
+    "wind", "wind_dir", "temp", "hum", "pres"
+#endif
+#define ANEMO_RECORD_NUM_OF_KEYS            \
+    (sizeof((const char *[]){ANEMO_RECORD_VALUE_KEYS}) / sizeof(const char *))
+
+/* Max JSON size of a record, including '\0' */
+#define ANEMO_RECORD_JSON_SIZE              (512)
+
+
+struct _anemo_record {
+    /* ANEMO_RECORD_MAGIC */
+    uint8_t magic;
+    uint8_t num_of_values;
+    /* Per value: index of its key (ANEMO_RECORD_VALUE_KEYS), and number of
+     * decimals, in received order */
+    uint8_t keys[ANEMO_RECORD_MAX_VALUES];
+    uint8_t decimals[ANEMO_RECORD_MAX_VALUES];
+    /* Per value: decimal mantissa (21.05 is 2105 with 2 decimals) */
+    int32_t values[ANEMO_RECORD_MAX_VALUES];
+    /* Time spent in serial fifo and framing [us] */
+    uint32_t delay_us;
+    /* Receive time of JSON's first byte [ns since Unix Epoch] */
+    uint64_t arrival_ns;
+    char station[ANEMO_RECORD_STATION_SIZE];
+};
+
+typedef struct _anemo_record anemo_record_t;
+
+
+/*  Decode framed JSON object into record (arrival and delay are not set).
+ *   p1: pointer to record
+ *   p2: JSON object
+ *   p3: JSON length
+ *  return: 0 on success, 1 if object doesn't fit the schema
+ */
+int8_t anemo_record_parse (anemo_record_t *record, const char *json,
+    uint32_t len);
+
+/*  Write record as JSON, with timestamp and delay in front of other fields.
+ *   p1: pointer to record
+ *   p2: pointer to where JSON should be written ('\0' terminated)
+ *   p3: size of destination
+ *  return: JSON length (without '\0'), -1 on error
+ */
+int anemo_record_to_json (const anemo_record_t *record, char *dst,
+    uint32_t size);
+
+/*  Get sensor value key.
+ *   p1: key index (as kept in record)
+ *  return: key, NULL if unknown
+ */
+const char *anemo_record_get_key (uint8_t key);
+
+/*  Check, if fifo entry holds a record (or JSON string).
+ *   p1: fifo entry
+ *   p2: entry length
+ *  return: 1 if record, else 0
+ */
+int8_t anemo_record_is_record (const char *data, uint32_t len);
+
+
+#endif
@@ -1,9 +1,55 @@
 #include "fifo.h"
+#include "../log/log.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h> /* exit */
+#include <string.h> /* memcpy, strnlen */
+#include <unistd.h> /* read, write, pread, pwrite */
+#include <fcntl.h> /* open */
+#include <poll.h> /* poll */
+#include <sys/eventfd.h> /* eventfd */
 
 
+/* Index access, ordered with regard to the other thread's slot access */
+#define _LOAD_ACQUIRE(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define _STORE_RELEASE(ptr, val)    __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+/* Producer waiting flag vs. read index (both sides store, then load) */
+#define _FENCE_SEQ_CST()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Record header: length (or padding marker), unused, time stamp */
+#define _RECORD_HEADER_SIZE         (16)
+#define _RECORD_STR(record)         ((char *)(record) + _RECORD_HEADER_SIZE)
+#define _RECORD_STAMP(record)       (((uint64_t *)(record))[1])
+
+/* Record size: header, string and '\0', aligned to record alignment */
+#define _RECORD_SIZE(len)           \
+    ((_RECORD_HEADER_SIZE + (len) + 1 + (FIFO_RECORD_ALIGN-1)) & \
+    ~(uint32_t)(FIFO_RECORD_ALIGN-1))
+
+/* Secondary store record header: length and time stamp */
+#define _SPILL_HEADER_SIZE          (2 * sizeof(uint64_t))
+
+
+/* PROTOTYPES *****************************************************************/
+
+static char *_reserve (str_fifo_t *fifo, uint32_t len);
+static int8_t _find_space (str_fifo_t *fifo, uint32_t len);
+static char *_reserve_overflow (str_fifo_t *fifo, int8_t result);
+static void _count_drop (str_fifo_t *fifo);
+static int8_t _wait_for_space (str_fifo_t *fifo, uint32_t len);
+static int8_t _spill (str_fifo_t *fifo, uint32_t len, uint64_t stamp);
+static void _load_spill (str_fifo_t *fifo);
+static int8_t _refill (str_fifo_t *fifo);
+static uint32_t _get_tail (str_fifo_t *fifo);
+static void _drop_oldest (str_fifo_t *fifo);
+static uint32_t *_get_record (str_fifo_t *fifo, uint32_t idx);
+static uint32_t *_skip_padding (str_fifo_t *fifo, uint32_t *idx);
+static void _notify (str_fifo_t *fifo);
+static uint32_t _get_depth (str_fifo_t *fifo);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
 /* int8_t str_fifo_read(fifo_t *fifo, char *data);
  *  function for reading from fifo buffer of strings
  *   fifo - address of fifo for reading
@@ -12,12 +58,15 @@
  *   returns 0 if data was successfully read, else 1 (buffer empty)
  */
 int8_t str_fifo_read(str_fifo_t *fifo, char *data){
-	uint32_t i=0;
+	char *slot = str_fifo_peek(fifo);
 
-	if(fifo->write_idx != fifo->read_idx){
-		for(i=0; i < fifo->str_size; i++){
-			data[i] = fifo->buffer[fifo->read_idx][i];
+	if(slot != NULL){
+		/* Copy only the string, including '\0' if it fits */
+		size_t len = str_fifo_get_len(slot);
+		if (len < fifo->str_size) {
+			len++;
 		}
+		memcpy(data, slot, len);
 		//fifo->read_idx = (fifo->read_idx+1)%fifo->buf_size;
         return 0;
 	}
@@ -38,27 +87,257 @@ int8_t str_fifo_read_auto_inc(str_fifo_t *fifo, char *data){
  *   fifo - address of fifo for writing
  *   data - address of data to be written into fifo
  *
- *   returns 0 if data was successfully written, else 1
+ *   returns FIFO_WRITE_OK, FIFO_WRITE_DROPPED or FIFO_WRITE_FULL (try again)
  */
 int8_t str_fifo_write(str_fifo_t *fifo, char *data){
-	uint32_t i=0;
-	uint32_t tmp_write_idx = (fifo->write_idx+1)%fifo->buf_size;
-
-    /* Allow circular overwrite.
-     * Always keep read_idx at leats one in front write_ix.
-     */
-	if(tmp_write_idx == fifo->read_idx){
-        fifo->read_idx = (fifo->read_idx+1)%fifo->buf_size;
-		printf("Fifo: circular overwrite (address: %p)\n", (void *)fifo);
+	return str_fifo_write_stamped(fifo, data, strnlen(data, fifo->str_size), 0);
+}
+
+
+/* int8_t str_fifo_write_stamped(str_fifo_t *fifo, const char *data,
+ *      uint32_t len, uint64_t stamp)
+ *  same as 'str_fifo_write', for data of known length, with time stamp kept
+ *  in record header
+ *   fifo - address of fifo for writing
+ *   data - address of data to be written into fifo
+ *   len - data length (without '\0')
+ *   stamp - time stamp (see 'str_fifo_get_stamp')
+ *
+ *   returns FIFO_WRITE_OK, FIFO_WRITE_DROPPED or FIFO_WRITE_FULL (try again)
+ */
+int8_t str_fifo_write_stamped(str_fifo_t *fifo, const char *data,
+		uint32_t len, uint64_t stamp){
+	char *slot;
+
+	/* Reserve only as much as the string needs */
+	if (len > fifo->str_size) {
+		len = fifo->str_size;
+	}
+	slot = _reserve(fifo, len);
+
+	if (slot == NULL) {
+		return FIFO_WRITE_FULL;
+	}
+	/* Dropped anyway, skip copy */
+	if (fifo->overflow_reserve != FIFO_WRITE_DROPPED) {
+		memcpy(slot, data, len);
+	}
+
+    return str_fifo_commit_stamped(fifo, len, stamp);
+}
+
+
+/* char *str_fifo_reserve(str_fifo_t *fifo)
+ *  get free space for writing in place, publish it with 'str_fifo_commit'
+ *   fifo - address of fifo for writing
+ *
+ *  returns pointer to space (str_size+1 bytes), or NULL if full (blocking)
+ */
+char *str_fifo_reserve(str_fifo_t *fifo){
+	return _reserve(fifo, fifo->str_size);
+}
+
+
+/* int8_t str_fifo_commit(str_fifo_t *fifo, uint32_t len)
+ *  publish record, previously returned by 'str_fifo_reserve'
+ *   fifo - address of fifo for writing
+ *   len - string length (without '\0'), at most as much as reserved
+ *
+ *  returns FIFO_WRITE_OK (written or spilled), or FIFO_WRITE_DROPPED
+ */
+int8_t str_fifo_commit(str_fifo_t *fifo, uint32_t len){
+	return str_fifo_commit_stamped(fifo, len, 0);
+}
+
+
+/* int8_t str_fifo_commit_stamped(str_fifo_t *fifo, uint32_t len,
+ *      uint64_t stamp)
+ *  same as 'str_fifo_commit', with time stamp kept in record header
+ *   fifo - address of fifo for writing
+ *   len - string length (without '\0'), at most as much as reserved
+ *   stamp - time stamp (see 'str_fifo_get_stamp')
+ *
+ *  returns FIFO_WRITE_OK (written or spilled), or FIFO_WRITE_DROPPED
+ */
+int8_t str_fifo_commit_stamped(str_fifo_t *fifo, uint32_t len, uint64_t stamp){
+	uint32_t *record;
+	uint32_t depth;
+
+	/* Space was outside of ring */
+	if (fifo->overflow_reserve == FIFO_WRITE_DROPPED) {
+		_count_drop(fifo);
+		return FIFO_WRITE_DROPPED;
+	}
+	if (fifo->overflow_reserve == FIFO_WRITE_FULL) {
+		return _spill(fifo, len, stamp);
+	}
+
+	/* Record was moved to beginning of ring, mark end as padding */
+	if (fifo->reserve_idx != fifo->write_idx) {
+		record = _get_record(fifo, fifo->write_idx);
+		*record = FIFO_RECORD_PADDING;
+	}
+
+	/* Add header and terminate string */
+	record = _get_record(fifo, fifo->reserve_idx);
+	*record = len;
+	_RECORD_STAMP(record) = stamp;
+	_RECORD_STR(record)[len] = '\0';
+
+    /* Publish record to consumer */
+    _STORE_RELEASE(&fifo->write_idx, fifo->reserve_idx + _RECORD_SIZE(len));
+    fifo->reserve_idx = fifo->write_idx;
+    _STORE_RELEASE(&fifo->write_count, fifo->write_count + 1);
+
+    depth = _get_depth(fifo);
+    if (depth > fifo->high_water) {
+    	_STORE_RELEASE(&fifo->high_water, depth);
     }
-    for(i=0; i < fifo->str_size; i++){
-        fifo->buffer[fifo->write_idx][i] = data[i];
+
+    /* Wake up consumer thread */
+    _notify(fifo);
+    return FIFO_WRITE_OK;
+}
+
+
+/* char *str_fifo_peek(str_fifo_t *fifo)
+ *  get oldest record for reading in place (first reader)
+ *   fifo - address of fifo for reading
+ *
+ *  returns pointer to string, or NULL if fifo is empty
+ */
+char *str_fifo_peek(str_fifo_t *fifo){
+	return str_fifo_peek_reader(fifo, 0);
+}
+
+
+/* int8_t str_fifo_release(str_fifo_t *fifo)
+ *  free oldest record, previously returned by 'str_fifo_peek' (first reader)
+ *   fifo - address of fifo for reading
+ *
+ *  returns 0 on success, 1 if fifo is empty
+ */
+int8_t str_fifo_release(str_fifo_t *fifo){
+	return str_fifo_release_reader(fifo, 0);
+}
+
+
+/* char *str_fifo_peek_reader(str_fifo_t *fifo, uint8_t reader)
+ *  get oldest record, not yet released by the reader
+ *   fifo - address of fifo for reading
+ *   reader - reader id
+ *
+ *  returns pointer to string, or NULL if fifo is empty (for this reader)
+ */
+char *str_fifo_peek_reader(str_fifo_t *fifo, uint8_t reader){
+	uint32_t *record = _skip_padding(fifo, &fifo->reader_idx[reader]);
+
+	if (record == NULL) {
+		return NULL;
+	}
+	return _RECORD_STR(record);
+}
+
+
+/* char *str_fifo_peek_next(str_fifo_t *fifo, const char *str)
+ *  get record after a peeked one, without releasing anything
+ *   fifo - address of fifo for reading
+ *   str - string, returned by any peek
+ *
+ *  returns pointer to string, or NULL if 'str' is the newest record
+ */
+char *str_fifo_peek_next(str_fifo_t *fifo, const char *str){
+	const char *record = str - _RECORD_HEADER_SIZE;
+	uint32_t idx = (uint32_t)(record - fifo->buffer) +
+		_RECORD_SIZE(*(const uint32_t *)record);
+	uint32_t write_idx = _LOAD_ACQUIRE(&fifo->write_idx);
+
+	/* Reader walks forward from its oldest record, so the first time it
+	 * meets the write index (within ring) is the end */
+	if ((idx & fifo->ring_mask) == (write_idx & fifo->ring_mask)) {
+		return NULL;
+	}
+	if (*_get_record(fifo, idx) == FIFO_RECORD_PADDING) {
+		/* Padding is never the last record */
+		idx = 0;
+	}
+	return _RECORD_STR(_get_record(fifo, idx));
+}
+
+
+/* uint32_t str_fifo_get_len(const char *str)
+ *  get string length from header of record, returned by peek
+ *   str - string, returned by 'str_fifo_peek' or 'str_fifo_peek_reader'
+ *
+ *  returns string length (without '\0')
+ */
+uint32_t str_fifo_get_len(const char *str){
+	return *(const uint32_t *)(str - _RECORD_HEADER_SIZE);
+}
+
+
+/* uint64_t str_fifo_get_stamp(const char *str)
+ *  get time stamp from header of record, returned by peek
+ *   str - string, returned by 'str_fifo_peek' or 'str_fifo_peek_reader'
+ *
+ *  returns time stamp (0 if record was written without it)
+ */
+uint64_t str_fifo_get_stamp(const char *str){
+	return *(const uint64_t *)(str - _RECORD_HEADER_SIZE + sizeof(uint64_t));
+}
+
+
+/* int8_t str_fifo_release_reader(str_fifo_t *fifo, uint8_t reader)
+ *  move reader past its oldest record. Space gets reused only after all
+ *  readers have released the record.
+ *   fifo - address of fifo for reading
+ *   reader - reader id
+ *
+ *  returns 0 on success, 1 if fifo is empty (for this reader)
+ */
+int8_t str_fifo_release_reader(str_fifo_t *fifo, uint8_t reader){
+	uint32_t *idx = &fifo->reader_idx[reader];
+    // -- check if fifo is empty
+    uint32_t *record = _skip_padding(fifo, idx);
+    if (record == NULL) return 1;
+    // -- increment read pointer (point to fresh data), release record
+    _STORE_RELEASE(idx, *idx + _RECORD_SIZE(*record));
+    _STORE_RELEASE(&fifo->read_count[reader], fifo->read_count[reader] + 1);
+
+    /* Wake up producer, if it waits for space (blocking policy) */
+    if (fifo->space_fd != -1) {
+    	_FENCE_SEQ_CST();
+    	if (_LOAD_ACQUIRE(&fifo->is_producer_waiting) == 1) {
+    		uint64_t one = 1;
+    		if (write(fifo->space_fd, &one, sizeof(one)) != sizeof(one)) {
+    			LOG_ERROR("Fifo: notify error (address: %p)\n", (void *)fifo);
+    		}
+    	}
     }
-    fifo->write_idx = tmp_write_idx;
+
     return 0;
 }
 
 
+/* int8_t str_fifo_add_reader(str_fifo_t *fifo)
+ *  add reader with its own read index, starting at the newest record
+ *   fifo - address of fifo
+ *
+ *  returns reader id, or -1 if there are too many readers
+ */
+int8_t str_fifo_add_reader(str_fifo_t *fifo){
+	if (fifo->num_of_readers >= FIFO_MAX_READERS) {
+		return -1;
+	}
+	fifo->reader_idx[fifo->num_of_readers] = fifo->write_idx;
+	fifo->read_count[fifo->num_of_readers] = fifo->write_count;
+	fifo->reader_drops[fifo->num_of_readers] = 0;
+	fifo->notify_fd[fifo->num_of_readers] = -1;
+	fifo->num_of_readers++;
+	return fifo->num_of_readers - 1;
+}
+
+
 /* int8_t fifo_increment_read(str_fifo_t *fifo)
  *  manually increment fifo read pointer, only turn fifo after incrementation
  *   fifo - address of fifo for writing
@@ -68,12 +347,7 @@ int8_t str_fifo_write(str_fifo_t *fifo, char *data){
  *   1 - fifo empty
  */
 int8_t fifo_increment_read_idx(str_fifo_t *fifo){
-    // -- check if fifo is empty
-    if (fifo->read_idx == fifo->write_idx) return 1;
-    // -- increment read pointer (point to fresh data)
-    fifo->read_idx = (fifo->read_idx+1)%fifo->buf_size;
-
-    return 0;
+    return str_fifo_release_reader(fifo, 0);
 }
 
 
@@ -82,23 +356,485 @@ int8_t fifo_increment_read_idx(str_fifo_t *fifo){
  *   request data buffer: only for data, not full request!
  *   data_save buffer: new line for output file
  *
+ *  Ring size is the largest power of two, that fits into the space of
+ *  'buf_size' fixed strings, but at least two records of 'str_size'.
+ *
  *  returns:
  *   0 - buffer setup successful
  *   -1 - error
  */
 int8_t setup_str_fifo (str_fifo_t *fifo, int32_t buf_size, int32_t str_size) {
-	// -- initialie seperately to avoid 'is not constant' error
-    static char **tmp_fifo_buf=NULL;
+	uint32_t max_size = (uint32_t)buf_size * (uint32_t)(str_size+1);
+	uint32_t min_size = 2 * _RECORD_SIZE(fifo->str_size);
+	uint32_t ring_size = FIFO_CACHE_LINE_SIZE;
+
+	while (ring_size < min_size || ring_size*2 <= max_size) {
+		ring_size *= 2;
+	}
+
+	/* Single contiguous, cache line aligned block */
+	fifo->buffer = (char *) aligned_alloc(FIFO_CACHE_LINE_SIZE, ring_size);
+	/* Records, which don't get to the ring, are written here */
+	fifo->overflow_buf = (char *) malloc(fifo->str_size + 1);
+	if (fifo->buffer == NULL || fifo->overflow_buf == NULL) {
+		return -1;
+	}
+
+	fifo->ring_mask = ring_size - 1;
+	fifo->read_idx = 0;
+	fifo->write_idx = 0;
+	fifo->reserve_idx = 0;
+	fifo->is_spsc = 0;
+	/* Default reader (0) */
+	fifo->num_of_readers = 1;
+	fifo->reader_idx[0] = 0;
+	fifo->notify_fd[0] = -1;
+	/* Default overflow policy, circular overwrite */
+	fifo->overflow_policy = FIFO_OVERFLOW_DROP_OLDEST;
+	fifo->overflow_reserve = FIFO_WRITE_OK;
+	fifo->space_fd = -1;
+	fifo->is_producer_waiting = 0;
+	fifo->spill_fd = -1;
+	fifo->spill_read_off = 0;
+	fifo->spill_write_off = 0;
+	/* Counters */
+	fifo->write_count = 0;
+	fifo->read_count[0] = 0;
+	fifo->reader_drops[0] = 0;
+	fifo->drops = 0;
+	fifo->spills = 0;
+	fifo->spill_count = 0;
+	fifo->high_water = 0;
+	fifo->overflow_drops = 0;
+	return 0;
+}
+
+
+/* int8_t str_fifo_set_overflow (str_fifo_t *fifo, int8_t policy,
+ *      const char *spill_filename)
+ *  set overflow policy, open secondary store for spill policy
+ *   fifo - address of fifo
+ *   policy - FIFO_OVERFLOW_...
+ *   spill_filename - secondary store (spill policy only)
+ *
+ *  returns:
+ *   0 - success
+ *   -1 - error
+ */
+int8_t str_fifo_set_overflow (str_fifo_t *fifo, int8_t policy,
+		const char *spill_filename) {
+	if (policy == FIFO_OVERFLOW_SPILL) {
+		/* Records left by previous run are moved to ring first */
+		fifo->spill_fd = open(spill_filename,
+			O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fifo->spill_fd == -1) {
+			printf("Fifo: can't open secondary store %s\n", spill_filename);
+			return -1;
+		}
+		_load_spill(fifo);
+	}
+	fifo->overflow_policy = policy;
+	return 0;
+}
+
+
+/* uint32_t str_fifo_get_reader_drops (str_fifo_t *fifo, uint8_t reader)
+ *  get number of records, which overwrite took away from reader
+ *   fifo - address of fifo
+ *   reader - reader id
+ */
+uint32_t str_fifo_get_reader_drops (str_fifo_t *fifo, uint8_t reader) {
+	return _LOAD_ACQUIRE(&fifo->reader_drops[reader]);
+}
+
+
+/* void str_fifo_get_stats (str_fifo_t *fifo, str_fifo_stats_t *stats)
+ *  get fifo counters, each one is loaded atomically (no locks)
+ *   fifo - address of fifo
+ *   stats - address of where counters are stored
+ */
+void str_fifo_get_stats (str_fifo_t *fifo, str_fifo_stats_t *stats) {
+	stats->drops = _LOAD_ACQUIRE(&fifo->drops);
+	stats->spills = _LOAD_ACQUIRE(&fifo->spills);
+	stats->spill_depth = _LOAD_ACQUIRE(&fifo->spill_count);
+	stats->depth = _get_depth(fifo);
+	stats->high_water = _LOAD_ACQUIRE(&fifo->high_water);
+}
+
+
+/* int8_t str_fifo_init_spsc (str_fifo_t *fifo)
+ *  prepare fifo for single producer, single consumer (per reader) use
+ *  between threads, call after all readers were added
+ *   fifo - address of fifo
+ *
+ *  returns:
+ *   0 - success
+ *   -1 - error
+ */
+int8_t str_fifo_init_spsc (str_fifo_t *fifo) {
+	uint8_t i;
+	for (i=0; i<fifo->num_of_readers; i++) {
+		fifo->notify_fd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fifo->notify_fd[i] == -1) {
+			return -1;
+		}
+	}
+	/* Readers wake up blocked producer */
+	if (fifo->overflow_policy == FIFO_OVERFLOW_BLOCK) {
+		fifo->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fifo->space_fd == -1) {
+			return -1;
+		}
+	}
+	fifo->is_spsc = 1;
+	return 0;
+}
+
+
+/* void str_fifo_clear_notify (str_fifo_t *fifo, uint8_t reader)
+ *  clear pending consumer wake-up (reading eventfd resets its counter)
+ *   fifo - address of fifo
+ *   reader - reader id
+ */
+void str_fifo_clear_notify (str_fifo_t *fifo, uint8_t reader) {
+	uint64_t count;
+	if (fifo->notify_fd[reader] != -1) {
+		/* EAGAIN (nothing pending) is not an error */
+		read(fifo->notify_fd[reader], &count, sizeof(count));
+	}
+}
 
-    tmp_fifo_buf= (char **) malloc(sizeof(char *)*(buf_size+1));
 
-    int32_t i = 0;
+/* FUNCTIONS (LOCAL) **********************************************************/
 
-	for(i=0; i < buf_size+1; i++){
-		char *tmp_p = (char *) malloc(sizeof(char)*(str_size+1));
-		tmp_fifo_buf[i] = tmp_p;
+/* char *_reserve (str_fifo_t *fifo, uint32_t len)
+ *  find contiguous space for string of 'len' chars. Records never wrap
+ *  around the end of the ring, in that case the rest of the ring gets
+ *  padded on commit. If there is not enough space, apply overflow policy.
+ *
+ *  returns pointer to string space, or NULL if full (blocking policy)
+ */
+static char *_reserve (str_fifo_t *fifo, uint32_t len) {
+	fifo->overflow_reserve = FIFO_WRITE_OK;
+
+	/* Keep order, while older records still wait in secondary store */
+	if (fifo->spill_count > 0 && _refill(fifo) != 0) {
+		return _reserve_overflow(fifo, FIFO_WRITE_FULL);
 	}
 
-	fifo->buffer = tmp_fifo_buf;
+	if (_find_space(fifo, len) == 0) {
+		/* Overflow has ended, report it once */
+		if (fifo->overflow_drops > 0) {
+			LOG_WARN("Fifo: overflow ended, %u dropped (address: %p)\n",
+				fifo->overflow_drops, (void *)fifo);
+			fifo->overflow_drops = 0;
+		}
+	}
+	else {
+		switch (fifo->overflow_policy) {
+		case FIFO_OVERFLOW_DROP_OLDEST:
+			/* Consumers own read indexes, drop newest instead */
+			if (fifo->is_spsc == 1) {
+				return _reserve_overflow(fifo, FIFO_WRITE_DROPPED);
+			}
+			/* Allow circular overwrite, drop oldest records */
+			do {
+				_drop_oldest(fifo);
+				_count_drop(fifo);
+			} while (_find_space(fifo, len) != 0);
+			break;
+		case FIFO_OVERFLOW_BLOCK:
+			if (_wait_for_space(fifo, len) != 0) {
+				return NULL;
+			}
+			break;
+		case FIFO_OVERFLOW_SPILL:
+			return _reserve_overflow(fifo, FIFO_WRITE_FULL);
+		default:
+			return _reserve_overflow(fifo, FIFO_WRITE_DROPPED);
+		}
+	}
+
+	return _RECORD_STR(_get_record(fifo, fifo->reserve_idx));
+}
+
+/* int8_t _find_space (str_fifo_t *fifo, uint32_t len)
+ *  set 'reserve_idx' to start of space for string of 'len' chars
+ *
+ *  returns 0 if there is enough space, else 1
+ */
+static int8_t _find_space (str_fifo_t *fifo, uint32_t len) {
+	uint32_t ring_size = fifo->ring_mask + 1;
+	uint32_t record_size = _RECORD_SIZE(len);
+	uint32_t tail = ring_size - (fifo->write_idx & fifo->ring_mask);
+	uint32_t needed = record_size;
+
+	fifo->reserve_idx = fifo->write_idx;
+	/* Doesn't fit before end of ring, start at beginning */
+	if (tail < record_size) {
+		fifo->reserve_idx += tail;
+		needed += tail;
+	}
+
+	if (ring_size - (fifo->write_idx - _get_tail(fifo)) < needed) {
+		return 1;
+	}
 	return 0;
 }
+
+/* char *_reserve_overflow (str_fifo_t *fifo, int8_t result)
+ *  reserve space outside of ring, commit then drops or spills the record
+ *   result - FIFO_WRITE_DROPPED or FIFO_WRITE_FULL (spill)
+ *
+ *  returns pointer to overflow space
+ */
+static char *_reserve_overflow (str_fifo_t *fifo, int8_t result) {
+	fifo->overflow_reserve = result;
+	return fifo->overflow_buf;
+}
+
+/* void _count_drop (str_fifo_t *fifo)
+ *  count dropped record, report only the start of overflow
+ */
+static void _count_drop (str_fifo_t *fifo) {
+	_STORE_RELEASE(&fifo->drops, fifo->drops + 1);
+	if (fifo->overflow_drops == 0) {
+		LOG_WARN("Fifo: overflow, dropping records (address: %p)\n",
+			(void *)fifo);
+	}
+	fifo->overflow_drops++;
+}
+
+/* int8_t _wait_for_space (str_fifo_t *fifo, uint32_t len)
+ *  wait until readers free enough space for string of 'len' chars (spsc
+ *  mode only, in single threaded mode readers can't run in the meantime)
+ *
+ *  returns 0 if there is enough space, else 1 (try again later)
+ */
+static int8_t _wait_for_space (str_fifo_t *fifo, uint32_t len) {
+	struct pollfd space_pfd = {fifo->space_fd, POLLIN, 0};
+	uint64_t count;
+	int8_t status = 1;
+
+	if (fifo->space_fd == -1) {
+		return 1;
+	}
+
+	_STORE_RELEASE(&fifo->is_producer_waiting, 1);
+	_FENCE_SEQ_CST();
+	/* Space could have been freed before flag was seen by readers */
+	while ((status = _find_space(fifo, len)) != 0) {
+		if (poll(&space_pfd, 1, FIFO_BLOCK_WAIT_MS) <= 0) {
+			break;
+		}
+		/* EAGAIN (already cleared) is not an error */
+		read(fifo->space_fd, &count, sizeof(count));
+	}
+	_STORE_RELEASE(&fifo->is_producer_waiting, 0);
+
+	return status;
+}
+
+/* int8_t _spill (str_fifo_t *fifo, uint32_t len, uint64_t stamp)
+ *  append record from overflow space to secondary store (length and stamp
+ *  header, followed by string)
+ *
+ *  returns FIFO_WRITE_OK, or FIFO_WRITE_DROPPED on store error
+ */
+static int8_t _spill (str_fifo_t *fifo, uint32_t len, uint64_t stamp) {
+	uint64_t header[2] = {len, stamp};
+
+	if (pwrite(fifo->spill_fd, header, _SPILL_HEADER_SIZE,
+			fifo->spill_write_off) != _SPILL_HEADER_SIZE ||
+		pwrite(fifo->spill_fd, fifo->overflow_buf, len,
+			fifo->spill_write_off + _SPILL_HEADER_SIZE) != (ssize_t)len) {
+		_count_drop(fifo);
+		return FIFO_WRITE_DROPPED;
+	}
+	if (fifo->spill_count == 0) {
+		LOG_WARN("Fifo: overflow, spilling to secondary store (address: %p)\n",
+			(void *)fifo);
+	}
+	fifo->spill_write_off += _SPILL_HEADER_SIZE + len;
+	_STORE_RELEASE(&fifo->spill_count, fifo->spill_count + 1);
+	_STORE_RELEASE(&fifo->spills, fifo->spills + 1);
+	return FIFO_WRITE_OK;
+}
+
+/* void _load_spill (str_fifo_t *fifo)
+ *  count records, which are left in secondary store (previous run), so they
+ *  are moved to the ring before any new record. Incomplete last record
+ *  (interrupted write) is cut off.
+ */
+static void _load_spill (str_fifo_t *fifo) {
+	uint64_t header[2];
+	off_t size = lseek(fifo->spill_fd, 0, SEEK_END);
+
+	while (size != -1 && fifo->spill_write_off + _SPILL_HEADER_SIZE <=
+			(uint64_t)size) {
+		if (pread(fifo->spill_fd, header, _SPILL_HEADER_SIZE,
+				fifo->spill_write_off) != _SPILL_HEADER_SIZE ||
+				header[0] > fifo->str_size ||
+				fifo->spill_write_off + _SPILL_HEADER_SIZE + header[0] >
+				(uint64_t)size) {
+			break;
+		}
+		fifo->spill_write_off += _SPILL_HEADER_SIZE + header[0];
+		fifo->spill_count++;
+	}
+	if (size != -1 && fifo->spill_write_off < (uint64_t)size &&
+			ftruncate(fifo->spill_fd, fifo->spill_write_off) != 0) {
+		LOG_ERROR("Fifo: secondary store truncate error\n");
+	}
+	if (fifo->spill_count > 0) {
+		LOG_INFO("Fifo: %u records left in secondary store, replaying\n",
+			fifo->spill_count);
+	}
+}
+
+/* int8_t _refill (str_fifo_t *fifo)
+ *  move records from secondary store back to ring, as long as there is
+ *  space. Store gets truncated, once it is empty.
+ *
+ *  returns 0 if secondary store is empty, else 1
+ */
+static int8_t _refill (str_fifo_t *fifo) {
+	uint64_t header[2];
+	uint32_t len;
+	char *slot;
+
+	while (fifo->spill_count > 0) {
+		if (pread(fifo->spill_fd, header, _SPILL_HEADER_SIZE,
+				fifo->spill_read_off) != _SPILL_HEADER_SIZE ||
+				header[0] > fifo->str_size) {
+			break;
+		}
+		len = (uint32_t)header[0];
+		if (_find_space(fifo, len) != 0) {
+			return 1;
+		}
+		slot = _RECORD_STR(_get_record(fifo, fifo->reserve_idx));
+		if (pread(fifo->spill_fd, slot, len,
+				fifo->spill_read_off + _SPILL_HEADER_SIZE) != (ssize_t)len) {
+			break;
+		}
+		str_fifo_commit_stamped(fifo, len, header[1]);
+		fifo->spill_read_off += _SPILL_HEADER_SIZE + len;
+		_STORE_RELEASE(&fifo->spill_count, fifo->spill_count - 1);
+	}
+
+	/* Store is empty (or unreadable, remaining records are lost) */
+	if (fifo->spill_count > 0) {
+		LOG_ERROR("Fifo: secondary store read error, %u dropped\n",
+			fifo->spill_count);
+		_STORE_RELEASE(&fifo->drops, fifo->drops + fifo->spill_count);
+		_STORE_RELEASE(&fifo->spill_count, 0);
+	}
+	else {
+		LOG_INFO("Fifo: secondary store drained (address: %p)\n", (void *)fifo);
+	}
+	if (ftruncate(fifo->spill_fd, 0) != 0) {
+		LOG_ERROR("Fifo: secondary store truncate error\n");
+	}
+	fifo->spill_read_off = 0;
+	fifo->spill_write_off = 0;
+	return 0;
+}
+
+/* uint32_t _get_tail (str_fifo_t *fifo)
+ *  find oldest record, which is still in use by any reader and keep it in
+ *  'read_idx' (producer only)
+ *
+ *  returns read index of the slowest reader
+ */
+static uint32_t _get_tail (str_fifo_t *fifo) {
+	uint32_t tail = _LOAD_ACQUIRE(&fifo->reader_idx[0]);
+	uint32_t idx;
+	uint8_t i;
+
+	for (i=1; i<fifo->num_of_readers; i++) {
+		idx = _LOAD_ACQUIRE(&fifo->reader_idx[i]);
+		/* Unsigned distance handles index wrap-around */
+		if (fifo->write_idx - idx > fifo->write_idx - tail) {
+			tail = idx;
+		}
+	}
+	fifo->read_idx = tail;
+	return tail;
+}
+
+/* void _drop_oldest (str_fifo_t *fifo)
+ *  move all readers, which point to the oldest record, past it (single
+ *  threaded use only)
+ */
+static void _drop_oldest (str_fifo_t *fifo) {
+	uint32_t tail = _get_tail(fifo);
+	uint8_t i;
+
+	for (i=0; i<fifo->num_of_readers; i++) {
+		if (fifo->reader_idx[i] == tail &&
+				str_fifo_release_reader(fifo, i) == 0) {
+			_STORE_RELEASE(&fifo->reader_drops[i], fifo->reader_drops[i] + 1);
+		}
+	}
+}
+
+/* uint32_t *_get_record (str_fifo_t *fifo, uint32_t idx)
+ *  get record header at free running index
+ */
+static uint32_t *_get_record (str_fifo_t *fifo, uint32_t idx) {
+	return (uint32_t *)(fifo->buffer + (idx & fifo->ring_mask));
+}
+
+/* uint32_t *_skip_padding (str_fifo_t *fifo, uint32_t *idx)
+ *  get record header at read index, skip (and release) padding at the end
+ *  of the ring
+ *
+ *  returns pointer to record header, or NULL if fifo is empty
+ */
+static uint32_t *_skip_padding (str_fifo_t *fifo, uint32_t *idx) {
+	uint32_t *record;
+
+	if (_LOAD_ACQUIRE(&fifo->write_idx) == *idx) {
+		return NULL;
+	}
+	record = _get_record(fifo, *idx);
+	if (*record == FIFO_RECORD_PADDING) {
+		/* Padding is never the last record */
+		_STORE_RELEASE(idx, (*idx | fifo->ring_mask) + 1);
+		record = _get_record(fifo, *idx);
+	}
+	return record;
+}
+
+/* void _notify (str_fifo_t *fifo)
+ *  wake up consumer thread
+ */
+static void _notify (str_fifo_t *fifo) {
+	uint64_t one = 1;
+	uint8_t i;
+
+	for (i=0; i<fifo->num_of_readers; i++) {
+	    if (fifo->notify_fd[i] != -1) {
+	    	if (write(fifo->notify_fd[i], &one, sizeof(one)) != sizeof(one)) {
+	    		LOG_ERROR("Fifo: notify error (address: %p)\n", (void *)fifo);
+	    	}
+	    }
+	}
+}
+
+/* uint32_t _get_depth (str_fifo_t *fifo)
+ *  get number of records, not yet released by the slowest reader
+ */
+static uint32_t _get_depth (str_fifo_t *fifo) {
+	uint32_t write_count = _LOAD_ACQUIRE(&fifo->write_count);
+	uint32_t depth = 0;
+	uint8_t i;
+
+	for (i=0; i<fifo->num_of_readers; i++) {
+		if (write_count - _LOAD_ACQUIRE(&fifo->read_count[i]) > depth) {
+			depth = write_count - _LOAD_ACQUIRE(&fifo->read_count[i]);
+		}
+	}
+	return depth;
+}
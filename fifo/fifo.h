@@ -6,13 +6,108 @@
 
 #define FIFO_STRING_SIZE                    (512)
 
+/* Ring buffer alignment and record (length header) alignment */
+#define FIFO_CACHE_LINE_SIZE                (64)
+#define FIFO_RECORD_ALIGN                   (8)
+/* Length value, which marks unused space at the end of the ring */
+#define FIFO_RECORD_PADDING                 (0xFFFFFFFF)
+/* Max number of readers (consumers) of a single fifo */
+#define FIFO_MAX_READERS                    (4)
 
+/* Overflow policies (what happens to a new record, when the ring is full)
+ *  DROP_OLDEST - circular overwrite, readers lose their oldest records
+ *                (single threaded only, drops newest in spsc mode)
+ *  DROP_NEWEST - new record is discarded
+ *  BLOCK       - producer waits for readers to free space (spsc mode),
+ *                or gets FIFO_WRITE_FULL and has to try again later
+ *  SPILL       - new records go to a secondary store (file), and are moved
+ *                back to the ring in order, once there is space again
+ */
+#define FIFO_OVERFLOW_DROP_OLDEST           (0)
+#define FIFO_OVERFLOW_DROP_NEWEST           (1)
+#define FIFO_OVERFLOW_BLOCK                 (2)
+#define FIFO_OVERFLOW_SPILL                 (3)
+
+/* Max time, that blocked producer waits for space in one go [ms] */
+#define FIFO_BLOCK_WAIT_MS                  (1000)
+
+/* Write (commit) results */
+#define FIFO_WRITE_OK                       (0)
+#define FIFO_WRITE_DROPPED                  (1)
+#define FIFO_WRITE_FULL                     (2)
+
+
+/* Fifo counters, see 'str_fifo_get_stats' */
+struct _str_fifo_stats {
+	/* Records dropped on overflow (oldest or newest) */
+	uint32_t drops;
+	/* Records moved to secondary store, and those still waiting there */
+	uint32_t spills;
+	uint32_t spill_depth;
+	/* Records not yet released by the slowest reader, and its max value */
+	uint32_t depth;
+	uint32_t high_water;
+};
+
+typedef struct _str_fifo_stats str_fifo_stats_t;
+
+
+/* Strings are kept as variable length records in a single contiguous ring
+ * buffer (power of two size). Each record is a header (length and optional
+ * time stamp), followed by the string and '\0'. Indexes are free running
+ * byte offsets, masked with 'ring_mask' on access.
+ *
+ * Each reader (consumer) has its own read index, so one record can feed
+ * several consumers without being copied. Space is reused only after all
+ * readers have released the record.
+ *
+ * Indexes are accessed with acquire/release semantics, so that a single
+ * producer and a single consumer (per reader) can run on separate threads.
+ */
 struct _str_fifo {
+	/* Oldest record in use by any reader (tail, producer only) */
 	uint32_t read_idx;
 	uint32_t write_idx;
+	/* Nominal number of strings (only used for sizing the ring) */
 	uint32_t buf_size;
+	/* Max string length */
 	uint32_t str_size;
-	char **buffer;
+	char *buffer;
+	uint32_t ring_mask;
+	/* Start of reserved record (producer only) */
+	uint32_t reserve_idx;
+	/* Producer and consumer on separate threads (drop newest on overflow) */
+	int8_t is_spsc;
+	/* Read index of each reader */
+	uint8_t num_of_readers;
+	uint32_t reader_idx[FIFO_MAX_READERS];
+	/* Consumer wake-up (eventfd) of each reader, -1 if not used */
+	int notify_fd[FIFO_MAX_READERS];
+	/* Overflow handling (FIFO_OVERFLOW_...) */
+	int8_t overflow_policy;
+	/* Space for records, which don't go to the ring (dropped, spilled) */
+	char *overflow_buf;
+	/* Reserved space is 'overflow_buf', not ring (FIFO_WRITE_...) */
+	int8_t overflow_reserve;
+	/* Producer wake-up (eventfd) for blocking policy, -1 if not used */
+	int space_fd;
+	uint8_t is_producer_waiting;
+	/* Secondary store (spill policy), -1 if not used */
+	int spill_fd;
+	uint32_t spill_read_off;
+	uint32_t spill_write_off;
+	/* Records written (producer) and released (each reader) */
+	uint32_t write_count;
+	uint32_t read_count[FIFO_MAX_READERS];
+	/* Records dropped (oldest), before each reader released them */
+	uint32_t reader_drops[FIFO_MAX_READERS];
+	/* Counters (producer only) */
+	uint32_t drops;
+	uint32_t spills;
+	uint32_t spill_count;
+	uint32_t high_water;
+	/* Drops since overflow started, reported once at start and end */
+	uint32_t overflow_drops;
 };
 
 typedef struct _str_fifo str_fifo_t;
@@ -33,10 +128,124 @@ int8_t str_fifo_read_auto_inc(str_fifo_t *fifo, char *data);
  *   fifo - address of fifo for writing
  *   data - address of data to be written into fifo
  *
- *   returns 0 if data was successfully written, else 1
+ *   returns FIFO_WRITE_OK if data was successfully written (or spilled),
+ *   FIFO_WRITE_DROPPED if it was dropped, FIFO_WRITE_FULL if it has to be
+ *   written again later (blocking policy)
  */
 int8_t str_fifo_write(str_fifo_t *fifo, char *data);
 
+/* int8_t str_fifo_write_stamped(str_fifo_t *fifo, const char *data,
+ *      uint32_t len, uint64_t stamp)
+ *  same as 'str_fifo_write', for data of known length (no need for '\0'),
+ *  record also keeps a time stamp
+ *   len - data length (cut to str_size)
+ *   stamp - time stamp (any unit, 0 means none)
+ */
+int8_t str_fifo_write_stamped(str_fifo_t *fifo, const char *data,
+	uint32_t len, uint64_t stamp);
+
+/* char *str_fifo_reserve(str_fifo_t *fifo)
+ *  get free space for writing in place (zero-copy), publish it with
+ *  'str_fifo_commit'. Space holds str_size chars and terminating '\0'.
+ *  If there is not enough space, fifo's overflow policy applies.
+ *   fifo - address of fifo for writing
+ *
+ *   returns pointer to space, or NULL if fifo is full (blocking policy),
+ *   in that case producer should leave its data and try again later
+ */
+char *str_fifo_reserve(str_fifo_t *fifo);
+
+/* int8_t str_fifo_commit(str_fifo_t *fifo, uint32_t len)
+ *  publish record, previously returned by 'str_fifo_reserve', '\0' gets
+ *  added at the end
+ *   fifo - address of fifo for writing
+ *   len - string length (without '\0')
+ *
+ *   returns FIFO_WRITE_OK if data was successfully written (or spilled),
+ *   else FIFO_WRITE_DROPPED
+ */
+int8_t str_fifo_commit(str_fifo_t *fifo, uint32_t len);
+
+/* int8_t str_fifo_commit_stamped(str_fifo_t *fifo, uint32_t len,
+ *      uint64_t stamp)
+ *  same as 'str_fifo_commit', record also keeps a time stamp
+ *   stamp - time stamp (any unit, 0 means none)
+ */
+int8_t str_fifo_commit_stamped(str_fifo_t *fifo, uint32_t len, uint64_t stamp);
+
+/* char *str_fifo_peek(str_fifo_t *fifo)
+ *  get oldest record for reading in place (zero-copy), free it with
+ *  'str_fifo_release'. String stays valid until released (or overwritten
+ *  on overflow).
+ *   fifo - address of fifo for reading
+ *
+ *   returns pointer to string, or NULL if fifo is empty
+ */
+char *str_fifo_peek(str_fifo_t *fifo);
+
+/* uint32_t str_fifo_get_len(const char *str)
+ *  get length of peeked record (may contain '\0' before the end)
+ *   str - string, returned by 'str_fifo_peek' or 'str_fifo_peek_reader'
+ *
+ *   returns string length (without terminating '\0')
+ */
+uint32_t str_fifo_get_len(const char *str);
+
+/* uint64_t str_fifo_get_stamp(const char *str)
+ *  get time stamp of peeked record (valid until released)
+ *   str - string, returned by 'str_fifo_peek' or 'str_fifo_peek_reader'
+ *
+ *   returns time stamp, 0 if record was written without it
+ */
+uint64_t str_fifo_get_stamp(const char *str);
+
+/* int8_t str_fifo_release(str_fifo_t *fifo)
+ *  free oldest record, previously returned by 'str_fifo_peek'
+ *   fifo - address of fifo for reading
+ *
+ *   returns 0 on success, 1 if fifo is empty
+ */
+int8_t str_fifo_release(str_fifo_t *fifo);
+
+/* char *str_fifo_peek_reader(str_fifo_t *fifo, uint8_t reader)
+ *  same as 'str_fifo_peek', for the given reader
+ *   fifo - address of fifo for reading
+ *   reader - reader id (0 is the default reader)
+ *
+ *   returns pointer to string, or NULL if fifo is empty (for this reader)
+ */
+char *str_fifo_peek_reader(str_fifo_t *fifo, uint8_t reader);
+
+/* char *str_fifo_peek_next(str_fifo_t *fifo, const char *str)
+ *  get record after 'str' (returned by peek), for reading several records
+ *  in place. Records stay in fifo until released one by one. DROP_OLDEST
+ *  overwrite in between takes them away, check 'str_fifo_get_reader_drops'
+ *  before using 'str' again.
+ *   fifo - address of fifo for reading
+ *   str - string, returned by any peek
+ *
+ *   returns pointer to string, or NULL if 'str' is the newest record
+ */
+char *str_fifo_peek_next(str_fifo_t *fifo, const char *str);
+
+/* int8_t str_fifo_release_reader(str_fifo_t *fifo, uint8_t reader)
+ *  same as 'str_fifo_release', for the given reader. Space is reused only
+ *  after all readers have released the record.
+ *   fifo - address of fifo for reading
+ *   reader - reader id (0 is the default reader)
+ *
+ *   returns 0 on success, 1 if fifo is empty (for this reader)
+ */
+int8_t str_fifo_release_reader(str_fifo_t *fifo, uint8_t reader);
+
+/* int8_t str_fifo_add_reader(str_fifo_t *fifo)
+ *  add reader, which gets every record published from now on
+ *   fifo - address of fifo
+ *
+ *   returns reader id, or -1 if there are too many readers
+ */
+int8_t str_fifo_add_reader(str_fifo_t *fifo);
+
 /* int str_increment_read(str_fifo_t *fifo)
  *  manually increment fifo read pointer, only turn fifo after incrementation
  *   fifo - address of fifo for writing
@@ -58,4 +267,59 @@ int8_t fifo_increment_read_idx(str_fifo_t *fifo);
  */
 int8_t setup_str_fifo (str_fifo_t *fifo, int32_t buf_size, int32_t str_size);
 
+/* int8_t str_fifo_set_overflow (str_fifo_t *fifo, int8_t policy,
+ *      const char *spill_filename)
+ *  set what happens when fifo is full (default: FIFO_OVERFLOW_DROP_OLDEST).
+ *  Call after 'setup_str_fifo' and before 'str_fifo_init_spsc'.
+ *   fifo - address of fifo
+ *   policy - FIFO_OVERFLOW_...
+ *   spill_filename - secondary store (spill policy only, else NULL),
+ *      records left in it (previous run) are moved to the ring before the
+ *      next new record
+ *
+ *  returns:
+ *   0 - success
+ *   -1 - error
+ */
+int8_t str_fifo_set_overflow (str_fifo_t *fifo, int8_t policy,
+	const char *spill_filename);
+
+/* uint32_t str_fifo_get_reader_drops (str_fifo_t *fifo, uint8_t reader)
+ *  get number of records, which DROP_OLDEST overwrite took away from reader
+ *  (oldest ones, before reader released them), counter wraps around
+ *   fifo - address of fifo
+ *   reader - reader id (0 is the default reader)
+ *
+ *   returns number of dropped records
+ */
+uint32_t str_fifo_get_reader_drops (str_fifo_t *fifo, uint8_t reader);
+
+/* void str_fifo_get_stats (str_fifo_t *fifo, str_fifo_stats_t *stats)
+ *  get fifo counters (cheap, no locks, may be called from any thread)
+ *   fifo - address of fifo
+ *   stats - address of where counters are stored
+ */
+void str_fifo_get_stats (str_fifo_t *fifo, str_fifo_stats_t *stats);
+
+/* int8_t str_fifo_init_spsc (str_fifo_t *fifo)
+ *  prepare fifo for single producer, single consumer (per reader) use
+ *  between threads: create eventfd for each reader, which gets signalled
+ *  on each write. Producer never touches read indexes, so oldest data can't
+ *  be dropped on overflow (newest is dropped instead). Call after all
+ *  readers were added.
+ *   fifo - address of fifo
+ *
+ *  returns:
+ *   0 - success
+ *   -1 - error
+ */
+int8_t str_fifo_init_spsc (str_fifo_t *fifo);
+
+/* void str_fifo_clear_notify (str_fifo_t *fifo, uint8_t reader)
+ *  clear pending consumer wake-up, call before checking fifo for data
+ *   fifo - address of fifo
+ *   reader - reader id
+ */
+void str_fifo_clear_notify (str_fifo_t *fifo, uint8_t reader);
+
 #endif //FIFO_H_
@@ -0,0 +1,334 @@
+#include "http_response.h"
+
+#include <stdint.h>         /* Data types */
+#include <stdlib.h>         /* strtoll, strtoull */
+#include <string.h>         /* memchr, memcpy, strncmp */
+#include <strings.h>        /* strncasecmp */
+
+
+/* Parser states */
+#define _STATE_STATUS_LINE          (0)
+#define _STATE_HEADER               (1)
+#define _STATE_BODY                 (2)     /* Content-Length bytes */
+#define _STATE_BODY_UNTIL_CLOSE     (3)
+#define _STATE_CHUNK_SIZE           (4)
+#define _STATE_CHUNK_DATA           (5)
+#define _STATE_CHUNK_END            (6)     /* Line ending after chunk data */
+#define _STATE_TRAILER              (7)
+#define _STATE_DONE                 (8)
+
+
+/* PROTOTYPES *****************************************************************/
+
+static int8_t _is_line_state (const http_response_t *response);
+static void _add_line (http_response_t *response, const char *src,
+    uint32_t len);
+static void _add_body (http_response_t *response, const char *src,
+    uint32_t len);
+static int8_t _parse_line (http_response_t *response);
+static int8_t _parse_status_line (http_response_t *response);
+static int8_t _parse_header (http_response_t *response);
+static int8_t _parse_chunk_size (http_response_t *response);
+static void _start_body (http_response_t *response);
+static int8_t _has_token (const char *value, const char *token);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Reset parser.
+ */
+void http_response_init (http_response_t *response) {
+    response->state = _STATE_STATUS_LINE;
+    response->status = 0;
+    response->is_close = 0;
+    response->is_chunked = 0;
+    response->content_len = -1;
+    response->body_left = 0;
+    response->len = 0;
+    response->line[0] = '\0';
+    response->line_len = 0;
+    response->body[0] = '\0';
+    response->body_len = 0;
+}
+
+/*  Take chunk line by line, until body starts. Body bytes are taken in one
+ *  go, up to body (or chunk) length.
+ */
+int8_t http_response_feed (http_response_t *response, const char *chunk,
+        uint32_t len, uint32_t *offset) {
+    const char *p = chunk + *offset;
+    const char *end = chunk + len;
+    const char *eol;
+    uint64_t n;
+    int8_t status = 1;
+
+    while (p < end && response->state != _STATE_DONE) {
+        if (_is_line_state(response) == 1) {
+            eol = memchr(p, '\n', end - p);
+            n = ((eol != NULL) ? eol : end) - p;
+            _add_line(response, p, n);
+            p += n;
+            if (eol == NULL) {
+                break;
+            }
+            /* Line ending */
+            p++;
+            if (_parse_line(response) != 0) {
+                status = -1;
+                break;
+            }
+            continue;
+        }
+
+        n = end - p;
+        if (response->state != _STATE_BODY_UNTIL_CLOSE &&
+                n > response->body_left) {
+            n = response->body_left;
+        }
+        _add_body(response, p, n);
+        p += n;
+        if (response->state == _STATE_BODY_UNTIL_CLOSE) {
+            continue;
+        }
+        response->body_left -= n;
+        if (response->body_left == 0) {
+            response->state = (response->state == _STATE_CHUNK_DATA) ?
+                _STATE_CHUNK_END : _STATE_DONE;
+        }
+    }
+
+    response->len += p - (chunk + *offset);
+    *offset = p - chunk;
+    if (status == 1 && response->state == _STATE_DONE) {
+        status = 0;
+    }
+    return status;
+}
+
+/*  Complete body, which is delimited by closing the connection.
+ */
+int8_t http_response_close (http_response_t *response) {
+    if (response->state == _STATE_BODY_UNTIL_CLOSE) {
+        response->state = _STATE_DONE;
+        return 0;
+    }
+    return (response->state == _STATE_DONE) ? 0 : -1;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Check if parser is collecting a line (not body bytes).
+ *  return: 1 for line, 0 for body
+ */
+static int8_t _is_line_state (const http_response_t *response) {
+    switch (response->state) {
+    case _STATE_BODY:
+    case _STATE_BODY_UNTIL_CLOSE:
+    case _STATE_CHUNK_DATA:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/*  Append to current line, part that doesn't fit is dropped.
+ */
+static void _add_line (http_response_t *response, const char *src,
+        uint32_t len) {
+    uint32_t free_len = HTTP_RESPONSE_LINE_SIZE - 1 - response->line_len;
+
+    if (len > free_len) {
+        len = free_len;
+    }
+    memcpy(&response->line[response->line_len], src, len);
+    response->line_len += len;
+}
+
+/*  Keep start of body, rest is skipped.
+ */
+static void _add_body (http_response_t *response, const char *src,
+        uint32_t len) {
+    uint32_t free_len = HTTP_RESPONSE_BODY_SIZE - 1 - response->body_len;
+
+    if (len > free_len) {
+        len = free_len;
+    }
+    memcpy(&response->body[response->body_len], src, len);
+    response->body_len += len;
+    response->body[response->body_len] = '\0';
+}
+
+/*  Handle complete line (line ending was just taken).
+ *  return: 0 on success, -1 on malformed line
+ */
+static int8_t _parse_line (http_response_t *response) {
+    int8_t result = 0;
+
+    /* Line ending is CRLF, bare LF is accepted too */
+    if (response->line_len > 0 &&
+            response->line[response->line_len - 1] == '\r') {
+        response->line_len--;
+    }
+    response->line[response->line_len] = '\0';
+
+    switch (response->state) {
+    case _STATE_STATUS_LINE:
+        /* Empty lines before status line are ignored */
+        if (response->line_len > 0) {
+            result = _parse_status_line(response);
+        }
+        break;
+    case _STATE_HEADER:
+        if (response->line_len == 0) {
+            _start_body(response);
+        } else {
+            result = _parse_header(response);
+        }
+        break;
+    case _STATE_CHUNK_SIZE:
+        result = _parse_chunk_size(response);
+        break;
+    case _STATE_CHUNK_END:
+        if (response->line_len > 0) {
+            result = -1;
+        }
+        response->state = _STATE_CHUNK_SIZE;
+        break;
+    case _STATE_TRAILER:
+        /* Trailer fields are ignored, blank line ends response */
+        if (response->line_len == 0) {
+            response->state = _STATE_DONE;
+        }
+        break;
+    default:
+        break;
+    }
+
+    response->line_len = 0;
+    return result;
+}
+
+/*  Parse status line: "HTTP/1.x <3 digit code> <reason>".
+ *  return: 0 on success, -1 on malformed line
+ */
+static int8_t _parse_status_line (http_response_t *response) {
+    const char *line = response->line;
+    uint32_t i;
+
+    if (response->line_len < 12 || strncmp(line, "HTTP/1.", 7) != 0 ||
+            line[8] != ' ') {
+        return -1;
+    }
+    response->status = 0;
+    for (i = 9; i < 12; i++) {
+        if (line[i] < '0' || line[i] > '9') {
+            return -1;
+        }
+        response->status = response->status * 10 + (line[i] - '0');
+    }
+    /* HTTP/1.0 closes connection, unless asked to keep it */
+    response->is_close = (line[7] == '0') ? 1 : 0;
+    response->state = _STATE_HEADER;
+    return 0;
+}
+
+/*  Parse header field, only ones defining body length and connection
+ *  reuse are used.
+ *  return: 0 on success, -1 on malformed field value
+ */
+static int8_t _parse_header (http_response_t *response) {
+    char *line = response->line;
+    char *value = memchr(line, ':', response->line_len);
+    char *end;
+    size_t name_len;
+
+    /* Not a field, ignored */
+    if (value == NULL) {
+        return 0;
+    }
+    name_len = value - line;
+    value++;
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+
+    if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+        response->content_len = strtoll(value, &end, 10);
+        if (end == value || response->content_len < 0) {
+            return -1;
+        }
+    } else if (name_len == 17 &&
+            strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+        if (_has_token(value, "chunked") == 1) {
+            response->is_chunked = 1;
+        }
+    } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+        if (_has_token(value, "close") == 1) {
+            response->is_close = 1;
+        } else if (_has_token(value, "keep-alive") == 1) {
+            response->is_close = 0;
+        }
+    }
+    return 0;
+}
+
+/*  Parse chunk size line (hex, extensions after ';' are ignored).
+ *  return: 0 on success, -1 on malformed line
+ */
+static int8_t _parse_chunk_size (http_response_t *response) {
+    char *end;
+
+    response->body_left = strtoull(response->line, &end, 16);
+    if (end == response->line) {
+        return -1;
+    }
+    /* Last chunk is empty, trailer follows */
+    response->state = (response->body_left == 0) ?
+        _STATE_TRAILER : _STATE_CHUNK_DATA;
+    return 0;
+}
+
+/*  Pick body delimitation after header ended. Chunked coding overrides
+ *  Content-Length.
+ */
+static void _start_body (http_response_t *response) {
+    if (response->status < 200 || response->status == 204 ||
+            response->status == 304) {
+        response->state = _STATE_DONE;
+    } else if (response->is_chunked == 1) {
+        response->state = _STATE_CHUNK_SIZE;
+    } else if (response->content_len >= 0) {
+        response->body_left = response->content_len;
+        response->state = (response->body_left == 0) ?
+            _STATE_DONE : _STATE_BODY;
+    } else {
+        /* Connection can't carry another response */
+        response->is_close = 1;
+        response->state = _STATE_BODY_UNTIL_CLOSE;
+    }
+}
+
+/*  Check comma separated field value for token (case insensitive).
+ *  return: 1 if value has token, 0 otherwise
+ */
+static int8_t _has_token (const char *value, const char *token) {
+    size_t token_len = strlen(token);
+    const char *p = value;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (strncasecmp(p, token, token_len) == 0 &&
+                (p[token_len] == '\0' || p[token_len] == ',' ||
+                p[token_len] == ' ' || p[token_len] == '\t' ||
+                p[token_len] == ';')) {
+            return 1;
+        }
+        while (*p != '\0' && *p != ',') {
+            p++;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+/*
+ *  Incremental HTTP/1.1 response parser. Received chunks are fed one after
+ *  another, parser stops right after the end of response, so following
+ *  (pipelined) responses stay in the chunk for the next one. Status line
+ *  and headers are parsed line by line, body is delimited by
+ *  Content-Length, chunked transfer coding, or by closing the connection.
+ *
+ *  Only the start of the body is kept (for reporting), the rest is skipped,
+ *  so any body length is accepted. Header lines are cut to line buffer
+ *  size, fields used here are short.
+ *
+ *	Useful links:
+ *		RFC 9112 (HTTP/1.1): https://www.rfc-editor.org/rfc/rfc9112
+ */
+
+#include <stdint.h>         /* Data types */
+
+
+/* Kept header line length (longer part is skipped), including '\0' */
+#define HTTP_RESPONSE_LINE_SIZE             (256)
+
+/* Kept start of body, including '\0' */
+#ifndef HTTP_RESPONSE_BODY_SIZE
+#define HTTP_RESPONSE_BODY_SIZE             (256)
+#endif
+
+
+struct _http_response {
+    /* Parser state (internal) */
+    uint8_t state;
+    /* Status code, 0 until status line is parsed */
+    uint16_t status;
+    /* Server closes connection after this response */
+    uint8_t is_close;
+    /* Body is sent in chunks */
+    uint8_t is_chunked;
+    /* Content-Length, -1 if not given */
+    int64_t content_len;
+    /* Bytes left in body (or current chunk) */
+    uint64_t body_left;
+    /* Bytes taken so far (whole response) */
+    uint64_t len;
+    /* Line being parsed (without line ending) */
+    char line[HTTP_RESPONSE_LINE_SIZE];
+    uint32_t line_len;
+    /* Start of body ('\0' terminated) */
+    char body[HTTP_RESPONSE_BODY_SIZE];
+    uint32_t body_len;
+};
+
+typedef struct _http_response http_response_t;
+
+
+/*  Reset parser (look for next status line).
+ *   p1: pointer to parser
+ */
+void http_response_init (http_response_t *response);
+
+/*  Parse chunk from offset on, until response is complete or chunk ends.
+ *   p1: pointer to parser
+ *   p2: chunk
+ *   p3: chunk length
+ *   p4: pointer to parse offset within chunk, advanced past taken bytes
+ *  return: 0 when response is complete, 1 when chunk was taken to the end,
+ *   -1 on malformed response (connection can't be used anymore)
+ */
+int8_t http_response_feed (http_response_t *response, const char *chunk,
+    uint32_t len, uint32_t *offset);
+
+/*  End response, after server closed connection.
+ *   p1: pointer to parser
+ *  return: 0 if response is complete now (body ends with connection), -1
+ *   if it was cut off
+ */
+int8_t http_response_close (http_response_t *response);
+
+
+#endif
@@ -0,0 +1,232 @@
+#include "json_framer.h"
+#include "../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* memchr, memcpy */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>      /* SSE2 intrinsics */
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>       /* NEON intrinsics */
+#endif
+
+
+/* Bytes per scanned block, and mask bits per byte */
+#define _BLOCK_SIZE                 (16)
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(__SSE2__)
+#define _MASK_BITS                  (4)
+#else
+#define _MASK_BITS                  (1)
+#endif
+#define _BYTE_MASK(i)               \
+    ((((uint64_t)1 << _MASK_BITS) - 1) << ((i) * _MASK_BITS))
+
+/* Block scan results */
+#define _BLOCK_COPY                 (0)
+#define _BLOCK_OBJECT_END           (1)
+#define _BLOCK_INVALID              (2)
+
+
+/* PROTOTYPES *****************************************************************/
+
+static uint64_t _get_structural_mask (const char *p, uint32_t len);
+static int8_t _append (json_framer_t *framer, const char *src, uint32_t len);
+static void _start_object (json_framer_t *framer, uint64_t stamp);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Reset framer.
+ */
+void json_framer_init (json_framer_t *framer) {
+    framer->len = 0;
+    framer->depth = 0;
+    framer->max_depth = 0;
+    framer->is_in_string = 0;
+    framer->is_escaped = 0;
+    framer->arrival_ns = 0;
+}
+
+/*  Scan chunk for (rest of) object. Outside of objects only opening braces
+ *  matter. Inside of them, chunk is handled in blocks: each block gets
+ *  copied in one go, only its structural chars (bits of block's mask) are
+ *  looked at one by one.
+ */
+int8_t json_framer_feed (json_framer_t *framer, const char *chunk,
+        uint32_t len, uint32_t *offset, uint64_t stamp) {
+    const char *p = chunk + *offset;
+    const char *end = chunk + len;
+    const char *next;
+    uint32_t block_len;
+    uint64_t mask;
+    uint32_t i;
+    int8_t block_status;
+    char c;
+
+    while (p < end) {
+        /* Outside of object, skip to opening braces */
+        if (framer->depth == 0) {
+            next = memchr(p, '{', end - p);
+            if (next == NULL) {
+                break;
+            }
+            _start_object(framer, stamp);
+            p = next + 1;
+            continue;
+        }
+
+        block_len = (end - p < _BLOCK_SIZE) ? end - p : _BLOCK_SIZE;
+        mask = _get_structural_mask(p, block_len);
+
+        /* First char was escaped by backslash at the end of previous block */
+        if (framer->is_escaped == 1) {
+            framer->is_escaped = 0;
+            mask &= ~_BYTE_MASK(0);
+        }
+
+        /* Whole block belongs to object, unless it ends (or breaks) here */
+        block_status = _BLOCK_COPY;
+        while (mask != 0) {
+            i = __builtin_ctzll(mask) / _MASK_BITS;
+            mask &= ~_BYTE_MASK(i);
+            c = p[i];
+
+            if (c == '\\') {
+                if (framer->is_in_string == 1) {
+                    /* Next char is escaped, could be in next block */
+                    if (i + 1 < block_len) {
+                        mask &= ~_BYTE_MASK(i + 1);
+                    } else {
+                        framer->is_escaped = 1;
+                    }
+                }
+            }
+            else if (c == '"') {
+                framer->is_in_string ^= 1;
+            }
+            else if (c == '\0') {
+                block_status = _BLOCK_INVALID;
+                break;
+            }
+            else if (framer->is_in_string == 0) {
+                if (c == '{') {
+                    framer->depth++;
+                    if (framer->depth > framer->max_depth) {
+                        framer->max_depth = framer->depth;
+                    }
+                }
+                else if (--framer->depth == 0) {
+                    block_status = _BLOCK_OBJECT_END;
+                    break;
+                }
+            }
+        }
+
+        if (block_status == _BLOCK_COPY) {
+            _append(framer, p, block_len);
+            p += block_len;
+            continue;
+        }
+
+        /* Serial data is not JSON, drop object */
+        if (block_status == _BLOCK_INVALID) {
+            json_framer_init(framer);
+            p += i + 1;
+            continue;
+        }
+
+        /* Complete, only outer object of whole message is valid */
+        if (_append(framer, p, i + 1) == 0 &&
+                framer->max_depth >= JSON_FRAMER_MIN_DEPTH) {
+            JSON_FRAMER_OBJECT(framer)[framer->len] = '\0';
+            *offset = (p + i + 1) - chunk;
+            return 0;
+        }
+        json_framer_init(framer);
+        p += i + 1;
+    }
+
+    *offset = len;
+    return 1;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Get mask of structural chars ('{', '}', '"', '\', '\0') in block.
+ *   p1: pointer to block
+ *   p2: block length (up to _BLOCK_SIZE, SIMD is used for full blocks)
+ *  return: mask, _MASK_BITS bits for each byte (lowest for first byte)
+ */
+static uint64_t _get_structural_mask (const char *p, uint32_t len) {
+    uint64_t mask = 0;
+    uint32_t i;
+
+#if defined(__SSE2__)
+    if (len == _BLOCK_SIZE) {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(block, _mm_set1_epi8('{')),
+                _mm_cmpeq_epi8(block, _mm_set1_epi8('}'))),
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+                    _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))),
+                _mm_cmpeq_epi8(block, _mm_setzero_si128())));
+        return (uint64_t)_mm_movemask_epi8(match);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    if (len == _BLOCK_SIZE) {
+        uint8x16_t block = vld1q_u8((const uint8_t *)p);
+        uint8x16_t match = vorrq_u8(
+            vorrq_u8(
+                vceqq_u8(block, vdupq_n_u8('{')),
+                vceqq_u8(block, vdupq_n_u8('}'))),
+            vorrq_u8(
+                vorrq_u8(
+                    vceqq_u8(block, vdupq_n_u8('"')),
+                    vceqq_u8(block, vdupq_n_u8('\\'))),
+                vceqzq_u8(block)));
+        /* Narrow each byte to 4 bits of a 64 bit mask */
+        return vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+    }
+#endif
+
+    /* Partial block (or no SIMD) */
+    for (i=0; i<len; i++) {
+        if (p[i] == '{' || p[i] == '}' || p[i] == '"' || p[i] == '\\' ||
+                p[i] == '\0') {
+            mask |= _BYTE_MASK(i);
+        }
+    }
+    return mask;
+}
+
+/*  Append bytes to object, drop object if it gets too long (space for '\0'
+ *  is kept).
+ *  return: 0 on success, 1 if object was dropped
+ */
+static int8_t _append (json_framer_t *framer, const char *src, uint32_t len) {
+    if (framer->len + len > JSON_FRAMER_BUFFER_SIZE - 1) {
+        LOG_WARN("Error: incoming too long, json buffer full\n");
+        json_framer_init(framer);
+        return 1;
+    }
+    memcpy(&JSON_FRAMER_OBJECT(framer)[framer->len], src, len);
+    framer->len += len;
+    return 0;
+}
+
+/*  Start new object with its opening braces.
+ */
+static void _start_object (json_framer_t *framer, uint64_t stamp) {
+    json_framer_init(framer);
+    JSON_FRAMER_OBJECT(framer)[0] = '{';
+    framer->len = 1;
+    framer->depth = 1;
+    framer->max_depth = 1;
+    framer->arrival_ns = stamp;
+}
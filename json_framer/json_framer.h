@@ -0,0 +1,77 @@
+#ifndef JSON_FRAMER_H
+#define JSON_FRAMER_H
+
+/*
+ *  Incremental JSON framer. Raw serial chunks are fed one after another,
+ *  complete top level objects are copied out of them. State (depth, string,
+ *  escape) is kept between chunks, so objects can be split arbitrarily and
+ *  one chunk can hold several objects. Braces inside strings don't count.
+ *
+ *  Chunks are scanned in 16 byte blocks (SSE2 on x86, NEON on aarch64,
+ *  plain C elsewhere). Each block inside an object is copied in one go,
+ *  only its structural chars (braces, quotes, backslash, '\0') are handled.
+ */
+
+#include "../fifo/fifo.h"
+
+#include <stdint.h>         /* Data types */
+
+
+/* Objects, which never reach this depth, are ignored. Filters out inner
+ * objects, when framing starts in the middle of a message (1 accepts any).
+ */
+#ifndef JSON_FRAMER_MIN_DEPTH
+#define JSON_FRAMER_MIN_DEPTH               (2)
+#endif
+
+/* Max object length, including '\0' */
+#define JSON_FRAMER_BUFFER_SIZE             (FIFO_STRING_SIZE)
+
+/* Free space in front of object, so fields can be added without moving it */
+#ifndef JSON_FRAMER_HEADROOM
+#define JSON_FRAMER_HEADROOM                (96)
+#endif
+
+/* Start of object in framer's buffer */
+#define JSON_FRAMER_OBJECT(framer)          \
+    (&(framer)->buffer[JSON_FRAMER_HEADROOM])
+
+
+struct _json_framer {
+    /* Object being copied (complete one after 'json_framer_feed' success),
+     * starts after headroom */
+    char buffer[JSON_FRAMER_HEADROOM + JSON_FRAMER_BUFFER_SIZE];
+    /* Object length (without '\0') */
+    uint32_t len;
+    /* Current and max nesting depth, 0 when outside of object */
+    uint32_t depth;
+    uint32_t max_depth;
+    /* Inside string value, and previous char was backslash */
+    uint8_t is_in_string;
+    uint8_t is_escaped;
+    /* Receive time of opening braces (stamp of its chunk) */
+    uint64_t arrival_ns;
+};
+
+typedef struct _json_framer json_framer_t;
+
+
+/*  Reset framer (look for next opening braces).
+ *   p1: pointer to framer
+ */
+void json_framer_init (json_framer_t *framer);
+
+/*  Scan chunk from offset on, until an object is complete or chunk ends.
+ *   p1: pointer to framer
+ *   p2: chunk
+ *   p3: chunk length
+ *   p4: pointer to scan offset within chunk, advanced past scanned bytes
+ *   p5: chunk receive time (kept for objects starting in it)
+ *  return: 0 when complete object is at JSON_FRAMER_OBJECT ('\0' terminated),
+ *   1 when chunk was scanned to the end
+ */
+int8_t json_framer_feed (json_framer_t *framer, const char *chunk,
+    uint32_t len, uint32_t *offset, uint64_t stamp);
+
+
+#endif
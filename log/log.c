@@ -0,0 +1,512 @@
+#include "log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <stdlib.h>         /* atexit */
+#include <stdarg.h>         /* va_list */
+#include <stddef.h>         /* size_t, ptrdiff_t */
+#include <string.h>         /* memcpy, strlen */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* read, write */
+#include <pthread.h>        /* Flusher thread, consumer lock */
+#include <sys/eventfd.h>    /* eventfd */
+
+
+#define _LOAD_ACQUIRE(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define _STORE_RELEASE(ptr, val)    __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define _LOAD_RELAXED(ptr)          __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define _STORE_RELAXED(ptr, val)    __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+/* Flusher waiting flag vs. ring sequence (both sides store, then load) */
+#define _FENCE_SEQ_CST()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define _RING_MASK                  (LOG_RING_SIZE - 1)
+/* Sequence of a free slot for ring position: position of slot's first use
+ * in current lap (so zeroed ring is free) */
+#define _LAP(pos)                   ((pos) & ~(uint32_t)_RING_MASK)
+
+/* Space for '%s' strings within record (after header and arguments) */
+#define _STRINGS_SIZE               \
+    (LOG_RECORD_SIZE - sizeof(uint64_t) * (LOG_MAX_ARGS + 2))
+/* Max conversion specification ("%-08.3lld") */
+#define _SPEC_SIZE                  (16)
+
+/* Argument types, by conversion and length modifier */
+#define _ARG_NONE                   (0)
+#define _ARG_INT                    (1)
+#define _ARG_LONG                   (2)
+#define _ARG_LLONG                  (3)
+#define _ARG_SIZE                   (4)
+#define _ARG_DOUBLE                 (5)
+#define _ARG_PTR                    (6)
+#define _ARG_STR                    (7)
+#define _ARG_INVALID                (8)
+
+
+/* Message, formatted by flusher */
+struct _log_record {
+    /* Lap of ring position (free), +1 when written */
+    uint32_t seq;
+    /* Messages of the same call site, suppressed before this one */
+    uint32_t suppressed;
+    const char *fmt;
+    /* Arguments in order ('*' width and precision included), strings are
+     * offsets into 'strings' */
+    uint64_t args[LOG_MAX_ARGS];
+    char strings[_STRINGS_SIZE];
+};
+
+typedef struct _log_record log_record_t;
+
+
+/* LOCALS *********************************************************************/
+
+static log_record_t ring[LOG_RING_SIZE];
+/* Next position for producers (claimed by CAS) and for flusher */
+static uint32_t head = 0;
+static uint32_t tail = 0;
+/* Messages lost, because ring was full */
+static uint32_t drops = 0;
+
+/* Wakes up flusher, -1 until 'log_init' */
+static int wake_fd = -1;
+static uint8_t is_flusher_waiting = 0;
+/* Flusher thread and 'log_flush' (on exit) consume the ring */
+static pthread_mutex_t consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Formatted output, and single formatted argument */
+static char out[LOG_FLUSH_BUF_SIZE];
+static uint32_t out_len = 0;
+static char arg_out[LOG_FLUSH_BUF_SIZE / 4];
+
+
+/* PROTOTYPES *****************************************************************/
+
+static int8_t _is_rate_limited (log_site_t *site, uint32_t *suppressed);
+static const char *_parse_spec (const char *p, uint8_t *type,
+    uint8_t *num_of_stars);
+static void *_flusher_thread (void *arg);
+static uint32_t _drain (void);
+static void _format_record (log_record_t *record);
+static int _format_arg (const char *spec, uint8_t type, uint8_t num_of_stars,
+    const int *stars, uint64_t value, const char *str);
+static void _out_append (const char *src, uint32_t len);
+static void _out_write (void);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Create flusher's wake-up event and start flusher.
+ */
+int8_t log_init (void) {
+    pthread_t thread;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        printf("Error: log eventfd\n");
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, &_flusher_thread, NULL) != 0) {
+        printf("Error: log pthread_create\n");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    /* Fatal errors end the process, last messages are the important ones */
+    atexit(&log_flush);
+
+    return 0;
+}
+
+/*  Copy format pointer and arguments into next free ring slot. Arguments are
+ *  taken by walking the format, the same way 'printf' does.
+ */
+void log_write (log_site_t *site, const char *fmt, ...) {
+    log_record_t *record;
+    const char *p = fmt;
+    const char *str;
+    uint32_t suppressed;
+    uint32_t pos;
+    uint32_t seq;
+    uint32_t str_len;
+    uint32_t strings_len = 0;
+    uint8_t num_of_args = 0;
+    uint8_t num_of_stars;
+    uint8_t type;
+    uint8_t i;
+    va_list ap;
+
+    if (_is_rate_limited(site, &suppressed) == 1) {
+        return;
+    }
+
+    /* Claim slot, unless flusher is a whole lap behind */
+    pos = _LOAD_RELAXED(&head);
+    while (1) {
+        record = &ring[pos & _RING_MASK];
+        seq = _LOAD_ACQUIRE(&record->seq);
+        if (seq == _LAP(pos)) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if ((int32_t)(seq - _LAP(pos)) < 0) {
+            __atomic_add_fetch(&drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else {
+            pos = _LOAD_RELAXED(&head);
+        }
+    }
+
+    record->fmt = fmt;
+    record->suppressed = suppressed;
+
+    va_start(ap, fmt);
+    while ((p = strchr(p, '%')) != NULL) {
+        p = _parse_spec(p, &type, &num_of_stars);
+        if (type == _ARG_INVALID) {
+            break;
+        }
+        if (type == _ARG_NONE) {
+            continue;
+        }
+        if (num_of_args + num_of_stars + 1 > LOG_MAX_ARGS) {
+            break;
+        }
+
+        for (i=0; i<num_of_stars; i++) {
+            record->args[num_of_args++] = (uint64_t)va_arg(ap, int);
+        }
+        switch (type) {
+        case _ARG_INT:
+            record->args[num_of_args] = (uint64_t)va_arg(ap, int);
+            break;
+        case _ARG_LONG:
+            record->args[num_of_args] = (uint64_t)va_arg(ap, long);
+            break;
+        case _ARG_LLONG:
+            record->args[num_of_args] = (uint64_t)va_arg(ap, long long);
+            break;
+        case _ARG_SIZE:
+            record->args[num_of_args] = (uint64_t)va_arg(ap, size_t);
+            break;
+        case _ARG_DOUBLE: {
+            double value = va_arg(ap, double);
+            memcpy(&record->args[num_of_args], &value, sizeof(value));
+            break;
+        }
+        case _ARG_PTR:
+            record->args[num_of_args] = (uintptr_t)va_arg(ap, void *);
+            break;
+        case _ARG_STR:
+            /* Copy what fits (empty string at the very end) */
+            str = va_arg(ap, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            str_len = strlen(str);
+            if (strings_len + str_len + 1 > _STRINGS_SIZE) {
+                str_len = (strings_len < _STRINGS_SIZE) ?
+                    _STRINGS_SIZE - strings_len - 1 : 0;
+            }
+            if (strings_len < _STRINGS_SIZE) {
+                memcpy(&record->strings[strings_len], str, str_len);
+                record->strings[strings_len + str_len] = '\0';
+                record->args[num_of_args] = strings_len;
+                strings_len += str_len + 1;
+            } else {
+                record->args[num_of_args] = _STRINGS_SIZE - 1;
+            }
+            break;
+        }
+        num_of_args++;
+    }
+    va_end(ap);
+
+    _STORE_RELEASE(&record->seq, _LAP(pos) + 1);
+
+    /* Wake up flusher, if it's waiting */
+    _FENCE_SEQ_CST();
+    if (_LOAD_RELAXED(&is_flusher_waiting) == 1 &&
+            __atomic_exchange_n(&is_flusher_waiting, 0,
+                __ATOMIC_RELAXED) == 1) {
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+}
+
+/*  Drain ring on the calling thread.
+ */
+void log_flush (void) {
+    _drain();
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Count call site's messages within interval.
+ *   p2: pointer to where number of previously suppressed messages is kept
+ *  return: 1 if message is suppressed, else 0
+ */
+static int8_t _is_rate_limited (log_site_t *site, uint32_t *suppressed) {
+    struct timespec now;
+    uint64_t now_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    /* New interval (races between threads only shift its start) */
+    if (now_ms - _LOAD_RELAXED(&site->interval_start_ms) >=
+            LOG_RATE_LIMIT_INTERVAL_MS) {
+        _STORE_RELAXED(&site->interval_start_ms, now_ms);
+        _STORE_RELAXED(&site->count, 0);
+    }
+
+    if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) >
+            LOG_RATE_LIMIT_BURST) {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*  Parse conversion specification (flags, width, precision, length,
+ *  conversion).
+ *   p1: pointer to '%'
+ *   p2: pointer to where argument type is kept (_ARG_...)
+ *   p3: pointer to where number of '*' (int arguments in front) is kept
+ *  return: pointer past specification
+ */
+static const char *_parse_spec (const char *p, uint8_t *type,
+        uint8_t *num_of_stars) {
+    uint8_t length = 0;
+    const char *start = p++;
+
+    *num_of_stars = 0;
+
+    /* Flags, width and precision */
+    while (*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL) {
+        if (*p == '*') {
+            (*num_of_stars)++;
+        }
+        p++;
+    }
+
+    /* Length modifier: 'h' and 'hh' are promoted to int anyway */
+    while (*p != '\0' && strchr("hlzjt", *p) != NULL) {
+        if (*p == 'l') {
+            length = (length == _ARG_LONG) ? _ARG_LLONG : _ARG_LONG;
+        } else if (*p == 'z' || *p == 'j' || *p == 't') {
+            length = (*p == 'j') ? _ARG_LLONG : _ARG_SIZE;
+        }
+        p++;
+    }
+
+    switch (*p) {
+    case '%':
+        *type = _ARG_NONE;
+        break;
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+        *type = (length == 0) ? _ARG_INT : length;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        *type = _ARG_DOUBLE;
+        break;
+    case 'p':
+        *type = _ARG_PTR;
+        break;
+    case 's':
+        *type = _ARG_STR;
+        break;
+    default:
+        *type = _ARG_INVALID;
+        return start;
+    }
+
+    /* Width and precision are the only '*' */
+    if (p - start + 2 > _SPEC_SIZE || *num_of_stars > 2) {
+        *type = _ARG_INVALID;
+        return start;
+    }
+    return p + 1;
+}
+
+/*  Wait for records and write them out, until the process ends.
+ */
+static void *_flusher_thread (void *arg) {
+    uint64_t count;
+    log_record_t *record;
+
+    while (1) {
+        if (_drain() > 0) {
+            continue;
+        }
+
+        /* Record could have been written before flag was seen */
+        _STORE_RELAXED(&is_flusher_waiting, 1);
+        _FENCE_SEQ_CST();
+        record = &ring[_LOAD_RELAXED(&tail) & _RING_MASK];
+        if (_LOAD_ACQUIRE(&record->seq) == _LAP(_LOAD_RELAXED(&tail)) + 1) {
+            _STORE_RELAXED(&is_flusher_waiting, 0);
+            continue;
+        }
+        if (read(wake_fd, &count, sizeof(count)) != sizeof(count)) {
+            _STORE_RELAXED(&is_flusher_waiting, 0);
+        }
+    }
+
+    return NULL;
+}
+
+/*  Format all written records, and free their slots.
+ *  return: number of records
+ */
+static uint32_t _drain (void) {
+    log_record_t *record;
+    uint32_t num_of_records = 0;
+    uint32_t num_of_drops;
+    int len;
+
+    pthread_mutex_lock(&consumer_mutex);
+
+    while (1) {
+        record = &ring[tail & _RING_MASK];
+        if (_LOAD_ACQUIRE(&record->seq) != _LAP(tail) + 1) {
+            break;
+        }
+        _format_record(record);
+        /* Slot is free for the next lap */
+        _STORE_RELEASE(&record->seq, _LAP(tail) + LOG_RING_SIZE);
+        _STORE_RELAXED(&tail, tail + 1);
+        num_of_records++;
+    }
+
+    num_of_drops = __atomic_exchange_n(&drops, 0, __ATOMIC_RELAXED);
+    if (num_of_drops > 0) {
+        len = snprintf(arg_out, sizeof(arg_out),
+            "Log: ring full, %u messages dropped\n", num_of_drops);
+        _out_append(arg_out, len);
+    }
+    _out_write();
+
+    pthread_mutex_unlock(&consumer_mutex);
+
+    return num_of_records;
+}
+
+/*  Format record, the same way 'printf' would have, one conversion at a time.
+ */
+static void _format_record (log_record_t *record) {
+    const char *p = record->fmt;
+    const char *next;
+    char spec[_SPEC_SIZE];
+    int stars[2] = {0, 0};
+    uint8_t num_of_args = 0;
+    uint8_t num_of_stars;
+    uint8_t type;
+    uint8_t i;
+    int len;
+
+    while ((next = strchr(p, '%')) != NULL) {
+        _out_append(p, next - p);
+
+        p = _parse_spec(next, &type, &num_of_stars);
+        if (type == _ARG_INVALID ||
+                num_of_args + num_of_stars + 1 > LOG_MAX_ARGS) {
+            /* Same as writer, rest of format is text */
+            p = next;
+            break;
+        }
+        if (type == _ARG_NONE) {
+            _out_append("%", 1);
+            continue;
+        }
+
+        for (i=0; i<num_of_stars; i++) {
+            stars[i] = (int)record->args[num_of_args++];
+        }
+        memcpy(spec, next, p - next);
+        spec[p - next] = '\0';
+
+        len = _format_arg(spec, type, num_of_stars, stars,
+            record->args[num_of_args],
+            &record->strings[record->args[num_of_args] % _STRINGS_SIZE]);
+        if (len > (int)sizeof(arg_out) - 1) {
+            len = sizeof(arg_out) - 1;
+        }
+        if (len > 0) {
+            _out_append(arg_out, len);
+        }
+        num_of_args++;
+    }
+    _out_append(p, strlen(p));
+
+    if (record->suppressed > 0) {
+        len = snprintf(arg_out, sizeof(arg_out),
+            "Log: %u similar messages suppressed\n", record->suppressed);
+        _out_append(arg_out, len);
+    }
+}
+
+/*  Format single argument into 'arg_out'.
+ *  return: 'snprintf' result
+ */
+static int _format_arg (const char *spec, uint8_t type, uint8_t num_of_stars,
+        const int *stars, uint64_t value, const char *str) {
+    double d;
+
+#define _FORMAT(arg)                                                        \
+    ((num_of_stars == 0) ?                                                  \
+        snprintf(arg_out, sizeof(arg_out), spec, arg) :                     \
+    (num_of_stars == 1) ?                                                   \
+        snprintf(arg_out, sizeof(arg_out), spec, stars[0], arg) :           \
+        snprintf(arg_out, sizeof(arg_out), spec, stars[0], stars[1], arg))
+
+    switch (type) {
+    case _ARG_INT:
+        return _FORMAT((int)value);
+    case _ARG_LONG:
+        return _FORMAT((long)value);
+    case _ARG_LLONG:
+        return _FORMAT((long long)value);
+    case _ARG_SIZE:
+        return _FORMAT((size_t)value);
+    case _ARG_DOUBLE:
+        memcpy(&d, &value, sizeof(d));
+        return _FORMAT(d);
+    case _ARG_PTR:
+        return _FORMAT((void *)(uintptr_t)value);
+    case _ARG_STR:
+        return _FORMAT(str);
+    }
+    return 0;
+
+#undef _FORMAT
+}
+
+/*  Append to output, write output out first if it's full.
+ */
+static void _out_append (const char *src, uint32_t len) {
+    if (out_len + len > sizeof(out)) {
+        _out_write();
+    }
+    if (len > sizeof(out)) {
+        len = sizeof(out);
+    }
+    memcpy(&out[out_len], src, len);
+    out_len += len;
+}
+
+/*  Write output to stdout (shared with 'printf' of init code).
+ */
+static void _out_write (void) {
+    if (out_len == 0) {
+        return;
+    }
+    fwrite(out, 1, out_len, stdout);
+    fflush(stdout);
+    out_len = 0;
+}
@@ -0,0 +1,109 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ *  Asynchronous leveled logger. Tasks don't format or write anything, they
+ *  only copy format string pointer and arguments into a fixed size record of
+ *  a lock-free ring (multiple producers, so it works in threaded pipeline
+ *  mode too). A background thread formats records and writes them to
+ *  stdout in batches.
+ *
+ *  Messages below LOG_LEVEL are compiled out. Each call site is rate
+ *  limited, suppressed messages are counted and reported with the next one.
+ *
+ *  Usage is the same as 'printf':
+ *      LOG_WARN("Fifo: overflow (address: %p)\n", (void *)fifo);
+ *  Format must be a string literal (only its pointer is kept), '%s' strings
+ *  are copied (cut to what fits into the record).
+ */
+
+#include <stdint.h>         /* Data types */
+
+
+/* Log levels */
+#define LOG_LEVEL_NONE                      (0)
+#define LOG_LEVEL_ERROR                     (1)
+#define LOG_LEVEL_WARN                      (2)
+#define LOG_LEVEL_INFO                      (3)
+#define LOG_LEVEL_DEBUG                     (4)
+
+/* Messages with higher level are not compiled in */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL                           (LOG_LEVEL_INFO)
+#endif
+
+/* Records in ring (power of 2), further messages get dropped and counted */
+#define LOG_RING_SIZE                       (256)
+/* Record size, arguments and copied strings share what's left of it */
+#define LOG_RECORD_SIZE                     (256)
+#define LOG_MAX_ARGS                        (8)
+
+/* Per call site: max messages within interval, the rest is suppressed */
+#define LOG_RATE_LIMIT_BURST                (10)
+#define LOG_RATE_LIMIT_INTERVAL_MS          (1000)
+
+/* Formatted output, written to stdout at once */
+#define LOG_FLUSH_BUF_SIZE                  (4096)
+
+
+/* Rate limiting state, one per call site */
+struct _log_site {
+    uint64_t interval_start_ms;
+    uint32_t count;
+    uint32_t suppressed;
+};
+
+typedef struct _log_site log_site_t;
+
+
+/* Each call site keeps its own rate limiting state */
+#define _LOG(...)                                               \
+    do {                                                        \
+        static log_site_t _log_site;                            \
+        log_write(&_log_site, __VA_ARGS__);                     \
+    } while (0)
+
+#if (LOG_LEVEL >= LOG_LEVEL_ERROR)
+#define LOG_ERROR(...)      _LOG(__VA_ARGS__)
+#else
+#define LOG_ERROR(...)      do {} while (0)
+#endif
+
+#if (LOG_LEVEL >= LOG_LEVEL_WARN)
+#define LOG_WARN(...)       _LOG(__VA_ARGS__)
+#else
+#define LOG_WARN(...)       do {} while (0)
+#endif
+
+#if (LOG_LEVEL >= LOG_LEVEL_INFO)
+#define LOG_INFO(...)       _LOG(__VA_ARGS__)
+#else
+#define LOG_INFO(...)       do {} while (0)
+#endif
+
+#if (LOG_LEVEL >= LOG_LEVEL_DEBUG)
+#define LOG_DEBUG(...)      _LOG(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...)      do {} while (0)
+#endif
+
+
+/*  Start background flusher thread (pending records are also flushed on
+ *  exit).
+ *  return: 0 on success, -1 on error
+ */
+int8_t log_init (void);
+
+/*  Add message to ring (use LOG_... macros instead).
+ *   p1: call site's rate limiting state
+ *   p2: format string literal, followed by arguments
+ */
+void log_write (log_site_t *site, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+/*  Format and write all records in ring (from any thread).
+ */
+void log_flush (void);
+
+
+#endif
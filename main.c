@@ -9,17 +9,21 @@
 
 
 #include "fifo/fifo.h"
+#include "scheduler/scheduler.h"
+#include "pipeline/pipeline.h"
+#include "log/log.h"
 //#include "serial/serial.h"
 #include "task/serial/serial.h"
 #include "task/buffer_task/buffer_task.h"
+#include "task/aggregate_task/aggregate_task.h"
 #include "task/storage_task/storage_task.h"
 #include "task/request_task/request_task.h"
 
 #include <stdio.h>      /* Standard input/output definitions */
-#include <unistd.h>     /* Sleep */
 
 
-/* Relative path to measurement directory within base dir. */
+/* Relative path to measurement directory within base dir (segments are
+ * named 'data-<time>.json'). */
 #define MEASUREMENTS_FILENAME               "/measurement/data.json"
 
 //#define SERIAL_PORTNAME                     "/dev/ttyACM0"
@@ -33,26 +37,31 @@
 #define SERVER_PORT                         (80)
 //#define SERVER_PORT                         (8080)
 
-#define SHORT_SLEEP_TIME_US					10000		/* 10 ms */
-#define LONG_SLEEP_TIME_US					1000000		/* 1 s */
 
 
+#if (AGGREGATE_TASK_ENABLED == 1 && REQUEST_TASK_DISK_UPLOAD == 1)
+#error "Disk upload sends stored measurements, not aggregated summaries"
+#endif
+
 
 /* Pooling based tasks */
 int8_t (*task_ptrs[]) (void) = 
-    {&serial_task_run, &buffer_task_run, &request_task_run, &storage_task_run};
+    {&serial_task_run, &buffer_task_run,
+#if (AGGREGATE_TASK_ENABLED == 1)
+    &aggregate_task_run,
+#endif
+    &request_task_run, &storage_task_run};
     //{&serial_task_run, &buffer_task_run, &request_task_run};
 	//{&buffer_task_run};
 /* Get number of tasks */
 int8_t num_of_tasks = (sizeof(task_ptrs) / sizeof(task_ptrs[0]));
 
 
-/* Pointer to three fifo buffers
+/* Pointer to two fifo buffers
  *  1: Raw incoming UART data
- *  2: Data storage buffer
- *  3: Requests buffer
+ *  2: Measurements buffer, read by both data storage and requests
  */
-str_fifo_t *fifo_buffers[3];
+str_fifo_t *fifo_buffers[2];
 
 
 /*
@@ -64,6 +73,12 @@ int main (int argc, char* argv[]) {
 	get_timestamp_raw(_time);
 	printf("\nStarted at: %s\n\n", _time);
 
+	/* Tasks log through ring, written by background thread */
+	if (log_init() != 0) {
+        printf("Error: log_init");
+		return -1;
+	}
+
 	char serial_portname [PORTNAME_STRING_LEN] = {0};
 	if (argc == 1) {
 		sprintf(serial_portname, "%s", SERIAL_PORTNAME);
@@ -93,9 +108,24 @@ int main (int argc, char* argv[]) {
     }
 
 
-    /* Init data storage fifo */
-    if (storage_task_init_fifo(&fifo_buffers[1]) != 0) {
-        printf("Error: serial_init_fifo");
+    /* Init requests fifo (measurements buffer) */
+    if (request_task_init_fifo(&fifo_buffers[1]) != 0) {
+        printf("Error: request_task_init_fifo");
+        return -1;
+    }
+
+#if (AGGREGATE_TASK_ENABLED == 1)
+    /* Measurements go to data storage and aggregation, requests only get
+     * summaries */
+    if (aggregate_task_init_fifo(&fifo_buffers[1], fifo_buffers[1]) != 0) {
+        printf("Error: aggregate_task_init_fifo");
+        return -1;
+    }
+#endif
+
+    /* Attach data storage to measurements buffer */
+    if (storage_task_init_fifo(fifo_buffers[1]) != 0) {
+        printf("Error: storage_task_init_fifo");
         return -1;
     }
 
@@ -105,11 +135,12 @@ int main (int argc, char* argv[]) {
         return -1;
     }
 
-    /* Init requests fifo */
-    if (request_task_init_fifo(&fifo_buffers[2]) != 0) {
-        printf("Error: request_task_init_fifo");
+    /* Uploads continue from measurements log (disk upload) */
+    if (request_task_init_log(MEASUREMENTS_FILENAME) != 0) {
+        printf("Error: request_task_init_log");
         return -1;
     }
+
     /* Init requests socket */
     if (request_task_init_socket(SERVER_HOSTNAME, SERVER_PORT) != 0) {
         printf("Error: request_task_init_host_and_port");
@@ -123,16 +154,48 @@ int main (int argc, char* argv[]) {
     printf("\n*\tInit successful:\n");
 
     printf("Number of tasks: %d\n", num_of_tasks);
-    printf("Sleep ampunt [us]:  %d and %d\n",
-		SHORT_SLEEP_TIME_US, LONG_SLEEP_TIME_US);
 
 	printf("Fifo addresses (for later error handling):\n"
 			"0: \t%p\n"
-			"1: \t%p\n"
-			"2: \t%p\n",
+			"1: \t%p\n",
 			(void *)fifo_buffers[0],
-			(void *)fifo_buffers[1],
-			(void *)fifo_buffers[2]);
+			(void *)fifo_buffers[1]);
+
+
+#if (PIPELINE_THREADED == 1)
+    /* Each task runs on its own thread, returns only on fatal error */
+    printf("\n*\tBegin threaded pipeline\n\n");
+    return pipeline_run(fifo_buffers);
+#endif
+
+
+    /* Init scheduler (before any task registers its events) */
+    if (scheduler_init() != 0) {
+        printf("Error: scheduler_init");
+        return -1;
+    }
+    /* Wake up on incoming serial data */
+    if (serial_init_events() != 0) {
+        printf("Error: serial_init_events");
+        return -1;
+    }
+    /* Init requests timers */
+    if (request_task_init_events() != 0) {
+        printf("Error: request_task_init_events");
+        return -1;
+    }
+    /* Init data storage sync timer */
+    if (storage_task_init_events() != 0) {
+        printf("Error: storage_task_init_events");
+        return -1;
+    }
+#if (AGGREGATE_TASK_ENABLED == 1)
+    /* Init aggregation window timer */
+    if (aggregate_task_init_events() != 0) {
+        printf("Error: aggregate_task_init_events");
+        return -1;
+    }
+#endif
 
 
     printf("\n*\tBegin main loop\n\n");
@@ -144,8 +207,8 @@ int main (int argc, char* argv[]) {
     /* Task status accumulator, keeps track of busy tasks */
     int8_t is_sys_idle;
 
-    /* Sleep time on each loop to slow down execution */
-    uint64_t sleep_time_us;
+    /* Scheduler wait timeout on each loop */
+    int wait_time_ms;
 
     /* Task pointer index */
     int task_idx;
@@ -165,7 +228,7 @@ int main (int argc, char* argv[]) {
 
 			/* Check for fatal error within task. */
 			if (tmp_task_status == -1) {
-				printf("FATAL ERROR\n");
+				LOG_ERROR("FATAL ERROR\n");
 				return -1;
 			}
 
@@ -175,26 +238,27 @@ int main (int argc, char* argv[]) {
 
 		//printf("is_sys_idle: %d \n", is_sys_idle);
 
-		/* If no busy tasks, go to (interruptable) sleep */
+		/* If no busy tasks, wait for serial data, socket or timer events.
+		 * Otherwise only collect pending events and loop again. */
 		if (is_sys_idle == 0) {
-			sleep_time_us = LONG_SLEEP_TIME_US;
+			wait_time_ms = SCHEDULER_WAIT_FOREVER;
 		} else {
-			sleep_time_us = SHORT_SLEEP_TIME_US;
-			//sleep_time_us = LONG_SLEEP_TIME_US;
+			wait_time_ms = SCHEDULER_WAIT_NONE;
 		}
 
 		/* Go to (interruptable) sleep */
-		usleep(sleep_time_us);
+		if (scheduler_wait(wait_time_ms) == -1) {
+			LOG_ERROR("FATAL ERROR\n");
+			return -1;
+		}
 		//printf("AROUND\n");
 
 
         /*printf( "***FIFO POINTERS: \n"
-        		"\t%d, %d\n"
         		"\t%d, %d\n"
         		"\t%d, %d\n",
         		fifo_buffers[0]->write_idx, fifo_buffers[0]->read_idx,
-        		fifo_buffers[1]->write_idx, fifo_buffers[1]->read_idx,
-        		fifo_buffers[2]->write_idx, fifo_buffers[2]->read_idx);*/
+        		fifo_buffers[1]->write_idx, fifo_buffers[1]->read_idx);*/
     }
 
     return 0;
@@ -0,0 +1,162 @@
+#include "pipeline.h"
+#include "../fifo/fifo.h"
+#include "../scheduler/scheduler.h"
+#include "../task/task.h"
+#include "../task/serial/serial.h"
+#include "../task/buffer_task/buffer_task.h"
+#include "../task/aggregate_task/aggregate_task.h"
+#include "../task/storage_task/storage_task.h"
+#include "../task/request_task/request_task.h"
+#include "../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <stdlib.h>         /* exit */
+#include <pthread.h>        /* Threads */
+
+
+/* Single pipeline stage (one thread) */
+struct _pipeline_stage {
+    const char *name;
+    /* Task 'run' function */
+    int8_t (*run) (void);
+    /* Registers task's own events with thread's scheduler (may be NULL) */
+    int8_t (*init_events) (void);
+    /* Input fifo, which wakes up the stage (may be NULL) */
+    str_fifo_t *input_fifo;
+    /* Stage's reader id in input fifo */
+    uint8_t input_reader;
+    pthread_t thread;
+};
+
+typedef struct _pipeline_stage pipeline_stage_t;
+
+
+/* LOCALS *********************************************************************/
+
+static pipeline_stage_t stages[PIPELINE_NUM_OF_STAGES];
+
+
+/* PROTOTYPES *****************************************************************/
+
+static void *_stage_thread (void *arg);
+static void _stage_fatal (pipeline_stage_t *stage);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Prepare fifo buffers, start threads and wait for them.
+ */
+int8_t pipeline_run (str_fifo_t *_fifo_buffers[2]) {
+    str_fifo_t *request_fifo = _fifo_buffers[1];
+    int i;
+
+    /* Each fifo has exactly one producer and one consumer thread per reader */
+    for (i=0; i<2; i++) {
+        if (str_fifo_init_spsc(_fifo_buffers[i]) != 0) {
+            printf("Error: str_fifo_init_spsc (%d)\n", i);
+            return -1;
+        }
+    }
+
+#if (AGGREGATE_TASK_ENABLED == 1)
+    /* Requests get summaries, from a fifo of their own */
+    request_fifo = aggregate_task_get_output_fifo();
+    if (str_fifo_init_spsc(request_fifo) != 0) {
+        printf("Error: str_fifo_init_spsc (request)\n");
+        return -1;
+    }
+    stages[4] = (pipeline_stage_t)
+        {"aggregate", &aggregate_task_run, &aggregate_task_init_events,
+        _fifo_buffers[1], 0, 0};
+#endif
+
+    /* Serial port wakes up serial stage, fifos wake up the rest */
+    stages[0] = (pipeline_stage_t)
+        {"serial", &serial_task_run, &serial_init_events, NULL, 0, 0};
+    stages[1] = (pipeline_stage_t)
+        {"buffer", &buffer_task_run, NULL, _fifo_buffers[0], 0, 0};
+    stages[2] = (pipeline_stage_t)
+        {"storage", &storage_task_run, &storage_task_init_events,
+        _fifo_buffers[1],
+        storage_task_get_fifo_reader(), 0};
+    stages[3] = (pipeline_stage_t)
+        {"request", &request_task_run, &request_task_init_events,
+        request_fifo, 0, 0};
+
+    for (i=0; i<PIPELINE_NUM_OF_STAGES; i++) {
+        if (pthread_create(&stages[i].thread, NULL,
+                &_stage_thread, &stages[i]) != 0) {
+            printf("Error: pthread_create (%s)\n", stages[i].name);
+            return -1;
+        }
+    }
+
+    printf("Pipeline threads: %d\n", PIPELINE_NUM_OF_STAGES);
+
+    /* Stages only return on fatal error, which exits the process */
+    for (i=0; i<PIPELINE_NUM_OF_STAGES; i++) {
+        pthread_join(stages[i].thread, NULL);
+    }
+
+    return -1;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Stage main loop, equivalent to single threaded loop in 'main.c'.
+ */
+static void *_stage_thread (void *arg) {
+    pipeline_stage_t *stage = (pipeline_stage_t *)arg;
+    int8_t tmp_task_status;
+    int wait_time_ms;
+
+    /* Scheduler and all events belong to this thread */
+    if (scheduler_init() != 0) {
+        _stage_fatal(stage);
+    }
+    if (stage->init_events != NULL && stage->init_events() != 0) {
+        _stage_fatal(stage);
+    }
+    if (stage->input_fifo != NULL &&
+            scheduler_add_fd(
+                stage->input_fifo->notify_fd[stage->input_reader],
+                EPOLLIN) != 0) {
+        _stage_fatal(stage);
+    }
+
+    while (1) {
+        /* Clear wake-up before checking for data, so none gets lost */
+        if (stage->input_fifo != NULL) {
+            str_fifo_clear_notify(stage->input_fifo, stage->input_reader);
+        }
+
+        tmp_task_status = stage->run();
+
+        /* Check for fatal error within task. */
+        if (tmp_task_status == TASK_STATUS_ERROR) {
+            _stage_fatal(stage);
+        }
+
+        /* Busy task runs again, idle waits for its events */
+        if (tmp_task_status == TASK_STATUS_IDLE) {
+            wait_time_ms = SCHEDULER_WAIT_FOREVER;
+        } else {
+            wait_time_ms = SCHEDULER_WAIT_NONE;
+        }
+
+        if (scheduler_wait(wait_time_ms) == -1) {
+            _stage_fatal(stage);
+        }
+    }
+
+    return NULL;
+}
+
+/*  Report fatal error and end the process (same as returning from main).
+ */
+static void _stage_fatal (pipeline_stage_t *stage) {
+    LOG_ERROR("FATAL ERROR (%s)\n", stage->name);
+    exit(-1);
+}
@@ -0,0 +1,35 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*
+ *  Optional threaded pipeline. Each task (serial, buffer, storage, request)
+ *  runs on its own thread with its own scheduler. Threads are connected by
+ *  the existing fifo buffers, used as lock-free single producer, single
+ *  consumer queues. Consumers get woken up through fifo's eventfd.
+ *
+ *  Build with 'make THREADED=1' to enable.
+ */
+
+#include "../fifo/fifo.h"
+#include "../task/aggregate_task/aggregate_task.h"
+
+#include <stdint.h>         /* Data types */
+
+
+#ifndef PIPELINE_THREADED
+#define PIPELINE_THREADED (0)
+#endif
+
+/* Number of pipeline stages (threads), aggregation is optional */
+#define PIPELINE_NUM_OF_STAGES              (4 + AGGREGATE_TASK_ENABLED)
+
+
+/*  Prepare fifo buffers for use between threads, start one thread per task
+ *  and wait for them. Returns only on fatal error.
+ *   p1: pointer to array of fifo struct pointers (serial, measurements)
+ *  return: -1 on error
+ */
+int8_t pipeline_run (str_fifo_t *_fifo_buffers[2]);
+
+
+#endif
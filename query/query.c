@@ -0,0 +1,386 @@
+/*
+ *  Time range query over measurement segments (see 'segment/segment.h').
+ *
+ *  Finds segment, which was open at range start, seeks with its sparse
+ *  index close to range start, and streams lines until range end (lines
+ *  are in arrival order). Compressed segments are read the same way, index
+ *  points to gzip member starts.
+ *
+ *  Usage:
+ *      bin/query <from> <to> [base path]
+ *  Times are UTC ('2026-10-17T18:00:00Z', fractions allowed) or seconds
+ *  since Unix Epoch, range includes both ends. Base path defaults to
+ *  measurement file of this build ('<dir>/measurement/data.json').
+ */
+
+#include "../segment/segment.h"
+#include "../timestamp/timestamp.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <stdlib.h>         /* realloc, free, qsort, strtoull */
+#include <string.h>         /* strlen, strcmp, strstr */
+#include <time.h>           /* timegm */
+#include <fcntl.h>          /* File control definitions */
+#include <unistd.h>         /* lseek, close */
+#include <dirent.h>         /* opendir, readdir */
+#include <sys/stat.h>       /* fstat */
+#if (SEGMENT_COMPRESS == 1)
+#include <zlib.h>           /* gzip streams */
+#endif
+
+
+#define QUERY_DEFAULT_PATH                  CURDIR "/measurement/data.json"
+
+/* Max line length (longer lines are cut) */
+#define QUERY_LINE_SIZE                     (4096)
+#define QUERY_OUTPUT_BUF_SIZE               (64 * 1024)
+
+/* Segments are read line by line, gzip stream reads plain files as they
+ * are */
+#if (SEGMENT_COMPRESS == 1)
+#define _FILE                               gzFile
+#define _OPEN_FD(fd)                        gzdopen((fd), "rb")
+#define _GETS(buf, len, file)               gzgets((file), (buf), (len))
+#define _CLOSE(file)                        gzclose(file)
+#else
+#define _FILE                               FILE *
+#define _OPEN_FD(fd)                        fdopen((fd), "r")
+#define _GETS(buf, len, file)               fgets((buf), (len), (file))
+#define _CLOSE(file)                        fclose(file)
+#endif
+
+
+/* Segment file name */
+struct _query_segment {
+    char name[SEGMENT_PATH_SIZE];
+    uint64_t start_ns;
+};
+
+typedef struct _query_segment query_segment_t;
+
+
+/* LOCALS *********************************************************************/
+
+/* Directory, base name with '-' and extension of segments */
+static char dir[SEGMENT_PATH_SIZE];
+static char prefix[SEGMENT_PATH_SIZE];
+static char ext[SEGMENT_PATH_SIZE];
+
+static char line[QUERY_LINE_SIZE];
+static char output_buf[QUERY_OUTPUT_BUF_SIZE];
+
+
+/* PROTOTYPES *****************************************************************/
+
+static int8_t _set_names (const char *path);
+static int _list (query_segment_t **segments);
+static int _compare (const void *a, const void *b);
+static uint64_t _find_offset (const char *path, uint64_t from_ns);
+static int8_t _read (const char *path, uint64_t offset, uint64_t from_ns,
+    uint64_t to_ns);
+static int8_t _parse_time (const char *str, uint64_t *time_ns);
+static int8_t _parse_line_time (const char *str, uint64_t *time_ns);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+int main (int argc, char *argv[]) {
+    char path[SEGMENT_PATH_SIZE];
+    query_segment_t *segments = NULL;
+    uint64_t from_ns;
+    uint64_t to_ns;
+    uint64_t offset;
+    int8_t status = 0;
+    int num_of_segments;
+    int first = 0;
+    int i;
+
+    if (argc < 3 || argc > 4 ||
+            _parse_time(argv[1], &from_ns) != 0 ||
+            _parse_time(argv[2], &to_ns) != 0) {
+        fprintf(stderr, "Usage: %s <from> <to> [base path]\n"
+            "  times: 2026-10-17T18:00:00Z or seconds since Epoch (UTC)\n",
+            argv[0]);
+        return 1;
+    }
+    if (_set_names((argc == 4) ? argv[3] : QUERY_DEFAULT_PATH) != 0) {
+        fprintf(stderr, "Error: base path\n");
+        return 1;
+    }
+
+    num_of_segments = _list(&segments);
+    if (num_of_segments < 0) {
+        fprintf(stderr, "Error: can't read %s\n", dir);
+        return 1;
+    }
+    setvbuf(stdout, output_buf, _IOFBF, sizeof(output_buf));
+
+    /* Lines of a segment arrived before the next one was started, so
+     * range starts in the last segment started before it */
+    for (i=1; i<num_of_segments; i++) {
+        if (segments[i].start_ns <= from_ns) {
+            first = i;
+        }
+    }
+
+    /* Lines are in arrival order, reading stops after range end */
+    for (i=first; i<num_of_segments && status == 0; i++) {
+        if (snprintf(path, sizeof(path), "%s/%s", dir, segments[i].name) >=
+                (int)sizeof(path)) {
+            status = -1;
+            break;
+        }
+        offset = (i == first) ? _find_offset(path, from_ns) : 0;
+        status = _read(path, offset, from_ns, to_ns);
+    }
+
+    free(segments);
+    fflush(stdout);
+    return (status < 0) ? 1 : 0;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Split base path into directory, name and extension (same as segments).
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _set_names (const char *path) {
+    const char *name = strrchr(path, '/');
+    const char *dot;
+
+    if (name == NULL || strlen(path) >= SEGMENT_PATH_SIZE) {
+        return -1;
+    }
+    memcpy(dir, path, name - path);
+    dir[name - path] = '\0';
+    name++;
+
+    dot = strrchr(name, '.');
+    if (dot == NULL) {
+        dot = name + strlen(name);
+    }
+    memcpy(prefix, name, dot - name);
+    memcpy(&prefix[dot - name], "-", 2);
+    memcpy(ext, dot, strlen(dot) + 1);
+    return 0;
+}
+
+/*  List segments (plain or compressed, not their indexes), oldest first.
+ *  Segment, which exists in both forms (being compressed), is listed once.
+ *   p1: where list is returned (free it after use)
+ *  return: number of segments, -1 on error
+ */
+static int _list (query_segment_t **segments) {
+    query_segment_t *list = NULL;
+    query_segment_t *tmp;
+    int num_of_segments = 0;
+    int num_of_unique = 0;
+    int list_size = 0;
+    struct dirent *entry;
+    const char *end;
+    int i;
+    struct tm tm;
+    DIR *dp = opendir(dir);
+
+    if (dp == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dp)) != NULL) {
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0) {
+            continue;
+        }
+        /* Start time, followed by extension (and compressed extension) */
+        memset(&tm, 0, sizeof(tm));
+        end = &entry->d_name[strlen(prefix) + SEGMENT_TIME_LEN];
+        if (strlen(entry->d_name) < strlen(prefix) + SEGMENT_TIME_LEN ||
+                sscanf(&entry->d_name[strlen(prefix)], "%4d%2d%2dT%2d%2d%2dZ",
+                &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+                &tm.tm_min, &tm.tm_sec) != 6 ||
+                strncmp(end, ext, strlen(ext)) != 0 ||
+                (end[strlen(ext)] != '\0' &&
+                strcmp(&end[strlen(ext)], SEGMENT_COMPRESS_EXT) != 0)) {
+            continue;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+
+        if (num_of_segments == list_size) {
+            list_size = (list_size == 0) ? 64 : list_size * 2;
+            tmp = realloc(list, list_size * sizeof(query_segment_t));
+            if (tmp == NULL) {
+                break;
+            }
+            list = tmp;
+        }
+        snprintf(list[num_of_segments].name, SEGMENT_PATH_SIZE, "%s",
+            entry->d_name);
+        list[num_of_segments].start_ns = timegm(&tm) * 1000000000ULL;
+        num_of_segments++;
+    }
+    closedir(dp);
+
+    qsort(list, num_of_segments, sizeof(query_segment_t), &_compare);
+
+    /* Plain segment sorts right before its compressed copy, keep plain */
+    for (i=0; i<num_of_segments; i++) {
+        if (num_of_unique > 0 && strncmp(list[i].name,
+                list[num_of_unique-1].name,
+                strlen(list[num_of_unique-1].name)) == 0) {
+            continue;
+        }
+        list[num_of_unique++] = list[i];
+    }
+
+    *segments = list;
+    return num_of_unique;
+}
+
+/*  Compare segment names (time order).
+ */
+static int _compare (const void *a, const void *b) {
+    return strcmp(((const query_segment_t *)a)->name,
+        ((const query_segment_t *)b)->name);
+}
+
+/*  Binary search segment's index for last entry before range start.
+ *   p1: segment path
+ *   p2: range start
+ *  return: offset to read from (0 without index)
+ */
+static uint64_t _find_offset (const char *path, uint64_t from_ns) {
+    char index_path[SEGMENT_PATH_SIZE];
+    segment_index_t entry;
+    uint64_t offset = 0;
+    struct stat st;
+    int64_t low = 0;
+    int64_t high;
+    int64_t mid;
+    int fd;
+
+    if (snprintf(index_path, sizeof(index_path), "%s" SEGMENT_INDEX_EXT,
+            path) >= (int)sizeof(index_path)) {
+        return 0;
+    }
+    fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    /* Entries are in time order, find last one at or before range start */
+    high = st.st_size / sizeof(segment_index_t) - 1;
+    while (low <= high) {
+        mid = low + (high - low) / 2;
+        if (pread(fd, &entry, sizeof(entry), mid * sizeof(entry)) !=
+                sizeof(entry)) {
+            break;
+        }
+        if (entry.time_ns <= from_ns) {
+            offset = entry.offset;
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    close(fd);
+    return offset;
+}
+
+/*  Write segment's lines within range to stdout.
+ *   p1: segment path
+ *   p2: offset to start reading from (line or gzip member start)
+ *   p3, p4: range
+ *  return: 0 to go on with next segment, 1 after range end, -1 on error
+ */
+static int8_t _read (const char *path, uint64_t offset, uint64_t from_ns,
+        uint64_t to_ns) {
+    int8_t status = 0;
+    uint64_t time_ns;
+    _FILE file;
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: can't open %s\n", path);
+        return -1;
+    }
+    /* Index of a crashed run may point past the end */
+    if (fstat(fd, &st) != 0 || offset >= (uint64_t)st.st_size) {
+        offset = 0;
+    }
+    if (lseek(fd, offset, SEEK_SET) == -1 || (file = _OPEN_FD(fd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while (status == 0 && _GETS(line, sizeof(line), file) != NULL) {
+        if (_parse_line_time(line, &time_ns) != 0 || time_ns < from_ns) {
+            continue;
+        }
+        if (time_ns > to_ns) {
+            status = 1;
+        }
+        else {
+            fputs(line, stdout);
+        }
+    }
+    _CLOSE(file);
+    return status;
+}
+
+/*  Parse range time, UTC ('2026-10-17T18:00:00.5Z') or seconds since
+ *  Unix Epoch.
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _parse_time (const char *str, uint64_t *time_ns) {
+    char *end;
+    uint64_t seconds;
+
+    if (strchr(str, '-') == NULL) {
+        seconds = strtoull(str, &end, 10);
+        if (end == str || *end != '\0') {
+            return -1;
+        }
+        *time_ns = seconds * 1000000000ULL;
+        return 0;
+    }
+    return _parse_line_time(str, time_ns);
+}
+
+/*  Parse timestamp ('YYYY-MM-DDTHH:MM:SS[.fraction]Z', see 'timestamp.h')
+ *  of a line, or of a string, which starts with it.
+ *  return: 0 on success, -1 if there is none
+ */
+static int8_t _parse_line_time (const char *str, uint64_t *time_ns) {
+    const char *key = strstr(str, TIMESTAMP_JSON_KEY);
+    uint64_t fraction_ns = 0;
+    uint64_t digit_ns = 100000000ULL;
+    struct tm tm;
+    int len = 0;
+
+    if (key != NULL) {
+        str = key + sizeof(TIMESTAMP_JSON_KEY) - 1;
+    }
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(str, "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon,
+            &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &len) != 6) {
+        return -1;
+    }
+    str += len;
+    if (*str == '.') {
+        for (str++; *str >= '0' && *str <= '9'; str++) {
+            fraction_ns += (*str - '0') * digit_ns;
+            digit_ns /= 10;
+        }
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *time_ns = timegm(&tm) * 1000000000ULL + fraction_ns;
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "scheduler.h"
+#include "../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* For memory operations */
+#include <errno.h>          /* Error number definitions */
+#include <time.h>           /* clock_gettime */
+#include <sys/epoll.h>      /* epoll_create1, epoll_ctl, epoll_wait */
+
+
+/* LOCALS *********************************************************************/
+
+/* Epoll instance file descriptor (one scheduler per thread) */
+static __thread int epoll_fd = -1;
+
+/* Events returned by last 'epoll_wait()' */
+static __thread struct epoll_event events[SCHEDULER_MAX_EVENTS];
+
+/* Armed timers, min-heap ordered by deadline (nearest first) */
+static __thread scheduler_timer_t *timer_heap[SCHEDULER_MAX_TIMERS];
+static __thread int16_t num_of_timers = 0;
+
+
+/* PROTOTYPES *****************************************************************/
+
+static int8_t _ctl_fd (int op, int fd, uint32_t events);
+static int _get_wait_time (int timeout_ms);
+static void _expire_timers (void);
+static void _heap_remove (scheduler_timer_t *timer);
+static void _heap_swap (int16_t a, int16_t b);
+static void _heap_sift_up (int16_t idx);
+static void _heap_sift_down (int16_t idx);
+static void _report_errno (const char *location);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Create epoll instance.
+ */
+int8_t scheduler_init (void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        _report_errno("scheduler_init");
+        return -1;
+    }
+    return 0;
+}
+
+/*  Register file descriptor.
+ */
+int8_t scheduler_add_fd (int fd, uint32_t events) {
+    return _ctl_fd(EPOLL_CTL_ADD, fd, events);
+}
+
+/*  Change events of registered file descriptor.
+ */
+int8_t scheduler_mod_fd (int fd, uint32_t events) {
+    return _ctl_fd(EPOLL_CTL_MOD, fd, events);
+}
+
+/*  Unregister file descriptor.
+ */
+int8_t scheduler_del_fd (int fd) {
+    return _ctl_fd(EPOLL_CTL_DEL, fd, 0);
+}
+
+/*  Wait for events or nearest timer deadline. File descriptors are left for
+ *  tasks to handle (level triggered), timers are marked as expired here.
+ */
+int scheduler_wait (int timeout_ms) {
+    int num_of_events = epoll_wait(
+        epoll_fd, events, SCHEDULER_MAX_EVENTS, _get_wait_time(timeout_ms));
+
+    if (num_of_events == -1) {
+        /* Interrupted by signal, not an error */
+        if (errno == EINTR) {
+            return 0;
+        }
+        _report_errno("scheduler_wait");
+        return -1;
+    }
+
+    _expire_timers();
+
+    return num_of_events;
+}
+
+/*  Get monotonic time in ms.
+ */
+uint64_t scheduler_get_time_ms (void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/*  Init timer (not in heap, expired).
+ */
+int8_t scheduler_timer_init (scheduler_timer_t *timer) {
+    timer->deadline_ms = 0;
+    timer->heap_idx = -1;
+    timer->state = SCHEDULER_TIMER_EXPIRED;
+    return 0;
+}
+
+/*  (Re)start one-shot timer, move it to its place in heap.
+ */
+int8_t scheduler_timer_start (scheduler_timer_t *timer, uint32_t time_ms) {
+    timer->deadline_ms = scheduler_get_time_ms() + time_ms;
+
+    if (timer->heap_idx == -1) {
+        if (num_of_timers >= SCHEDULER_MAX_TIMERS) {
+            LOG_ERROR("Error: scheduler_timer_start | too many timers\n");
+            return -1;
+        }
+        timer->heap_idx = num_of_timers;
+        timer_heap[num_of_timers] = timer;
+        num_of_timers++;
+    }
+    /* Deadline could have moved in either direction */
+    _heap_sift_up(timer->heap_idx);
+    _heap_sift_down(timer->heap_idx);
+
+    timer->state = SCHEDULER_TIMER_ARMED;
+    return 0;
+}
+
+/*  Stop timer.
+ */
+int8_t scheduler_timer_stop (scheduler_timer_t *timer) {
+    _heap_remove(timer);
+    timer->state = SCHEDULER_TIMER_STOPPED;
+    return 0;
+}
+
+/*  Check timer expiration. Expiration could have happened after the last
+ *  'scheduler_wait()', so armed timers are checked against current time.
+ */
+int8_t scheduler_timer_has_ended (scheduler_timer_t *timer) {
+    if (timer->state == SCHEDULER_TIMER_ARMED &&
+            scheduler_get_time_ms() >= timer->deadline_ms) {
+        _heap_remove(timer);
+        timer->state = SCHEDULER_TIMER_EXPIRED;
+    }
+    return (timer->state == SCHEDULER_TIMER_EXPIRED) ? 0 : 1;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Wrapper around 'epoll_ctl()'.
+ */
+static int8_t _ctl_fd (int op, int fd, uint32_t events) {
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, op, fd, &event) != 0) {
+        _report_errno("scheduler epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+/*  Limit wait time to nearest timer deadline.
+ *  return: wait time in ms (-1 is forever)
+ */
+static int _get_wait_time (int timeout_ms) {
+    uint64_t now;
+    uint64_t until_deadline;
+
+    if (num_of_timers == 0) {
+        return timeout_ms;
+    }
+
+    now = scheduler_get_time_ms();
+    if (timer_heap[0]->deadline_ms <= now) {
+        return SCHEDULER_WAIT_NONE;
+    }
+    until_deadline = timer_heap[0]->deadline_ms - now;
+    if (timeout_ms == SCHEDULER_WAIT_FOREVER ||
+            until_deadline < (uint64_t)timeout_ms) {
+        return (int)until_deadline;
+    }
+    return timeout_ms;
+}
+
+/*  Mark all timers with past deadline as expired and remove them from heap.
+ */
+static void _expire_timers (void) {
+    uint64_t now = scheduler_get_time_ms();
+
+    while (num_of_timers > 0 && timer_heap[0]->deadline_ms <= now) {
+        timer_heap[0]->state = SCHEDULER_TIMER_EXPIRED;
+        _heap_remove(timer_heap[0]);
+    }
+}
+
+/*  Remove timer from heap (if it's there), last one takes its place.
+ */
+static void _heap_remove (scheduler_timer_t *timer) {
+    int16_t idx = timer->heap_idx;
+
+    if (idx == -1) {
+        return;
+    }
+    num_of_timers--;
+    if (idx != num_of_timers) {
+        _heap_swap(idx, num_of_timers);
+        _heap_sift_up(idx);
+        _heap_sift_down(idx);
+    }
+    timer->heap_idx = -1;
+}
+
+/*  Swap two heap entries and update their positions.
+ */
+static void _heap_swap (int16_t a, int16_t b) {
+    scheduler_timer_t *tmp = timer_heap[a];
+    timer_heap[a] = timer_heap[b];
+    timer_heap[b] = tmp;
+    timer_heap[a]->heap_idx = a;
+    timer_heap[b]->heap_idx = b;
+}
+
+/*  Move entry towards root, while its deadline is nearer than parent's.
+ */
+static void _heap_sift_up (int16_t idx) {
+    int16_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (timer_heap[parent]->deadline_ms <= timer_heap[idx]->deadline_ms) {
+            break;
+        }
+        _heap_swap(idx, parent);
+        idx = parent;
+    }
+}
+
+/*  Move entry towards leaves, while any child's deadline is nearer.
+ */
+static void _heap_sift_down (int16_t idx) {
+    int16_t child;
+
+    while ((child = 2 * idx + 1) < num_of_timers) {
+        /* Nearer of both children */
+        if (child + 1 < num_of_timers && timer_heap[child + 1]->deadline_ms <
+                timer_heap[child]->deadline_ms) {
+            child++;
+        }
+        if (timer_heap[idx]->deadline_ms <= timer_heap[child]->deadline_ms) {
+            break;
+        }
+        _heap_swap(idx, child);
+        idx = child;
+    }
+}
+
+/*  Prints location, error # and verbose.
+ */
+static void _report_errno (const char *location) {
+    LOG_ERROR("Error: %s | (%d) %s\n", location, errno, strerror(errno));
+}
@@ -0,0 +1,120 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/*
+ *  Event based scheduler. Replaces fixed sleep between task loops with
+ *  'epoll_wait()', which returns as soon as one of the registered file
+ *  descriptors (serial port, socket) is ready, or one of the timers expires.
+ *
+ *  Tasks are still run by the main loop. The scheduler only decides, when
+ *  the next loop should run.
+ *
+ *  Timers are deadlines on CLOCK_MONOTONIC (ms resolution, immune to wall
+ *  clock steps), kept in a min-heap. The nearest deadline limits the
+ *  'epoll_wait()' timeout, so (re)starting a timer costs no system call.
+ *
+ *  Scheduler state is kept per thread, so in threaded pipeline mode each
+ *  thread waits only on the events and timers registered from it.
+ *
+ *	Useful links:
+ *		epoll: http://man7.org/linux/man-pages/man7/epoll.7.html
+ *		clock_gettime: http://man7.org/linux/man-pages/man2/clock_gettime.2.html
+ */
+
+#include <stdint.h>         /* Data types */
+#include <sys/epoll.h>      /* EPOLLIN, EPOLLOUT */
+
+
+/* Max number of events handled by single 'epoll_wait()' call */
+#define SCHEDULER_MAX_EVENTS                (16)
+
+/* Max number of armed timers (per thread), each upload connection may arm
+ * a few */
+#define SCHEDULER_MAX_TIMERS                (32)
+
+/* Wait timeout values [ms] */
+#define SCHEDULER_WAIT_FOREVER              (-1)
+#define SCHEDULER_WAIT_NONE                 (0)
+
+/* Timer states */
+#define SCHEDULER_TIMER_STOPPED             0
+#define SCHEDULER_TIMER_ARMED               1
+#define SCHEDULER_TIMER_EXPIRED             2
+
+
+/* One-shot timer, deadline on CLOCK_MONOTONIC */
+struct _scheduler_timer {
+    /* Expiration time [ms] */
+    uint64_t deadline_ms;
+    /* Position in timer heap, -1 if not armed */
+    int16_t heap_idx;
+    int8_t state;
+};
+
+typedef struct _scheduler_timer scheduler_timer_t;
+
+
+/*  Create epoll instance. Call before any other scheduler function (once
+ *  in each thread, that uses the scheduler).
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_init (void);
+
+/*  Register file descriptor, so that it wakes up the main loop.
+ *   p1: file descriptor
+ *   p2: epoll events (EPOLLIN, EPOLLOUT)
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_add_fd (int fd, uint32_t events);
+
+/*  Change events of already registered file descriptor.
+ *   p1: file descriptor
+ *   p2: epoll events (EPOLLIN, EPOLLOUT)
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_mod_fd (int fd, uint32_t events);
+
+/*  Unregister file descriptor (call before closing it).
+ *   p1: file descriptor
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_del_fd (int fd);
+
+/*  Wait for events. Timer expirations are handled internally.
+ *   p1: timeout in ms (SCHEDULER_WAIT_FOREVER, SCHEDULER_WAIT_NONE ...)
+ *  return: number of events on success, -1 on error
+ */
+int scheduler_wait (int timeout_ms);
+
+/*  Get monotonic time (not affected by wall clock changes).
+ *  return: time in ms
+ */
+uint64_t scheduler_get_time_ms (void);
+
+/*  Init timer. Timer is initially expired.
+ *   p1: pointer to timer struct
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_timer_init (scheduler_timer_t *timer);
+
+/*  (Re)start one-shot timer (only in thread, which waits for it).
+ *   p1: pointer to timer struct
+ *   p2: time until expiration in ms
+ *  return: 0 on success, -1 on error (too many timers)
+ */
+int8_t scheduler_timer_start (scheduler_timer_t *timer, uint32_t time_ms);
+
+/*  Stop timer, stopped timer never expires.
+ *   p1: pointer to timer struct
+ *  return: 0 on success, -1 on error
+ */
+int8_t scheduler_timer_stop (scheduler_timer_t *timer);
+
+/*  Check timer expiration.
+ *   p1: pointer to timer struct
+ *  return: 0 when expired, 1 when still running or stopped
+ */
+int8_t scheduler_timer_has_ended (scheduler_timer_t *timer);
+
+
+#endif
@@ -0,0 +1,704 @@
+#include "segment.h"
+#include "../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <stdlib.h>         /* realloc, free, qsort */
+#include <string.h>         /* memcpy, strcmp, strlen */
+#include <errno.h>          /* Error number definitions */
+#include <time.h>           /* gmtime_r, strftime */
+#include <fcntl.h>          /* File control definitions */
+#include <unistd.h>         /* close, read, fsync, ftruncate, unlink */
+#include <dirent.h>         /* opendir, readdir */
+#include <pthread.h>        /* Background thread */
+#include <sys/stat.h>       /* stat */
+#if (SEGMENT_COMPRESS == 1)
+#include <zlib.h>           /* gzip streams */
+#endif
+
+
+/* Unfinished compressed segment (or index), removed if found on start */
+#define _TMP_EXT                    ".tmp"
+
+/* New segment, whose name is taken, gets the next second's name */
+#define _OPEN_RETRIES               (60)
+
+
+/* Finished segment file (or leftover) in directory */
+struct _segment_file {
+    char name[SEGMENT_PATH_SIZE];
+    uint64_t size;
+};
+
+typedef struct _segment_file segment_file_t;
+
+
+/* LOCALS *********************************************************************/
+
+/* Directory, base name with '-' and extension of segments */
+static char dir[SEGMENT_PATH_SIZE];
+static char prefix[SEGMENT_PATH_SIZE];
+static char ext[SEGMENT_PATH_SIZE];
+
+/* Current segment and its index (storage task only), -1 if none is open */
+static int fd = -1;
+static int index_fd = -1;
+static uint64_t window;
+static uint64_t size;
+
+/* Lines counted, but not yet committed, and their index entries */
+static uint64_t pending_size;
+static segment_index_t pending_index[SEGMENT_INDEX_BATCH_SIZE];
+static uint8_t num_of_pending_index;
+/* Last index entry */
+static uint64_t index_time_ns;
+static uint32_t index_lines;
+
+/* Shared with background thread: current segment's name ("" if none is
+ * open) and finished segments, waiting for it */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static char current_name[SEGMENT_PATH_SIZE];
+static char queue[SEGMENT_QUEUE_SIZE][SEGMENT_PATH_SIZE];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+#if (SEGMENT_COMPRESS == 1)
+/* Compression input (background thread only) */
+static char chunk[SEGMENT_COMPRESS_CHUNK];
+#endif
+
+
+/* PROTOTYPES *****************************************************************/
+
+static void _set_current (const char *name);
+static void *_thread (void *arg);
+static int _list (segment_file_t **files);
+static int _compare (const void *a, const void *b);
+static void _remove_leftovers (void);
+static void _apply_retention (void);
+static int8_t _has_ext (const char *name, const char *_ext);
+static int8_t _compress (const char *name);
+#if (SEGMENT_COMPRESS == 1)
+static int8_t _compress_range (int in, int out, uint64_t len);
+static int _read_index (const char *path, uint64_t max_offset,
+    segment_index_t **index);
+static int8_t _write_file (const char *path, const void *data, size_t len);
+#endif
+static void _sync_dir (void);
+static int8_t _get_path (char *path, const char *name, const char *_ext);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Split base path into directory, name and extension, start background
+ *  thread.
+ */
+int8_t segment_init (const char *path) {
+    const char *name = strrchr(path, '/');
+    const char *dot;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int result;
+
+    if (name == NULL || strlen(path) >= SEGMENT_PATH_SIZE) {
+        return -1;
+    }
+    memcpy(dir, path, name - path);
+    dir[name - path] = '\0';
+    name++;
+
+    /* Extension is kept after time ("data.json" -> "data-<time>.json") */
+    dot = strrchr(name, '.');
+    if (dot == NULL) {
+        dot = name + strlen(name);
+    }
+    memcpy(prefix, name, dot - name);
+    memcpy(&prefix[dot - name], "-", 2);
+    memcpy(ext, dot, strlen(dot) + 1);
+
+    /* Full name has to fit, including time and compressed extension */
+    if (strlen(dir) + strlen(prefix) + SEGMENT_TIME_LEN + strlen(ext) +
+            sizeof(SEGMENT_COMPRESS_EXT SEGMENT_INDEX_EXT _TMP_EXT) + 1 >
+            SEGMENT_PATH_SIZE) {
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    result = pthread_create(&thread, &attr, &_thread, NULL);
+    pthread_attr_destroy(&attr);
+    return (result == 0) ? 0 : -1;
+}
+
+/*  Create new segment file, named after current time.
+ */
+int segment_open (uint64_t now_ns) {
+    char name[SEGMENT_PATH_SIZE];
+    char path[SEGMENT_PATH_SIZE];
+    char time_str[SEGMENT_TIME_LEN + 1];
+    time_t name_s = now_ns / 1000000000ULL;
+    struct tm tm;
+    int i;
+
+    for (i=0; i<_OPEN_RETRIES && fd == -1; i++, name_s++) {
+        gmtime_r(&name_s, &tm);
+        strftime(time_str, sizeof(time_str), SEGMENT_TIME_FORMAT, &tm);
+        /* Length was checked on init */
+        if (snprintf(name, sizeof(name), "%s%s%s", prefix, time_str, ext) >=
+                (int)sizeof(name) || _get_path(path, name, "") != 0) {
+            return -1;
+        }
+
+        /* Published before file exists, so background thread never takes
+         * it for a leftover */
+        _set_current(name);
+        /* Never append to an earlier segment (could be compressed) */
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC,
+            0666);
+        if (fd == -1 && errno != EEXIST) {
+            LOG_ERROR("Error: segment open %s | (%d) %s\n",
+                path, errno, strerror(errno));
+            _set_current("");
+            return -1;
+        }
+    }
+    if (fd == -1) {
+        LOG_ERROR("Error: segment open %s | names taken\n", path);
+        _set_current("");
+        return -1;
+    }
+
+    /* Without index, queries read the whole segment */
+    if (_get_path(path, name, SEGMENT_INDEX_EXT) == 0) {
+        index_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC |
+            O_CLOEXEC, 0666);
+    }
+    if (index_fd == -1) {
+        LOG_WARN("Segment: no index for %s\n", name);
+    }
+
+    window = now_ns / 1000000000ULL / SEGMENT_DURATION_S;
+    size = 0;
+    pending_size = 0;
+    num_of_pending_index = 0;
+    index_time_ns = 0;
+    /* First line gets indexed */
+    index_lines = SEGMENT_INDEX_LINES;
+    return fd;
+}
+
+/*  Check current segment's window and size.
+ */
+int8_t segment_is_due (uint64_t now_ns) {
+    if (fd == -1) {
+        return 0;
+    }
+    if (now_ns / 1000000000ULL / SEGMENT_DURATION_S != window ||
+            size >= SEGMENT_MAX_BYTES) {
+        return 1;
+    }
+    return 0;
+}
+
+/*  Count line, add index entry every SEGMENT_INDEX_LINES lines or
+ *  SEGMENT_INDEX_INTERVAL_S.
+ */
+void segment_add_line (uint64_t time_ns, uint32_t len) {
+    segment_index_t *entry;
+
+    /* Index stays in time order, even if clock goes back */
+    if (time_ns < index_time_ns) {
+        time_ns = index_time_ns;
+    }
+    if ((index_lines >= SEGMENT_INDEX_LINES || time_ns - index_time_ns >=
+            SEGMENT_INDEX_INTERVAL_S * 1000000000ULL) &&
+            num_of_pending_index < SEGMENT_INDEX_BATCH_SIZE) {
+        entry = &pending_index[num_of_pending_index++];
+        entry->time_ns = time_ns;
+        entry->offset = size + pending_size;
+        index_time_ns = time_ns;
+        index_lines = 0;
+    }
+    index_lines++;
+    pending_size += len;
+}
+
+/*  Count pending lines as written, append their index entries.
+ */
+int8_t segment_commit (void) {
+    ssize_t len = num_of_pending_index * sizeof(segment_index_t);
+
+    size += pending_size;
+    pending_size = 0;
+    num_of_pending_index = 0;
+
+    if (index_fd == -1 || len == 0) {
+        return 0;
+    }
+    /* Index written after its lines never points past them */
+    if (write(index_fd, pending_index, len) != len) {
+        LOG_ERROR("Error: segment index write | (%d) %s\n",
+            errno, strerror(errno));
+        close(index_fd);
+        index_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*  Forget pending lines, so the part of them, which was written, doesn't
+ *  stay in segment (lines are written again, to next segment).
+ */
+int8_t segment_discard (void) {
+    pending_size = 0;
+    num_of_pending_index = 0;
+
+    if (fd != -1 && ftruncate(fd, size) != 0) {
+        LOG_ERROR("Error: segment truncate | (%d) %s\n",
+            errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*  Flush segment and index (data only, no metadata).
+ */
+int8_t segment_sync (void) {
+    int8_t status = 0;
+    if (fd != -1 && fdatasync(fd) != 0) {
+        status = -1;
+    }
+    if (index_fd != -1 && fdatasync(index_fd) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+/*  Get index file of current segment.
+ */
+int segment_get_index_fd (void) {
+    return index_fd;
+}
+
+/*  Close current segment, queue it for compression and retention.
+ */
+void segment_close (void) {
+    uint8_t idx;
+
+    if (fd == -1) {
+        return;
+    }
+    close(fd);
+    fd = -1;
+    if (index_fd != -1) {
+        close(index_fd);
+        index_fd = -1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (queue_count < SEGMENT_QUEUE_SIZE) {
+        idx = (queue_head + queue_count) % SEGMENT_QUEUE_SIZE;
+        memcpy(queue[idx], current_name, SEGMENT_PATH_SIZE);
+        queue_count++;
+        pthread_cond_signal(&cond);
+    }
+    else {
+        LOG_WARN("Segment: queue full, %s handled on next start\n",
+            current_name);
+    }
+    current_name[0] = '\0';
+    pthread_mutex_unlock(&mutex);
+}
+
+/*  Compare with current segment's name.
+ */
+int8_t segment_is_current (const char *name) {
+    int8_t is_current;
+
+    pthread_mutex_lock(&mutex);
+    is_current = (current_name[0] != '\0' &&
+        strcmp(name, current_name) == 0) ? 1 : 0;
+    pthread_mutex_unlock(&mutex);
+    return is_current;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Set current segment's name ("" if none is open).
+ */
+static void _set_current (const char *name) {
+    pthread_mutex_lock(&mutex);
+    snprintf(current_name, sizeof(current_name), "%s", name);
+    pthread_mutex_unlock(&mutex);
+}
+
+/*  Background thread: handle leftovers of earlier runs, then compress each
+ *  finished segment and apply retention budget.
+ */
+static void *_thread (void *arg) {
+    char name[SEGMENT_PATH_SIZE];
+
+    _remove_leftovers();
+    _apply_retention();
+
+    while (1) {
+        pthread_mutex_lock(&mutex);
+        while (queue_count == 0) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        memcpy(name, queue[queue_head], SEGMENT_PATH_SIZE);
+        queue_head = (queue_head + 1) % SEGMENT_QUEUE_SIZE;
+        queue_count--;
+        pthread_mutex_unlock(&mutex);
+
+        if (SEGMENT_COMPRESS == 1) {
+            _compress(name);
+        }
+        _apply_retention();
+    }
+    return NULL;
+}
+
+/*  List finished segments (all but current one), oldest first.
+ *   p1: where list is returned (free it after use)
+ *  return: number of segments, -1 on error
+ */
+static int _list (segment_file_t **files) {
+    char path[SEGMENT_PATH_SIZE];
+    segment_file_t *list = NULL;
+    segment_file_t *tmp;
+    int num_of_files = 0;
+    int list_size = 0;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dp = opendir(dir);
+
+    if (dp == NULL) {
+        LOG_ERROR("Error: segment opendir %s | (%d) %s\n",
+            dir, errno, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    while ((entry = readdir(dp)) != NULL) {
+        /* Current segment and its index are not finished */
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0 ||
+                (current_name[0] != '\0' && strncmp(entry->d_name,
+                current_name, strlen(current_name)) == 0)) {
+            continue;
+        }
+        if (_get_path(path, entry->d_name, "") != 0 ||
+                stat(path, &st) != 0 || S_ISREG(st.st_mode) == 0) {
+            continue;
+        }
+        if (num_of_files == list_size) {
+            list_size = (list_size == 0) ? 64 : list_size * 2;
+            tmp = realloc(list, list_size * sizeof(segment_file_t));
+            if (tmp == NULL) {
+                break;
+            }
+            list = tmp;
+        }
+        snprintf(list[num_of_files].name, SEGMENT_PATH_SIZE, "%s",
+            entry->d_name);
+        list[num_of_files].size = st.st_size;
+        num_of_files++;
+    }
+    pthread_mutex_unlock(&mutex);
+    closedir(dp);
+
+    qsort(list, num_of_files, sizeof(segment_file_t), &_compare);
+    *files = list;
+    return num_of_files;
+}
+
+/*  Compare segment names (time order).
+ */
+static int _compare (const void *a, const void *b) {
+    return strcmp(((const segment_file_t *)a)->name,
+        ((const segment_file_t *)b)->name);
+}
+
+/*  Remove unfinished compressed segments, compress the uncompressed ones
+ *  (earlier run ended before it did).
+ */
+static void _remove_leftovers (void) {
+    char path[SEGMENT_PATH_SIZE];
+    segment_file_t *files = NULL;
+    int num_of_files = _list(&files);
+    int i;
+
+    for (i=0; i<num_of_files; i++) {
+        if (_has_ext(files[i].name, _TMP_EXT) == 1) {
+            _get_path(path, files[i].name, "");
+            unlink(path);
+        }
+        else if (SEGMENT_COMPRESS == 1 && _has_ext(files[i].name, ext) == 1) {
+            _compress(files[i].name);
+        }
+    }
+    free(files);
+}
+
+/*  Delete oldest segments, until the rest fits into retention budget.
+ */
+static void _apply_retention (void) {
+    char path[SEGMENT_PATH_SIZE];
+    segment_file_t *files = NULL;
+    int num_of_files = _list(&files);
+    uint64_t total = 0;
+    int8_t is_deleted = 0;
+    /* Files of one segment share its start time ("data-<time>") */
+    size_t stem_len = strlen(prefix) + SEGMENT_TIME_LEN;
+    int i;
+
+    for (i=0; i<num_of_files; i++) {
+        total += files[i].size;
+    }
+    for (i=0; i<num_of_files; i++) {
+        /* Files of the same segment (compressed, indexes) go together */
+        if (total <= SEGMENT_RETENTION_BYTES && (i == 0 || strncmp(
+                files[i].name, files[i-1].name, stem_len) != 0)) {
+            break;
+        }
+        _get_path(path, files[i].name, "");
+        if (unlink(path) == 0) {
+            if (_has_ext(files[i].name, SEGMENT_INDEX_EXT) == 0) {
+                LOG_INFO("Segment: retention, deleted %s\n", files[i].name);
+            }
+            total -= files[i].size;
+            is_deleted = 1;
+        }
+    }
+    free(files);
+
+    if (is_deleted == 1) {
+        _sync_dir();
+    }
+}
+
+/*  Check file name's ending.
+ *  return: 1 if name ends with extension, else 0
+ */
+static int8_t _has_ext (const char *name, const char *_ext) {
+    size_t name_len = strlen(name);
+    size_t ext_len = strlen(_ext);
+    return (name_len >= ext_len &&
+        strcmp(&name[name_len - ext_len], _ext) == 0) ? 1 : 0;
+}
+
+/*  Compress segment to '<name>.gz' as a series of gzip members, which start
+ *  at index entries (at least SEGMENT_COMPRESS_MEMBER_BYTES apart). Member
+ *  starts go to '<name>.gz.idx'. Both are written to temporary files first,
+ *  so that only complete ones get the name, then segment is deleted.
+ *   p1: segment's file name
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _compress (const char *name) {
+#if (SEGMENT_COMPRESS == 1)
+    char src[SEGMENT_PATH_SIZE];
+    char dst[SEGMENT_PATH_SIZE];
+    char tmp[SEGMENT_PATH_SIZE];
+    char src_index[SEGMENT_PATH_SIZE];
+    char dst_index[SEGMENT_PATH_SIZE];
+    char tmp_index[SEGMENT_PATH_SIZE];
+    segment_index_t *index = NULL;
+    int num_of_entries = 0;
+    int num_of_members = 0;
+    uint64_t member_start = 0;
+    int8_t status = 0;
+    struct stat st;
+    int in;
+    int out;
+    int i;
+
+    if (_get_path(src, name, "") != 0 ||
+            _get_path(dst, name, SEGMENT_COMPRESS_EXT) != 0 ||
+            _get_path(tmp, name, SEGMENT_COMPRESS_EXT _TMP_EXT) != 0 ||
+            _get_path(src_index, name, SEGMENT_INDEX_EXT) != 0 ||
+            _get_path(dst_index, name,
+                SEGMENT_COMPRESS_EXT SEGMENT_INDEX_EXT) != 0 ||
+            _get_path(tmp_index, name,
+                SEGMENT_COMPRESS_EXT SEGMENT_INDEX_EXT _TMP_EXT) != 0) {
+        return -1;
+    }
+
+    in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        LOG_ERROR("Error: segment compress open %s | (%d) %s\n",
+            src, errno, strerror(errno));
+        return -1;
+    }
+    out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (out == -1 || fstat(in, &st) != 0) {
+        status = -1;
+    }
+    else {
+        /* Index of crashed run may point past the end */
+        num_of_entries = _read_index(src_index, st.st_size, &index);
+    }
+
+    /* Compressed index is written over the segment's one */
+    for (i=0; i<num_of_entries && status == 0; i++) {
+        if (index[i].offset < member_start + SEGMENT_COMPRESS_MEMBER_BYTES) {
+            continue;
+        }
+        status = _compress_range(in, out, index[i].offset - member_start);
+        member_start = index[i].offset;
+        index[num_of_members].time_ns = index[i].time_ns;
+        index[num_of_members].offset = lseek(out, 0, SEEK_CUR);
+        num_of_members++;
+    }
+    /* Last (or only) member */
+    if (status == 0) {
+        status = _compress_range(in, out, UINT64_MAX);
+    }
+    if (status == 0 && fsync(out) != 0) {
+        status = -1;
+    }
+    if (out != -1) {
+        close(out);
+    }
+    close(in);
+
+    /* First member needs no entry, queries start at the beginning */
+    if (status == 0 && num_of_members > 0) {
+        status = _write_file(tmp_index, index,
+            num_of_members * sizeof(segment_index_t));
+        if (status == 0) {
+            status = rename(tmp_index, dst_index);
+        }
+    }
+    free(index);
+
+    if (status != 0 || rename(tmp, dst) != 0) {
+        LOG_ERROR("Error: segment compress %s | (%d) %s\n",
+            src, errno, strerror(errno));
+        unlink(tmp);
+        unlink(tmp_index);
+        unlink(dst_index);
+        return -1;
+    }
+    unlink(src);
+    unlink(src_index);
+    _sync_dir();
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+#if (SEGMENT_COMPRESS == 1)
+/*  Compress part of segment as one gzip member (gzip stream closes its own
+ *  copy of output fd).
+ *   p1: segment fd, read from its current position
+ *   p2: output fd, written at its current position
+ *   p3: number of bytes (stops at end of segment)
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _compress_range (int in, int out, uint64_t len) {
+    int gz_fd = dup(out);
+    gzFile gz = (gz_fd != -1) ? gzdopen(gz_fd, SEGMENT_COMPRESS_LEVEL) : NULL;
+    ssize_t result = 1;
+
+    if (gz == NULL) {
+        if (gz_fd != -1) {
+            close(gz_fd);
+        }
+        return -1;
+    }
+    while (len > 0 && result > 0) {
+        result = read(in, chunk, (len < sizeof(chunk)) ? len : sizeof(chunk));
+        if (result > 0 && gzwrite(gz, chunk, result) != result) {
+            result = -1;
+        }
+        if (result > 0) {
+            len -= result;
+        }
+    }
+    return (gzclose(gz) == Z_OK && result >= 0) ? 0 : -1;
+}
+
+/*  Read index entries, which point within segment.
+ *   p1: index path
+ *   p2: segment size
+ *   p3: where entries are returned (free them after use)
+ *  return: number of entries (0 without index)
+ */
+static int _read_index (const char *path, uint64_t max_offset,
+        segment_index_t **index) {
+    int index_fd = open(path, O_RDONLY | O_CLOEXEC);
+    int num_of_entries = 0;
+    struct stat st;
+    ssize_t len;
+
+    *index = NULL;
+    if (index_fd == -1) {
+        return 0;
+    }
+    if (fstat(index_fd, &st) == 0 && st.st_size >= sizeof(segment_index_t)) {
+        len = st.st_size - st.st_size % sizeof(segment_index_t);
+        *index = malloc(len);
+        if (*index != NULL && read(index_fd, *index, len) == len) {
+            num_of_entries = len / sizeof(segment_index_t);
+        }
+    }
+    close(index_fd);
+
+    while (num_of_entries > 0 &&
+            (*index)[num_of_entries - 1].offset >= max_offset) {
+        num_of_entries--;
+    }
+    return num_of_entries;
+}
+
+/*  Write whole file and flush it to storage.
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _write_file (const char *path, const void *data, size_t len) {
+    int8_t status = -1;
+    int file_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (file_fd == -1) {
+        return -1;
+    }
+    if (write(file_fd, data, len) == (ssize_t)len && fsync(file_fd) == 0) {
+        status = 0;
+    }
+    close(file_fd);
+    return status;
+}
+#endif
+
+/*  Make renames and deletes in segment directory durable.
+ */
+static void _sync_dir (void) {
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+/*  Get full path of file in segment directory.
+ *   p1: where path is written (SEGMENT_PATH_SIZE)
+ *   p2: file name
+ *   p3: extension added to name (may be "")
+ *  return: 0 on success, -1 if path doesn't fit
+ */
+static int8_t _get_path (char *path, const char *name, const char *_ext) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    size_t ext_len = strlen(_ext);
+
+    if (dir_len + 1 + name_len + ext_len >= SEGMENT_PATH_SIZE) {
+        return -1;
+    }
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(&path[dir_len + 1], name, name_len);
+    memcpy(&path[dir_len + 1 + name_len], _ext, ext_len + 1);
+    return 0;
+}
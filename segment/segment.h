@@ -0,0 +1,136 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+/*
+ *  Measurements log as a series of segment files, each named after the time
+ *  it was started (UTC):
+ *      measurement/data-20261017T180512Z.json
+ *  A segment ends with its time window (aligned to UTC), or once it reaches
+ *  SEGMENT_MAX_BYTES. Finished segments are compressed by a background
+ *  thread (gzip, '.gz' is appended to the name), then the oldest segments
+ *  are deleted until all finished ones fit into the retention budget.
+ *
+ *  Segments left uncompressed by an earlier run are compressed on start.
+ *
+ *  Each segment has a sparse time index next to it ('<segment>.idx'), which
+ *  maps arrival time to byte offset of a line, every SEGMENT_INDEX_LINES
+ *  lines or SEGMENT_INDEX_INTERVAL_S. Compressed segments consist of
+ *  independent gzip members (about SEGMENT_COMPRESS_MEMBER_BYTES of input
+ *  each), and their index ('<segment>.gz.idx') points to member starts.
+ *  See 'query/query.c' for time range queries, and 'segment_reader' for
+ *  uploading from the log.
+ */
+
+#include <stdint.h>         /* Data types */
+
+
+/* Full path of a segment file */
+#define SEGMENT_PATH_SIZE                   (256)
+
+/* Time window of one segment [s] (3600 hourly, 86400 daily) */
+#ifndef SEGMENT_DURATION_S
+#define SEGMENT_DURATION_S                  (3600)
+#endif
+/* Size, after which segment ends before its window does */
+#define SEGMENT_MAX_BYTES                   (16 * 1024 * 1024)
+
+/* Max size of all finished segments, oldest are deleted first */
+#ifndef SEGMENT_RETENTION_BYTES
+#define SEGMENT_RETENTION_BYTES             (256 * 1024 * 1024)
+#endif
+
+/* Compress finished segments (needs zlib) */
+#ifndef SEGMENT_COMPRESS
+#define SEGMENT_COMPRESS                    (1)
+#endif
+#define SEGMENT_COMPRESS_EXT                ".gz"
+#define SEGMENT_COMPRESS_LEVEL              "wb6"
+#define SEGMENT_COMPRESS_CHUNK              (64 * 1024)
+
+/* Sparse index: entry every so many lines or seconds (whichever first) */
+#define SEGMENT_INDEX_EXT                   ".idx"
+#define SEGMENT_INDEX_LINES                 (256)
+#define SEGMENT_INDEX_INTERVAL_S            (60)
+/* Max index entries per commit (further lines get indexed later) */
+#define SEGMENT_INDEX_BATCH_SIZE            (32)
+/* Input size of a gzip member, start of member is indexed */
+#define SEGMENT_COMPRESS_MEMBER_BYTES       (64 * 1024)
+
+/* Start time in segment name, sorts in time order */
+#define SEGMENT_TIME_FORMAT                 "%Y%m%dT%H%M%SZ"
+#define SEGMENT_TIME_LEN                    (16)
+
+/* Finished segments waiting for background thread, further ones stay
+ * uncompressed until next start */
+#define SEGMENT_QUEUE_SIZE                  (8)
+
+
+/* Index entry: first line at offset arrived at (or after) given time.
+ * Entries are in time and offset order. */
+struct _segment_index {
+    uint64_t time_ns;
+    uint64_t offset;
+};
+
+typedef struct _segment_index segment_index_t;
+
+
+/*  Set segment names and start background thread.
+ *   p1: base path, segments are named '<base>-<time><ext>'
+ *       (for example '/home/pi/measurement/data.json')
+ *  return: 0 on success, -1 on error
+ */
+int8_t segment_init (const char *path);
+
+/*  Start new segment.
+ *   p1: current time in ns since Unix Epoch
+ *  return: file descriptor (append only), -1 on error
+ */
+int segment_open (uint64_t now_ns);
+
+/*  Check, whether current segment should be closed (before writing more).
+ *   p1: current time in ns since Unix Epoch
+ *  return: 1 when segment's window has passed or it is full, else 0
+ */
+int8_t segment_is_due (uint64_t now_ns);
+
+/*  Count line, which is about to be written to current segment (lines
+ *  have to be written in the same order), add index entry when due.
+ *   p1: line's arrival time in ns since Unix Epoch
+ *   p2: line's length (including '\n')
+ */
+void segment_add_line (uint64_t time_ns, uint32_t len);
+
+/*  Confirm lines counted so far as written, write their index entries.
+ *  return: 0 on success, -1 on error (index not written)
+ */
+int8_t segment_commit (void);
+
+/*  Drop lines counted since last commit (write failed), cut current
+ *  segment back to the end of committed lines.
+ *  return: 0 on success, -1 on error (segment may end with a torn line)
+ */
+int8_t segment_discard (void);
+
+/*  Flush current segment and its index to storage.
+ *  return: 0 on success, -1 on error
+ */
+int8_t segment_sync (void);
+
+/*  Get current segment's index file (for syncing it asynchronously).
+ *  return: file descriptor, -1 if there is none
+ */
+int segment_get_index_fd (void);
+
+/*  Close current segment and hand it over to background thread.
+ */
+void segment_close (void);
+
+/*  Check, whether segment is still being written (safe from any thread).
+ *   p1: segment file name (without directory and compressed extension)
+ *  return: 1 if it is the current segment, else 0
+ */
+int8_t segment_is_current (const char *name);
+
+
+#endif
@@ -0,0 +1,452 @@
+#include "segment_reader.h"
+#include "../segment/segment.h"
+#include "../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* memchr, memcpy, memmove, strcmp, strlen */
+#include <errno.h>          /* Error number definitions */
+#include <fcntl.h>          /* File control definitions */
+#include <unistd.h>         /* read, write, lseek, close, fdatasync */
+#include <dirent.h>         /* opendir, readdir */
+#if (SEGMENT_COMPRESS == 1)
+#include <zlib.h>           /* gzip streams */
+#endif
+
+
+/* Cursor past the end of a segment (nothing left to read in it) */
+#define _END_OFFSET                 (UINT64_MAX)
+
+/* Cursor is written here first, then renamed */
+#define _TMP_EXT                    ".tmp"
+
+#define _CURSOR_SIZE                (SEGMENT_PATH_SIZE + 32)
+
+
+/* LOCALS *********************************************************************/
+
+/* Directory, base name with '-' and extension of segments */
+static char dir[SEGMENT_PATH_SIZE];
+static char prefix[SEGMENT_PATH_SIZE];
+static char ext[SEGMENT_PATH_SIZE];
+static char cursor_path[SEGMENT_PATH_SIZE];
+
+/* Segment being read ("" before the first one), without compressed
+ * extension, and offset of 'buf[buf_pos]' within it */
+static char name[SEGMENT_PATH_SIZE];
+static uint64_t offset;
+
+/* Open segment, plain or compressed (-1 and NULL if none) */
+static int fd = -1;
+#if (SEGMENT_COMPRESS == 1)
+static gzFile gz = NULL;
+#endif
+
+/* Bytes read ahead, starting with oldest unreleased line */
+static char buf[SEGMENT_READER_BUF_SIZE];
+static uint32_t buf_pos = 0;
+static uint32_t buf_len = 0;
+/* Length of peeked line (including '\n'), 0 if none */
+static uint32_t line_len = 0;
+/* Length of all lines peeked since 'segment_reader_peek' (including the
+ * first one) */
+static uint32_t peek_len = 0;
+
+
+/* PROTOTYPES *****************************************************************/
+
+static int8_t _set_names (const char *path, const char *_cursor_path);
+static int8_t _load (void);
+static int8_t _save (void);
+static int8_t _open (void);
+static void _close (void);
+static ssize_t _read (void);
+static int8_t _next (void);
+static int8_t _find (char *found, int8_t is_newest);
+static int8_t _get_key (const char *entry, char *key);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Set names, continue from cursor (or after newest segment).
+ */
+int8_t segment_reader_init (const char *path, const char *_cursor_path) {
+    if (_set_names(path, _cursor_path) != 0) {
+        return -1;
+    }
+
+    if (_load() != 0) {
+        /* Earlier segments are not pending, start with next one */
+        if (_find(name, 1) != 0) {
+            name[0] = '\0';
+        }
+        offset = _END_OFFSET;
+        return 0;
+    }
+    if (_open() != 0) {
+        LOG_WARN("Segment reader: %s deleted before it was read\n", name);
+    }
+    return 0;
+}
+
+/*  Find next line, move to next segment after the end of a finished one.
+ */
+char *segment_reader_peek (uint32_t *len) {
+    char *end;
+    int8_t is_finished;
+    ssize_t result;
+
+    while (line_len == 0) {
+        end = memchr(&buf[buf_pos], '\n', buf_len - buf_pos);
+        if (end != NULL) {
+            *end = '\0';
+            line_len = end - &buf[buf_pos] + 1;
+            break;
+        }
+
+        /* Storage has written all of a segment, which is no longer current,
+         * so reading to its end once more (after the check) gets all */
+        is_finished = (name[0] == '\0' || segment_is_current(name) == 0);
+        result = _read();
+        if (result > 0) {
+            continue;
+        }
+        if (result == 0 && is_finished == 0) {
+            return NULL;
+        }
+        if (result == 0 && buf_pos < buf_len) {
+            LOG_WARN("Segment reader: incomplete line at end of %s\n", name);
+        }
+        if (_next() != 0) {
+            return NULL;
+        }
+    }
+
+    /* Following lines are peeked again */
+    peek_len = line_len;
+    *len = line_len - 1;
+    return &buf[buf_pos];
+}
+
+/*  Find line after peeked ones, within current segment.
+ */
+char *segment_reader_peek_next (uint32_t max_len, uint32_t *len) {
+    char *line;
+    char *end;
+
+    if (line_len == 0) {
+        return NULL;
+    }
+    end = memchr(&buf[buf_pos + peek_len], '\n', buf_len - buf_pos - peek_len);
+    /* Peeked lines stay in buffer (moved to its start) */
+    if (end == NULL && !(buf_pos == 0 && buf_len == sizeof(buf)) &&
+            _read() > 0) {
+        end = memchr(&buf[buf_pos + peek_len], '\n',
+            buf_len - buf_pos - peek_len);
+    }
+    if (end == NULL) {
+        return NULL;
+    }
+    line = &buf[buf_pos + peek_len];
+    if ((uint32_t)(end - line) > max_len) {
+        return NULL;
+    }
+    *len = end - line;
+    peek_len += *len + 1;
+    return line;
+}
+
+/*  Move past given number of peeked lines, save new position. Lines
+ *  peeked after them stay peeked.
+ */
+int8_t segment_reader_release (uint32_t count) {
+    uint32_t len;
+    char *end;
+
+    if (line_len == 0) {
+        return 1;
+    }
+    /* First line is '\0' terminated, the rest are not */
+    len = line_len;
+    while (count > 1 && len < peek_len) {
+        end = memchr(&buf[buf_pos + len], '\n', peek_len - len);
+        len = end - &buf[buf_pos] + 1;
+        count--;
+    }
+    buf_pos += len;
+    offset += len;
+    peek_len -= len;
+    line_len = 0;
+    /* Next peeked line becomes the first one */
+    if (peek_len > 0) {
+        end = memchr(&buf[buf_pos], '\n', peek_len);
+        *end = '\0';
+        line_len = end - &buf[buf_pos] + 1;
+    }
+    return _save();
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Split base path into directory, name and extension (same as segments).
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _set_names (const char *path, const char *_cursor_path) {
+    const char *base = strrchr(path, '/');
+    const char *dot;
+
+    if (base == NULL || strlen(path) >= SEGMENT_PATH_SIZE ||
+            strlen(_cursor_path) + sizeof(_TMP_EXT) > SEGMENT_PATH_SIZE) {
+        return -1;
+    }
+    memcpy(dir, path, base - path);
+    dir[base - path] = '\0';
+    base++;
+
+    dot = strrchr(base, '.');
+    if (dot == NULL) {
+        dot = base + strlen(base);
+    }
+    memcpy(prefix, base, dot - base);
+    memcpy(&prefix[dot - base], "-", 2);
+    memcpy(ext, dot, strlen(dot) + 1);
+    memcpy(cursor_path, _cursor_path, strlen(_cursor_path) + 1);
+    return 0;
+}
+
+/*  Read cursor file.
+ *  return: 0 on success, -1 if there is none (or it's not valid)
+ */
+static int8_t _load (void) {
+    char cursor[_CURSOR_SIZE];
+    char key[SEGMENT_PATH_SIZE];
+    unsigned long long _offset;
+    ssize_t len;
+    int cursor_fd = open(cursor_path, O_RDONLY | O_CLOEXEC);
+
+    if (cursor_fd == -1) {
+        return -1;
+    }
+    len = read(cursor_fd, cursor, sizeof(cursor) - 1);
+    close(cursor_fd);
+    if (len <= 0) {
+        return -1;
+    }
+    cursor[len] = '\0';
+
+    if (sscanf(cursor, "%255s %llu", name, &_offset) != 2 ||
+            _get_key(name, key) != 0 || strcmp(key, name) != 0) {
+        LOG_WARN("Segment reader: cursor %s not valid\n", cursor_path);
+        return -1;
+    }
+    offset = _offset;
+    return 0;
+}
+
+/*  Replace cursor file. Rename keeps either old or new cursor, so
+ *  directory is not synced (old one only repeats a line).
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _save (void) {
+    char cursor[_CURSOR_SIZE];
+    char tmp_path[SEGMENT_PATH_SIZE];
+    int8_t status = 0;
+    int len;
+    int cursor_fd;
+
+    len = snprintf(cursor, sizeof(cursor), "%s %llu\n",
+        name, (unsigned long long)offset);
+    /* Length was checked on init */
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s" _TMP_EXT, cursor_path) >=
+            (int)sizeof(tmp_path)) {
+        return -1;
+    }
+
+    cursor_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0666);
+    if (cursor_fd == -1) {
+        status = -1;
+    }
+    else {
+        if (write(cursor_fd, cursor, len) != len ||
+                fdatasync(cursor_fd) != 0) {
+            status = -1;
+        }
+        close(cursor_fd);
+    }
+    if (status == 0 && rename(tmp_path, cursor_path) != 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        LOG_ERROR("Error: segment reader cursor %s | (%d) %s\n",
+            cursor_path, errno, strerror(errno));
+    }
+    return status;
+}
+
+/*  Open current segment at current offset, plain one if it still exists.
+ *  return: 0 on success, -1 if it's missing (or can't be opened)
+ */
+static int8_t _open (void) {
+    char path[SEGMENT_PATH_SIZE];
+
+    buf_pos = 0;
+    buf_len = 0;
+    line_len = 0;
+    peek_len = 0;
+    if (offset == _END_OFFSET || snprintf(path, sizeof(path), "%s/%s",
+            dir, name) >= (int)sizeof(path) - (int)sizeof(SEGMENT_COMPRESS_EXT)) {
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        if (lseek(fd, offset, SEEK_SET) == -1) {
+            _close();
+            return -1;
+        }
+        return 0;
+    }
+#if (SEGMENT_COMPRESS == 1)
+    /* Compressed meanwhile, offset is within uncompressed data */
+    strcat(path, SEGMENT_COMPRESS_EXT);
+    gz = gzopen(path, "rb");
+    if (gz != NULL) {
+        gzbuffer(gz, SEGMENT_COMPRESS_CHUNK);
+        if (gzseek(gz, offset, SEEK_SET) == -1) {
+            _close();
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+/*  Close current segment.
+ */
+static void _close (void) {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+#if (SEGMENT_COMPRESS == 1)
+    if (gz != NULL) {
+        gzclose(gz);
+        gz = NULL;
+    }
+#endif
+}
+
+/*  Read more of current segment after unreleased bytes (a line, which is
+ *  not complete yet). Line, which doesn't fit the buffer, is cut.
+ *  return: number of bytes read, 0 at end (or without segment), -1 on error
+ */
+static ssize_t _read (void) {
+    ssize_t result = 0;
+
+    if (buf_pos > 0) {
+        memmove(buf, &buf[buf_pos], buf_len - buf_pos);
+        buf_len -= buf_pos;
+        buf_pos = 0;
+    }
+    if (buf_len == sizeof(buf)) {
+        LOG_WARN("Segment reader: line too long in %s, cut\n", name);
+        offset += buf_len;
+        buf_len = 0;
+    }
+
+    if (fd != -1) {
+        result = read(fd, &buf[buf_len], sizeof(buf) - buf_len);
+    }
+#if (SEGMENT_COMPRESS == 1)
+    else if (gz != NULL) {
+        result = gzread(gz, &buf[buf_len], sizeof(buf) - buf_len);
+    }
+#endif
+
+    if (result > 0) {
+        buf_len += result;
+    }
+    else if (result < 0) {
+        LOG_ERROR("Error: segment reader read %s | (%d) %s\n",
+            name, errno, strerror(errno));
+    }
+    return result;
+}
+
+/*  Move to the oldest segment after current one, save position.
+ *  return: 0 on success, 1 if there is none yet
+ */
+static int8_t _next (void) {
+    char found[SEGMENT_PATH_SIZE];
+
+    if (_find(found, 0) != 0) {
+        return 1;
+    }
+    _close();
+    memcpy(name, found, sizeof(name));
+    offset = 0;
+    if (_open() != 0) {
+        LOG_WARN("Segment reader: %s deleted before it was read\n", name);
+    }
+    _save();
+    return 0;
+}
+
+/*  Find oldest segment after current one, or newest segment.
+ *   p1: where segment's name is returned (without compressed extension)
+ *   p2: 1 for newest, 0 for next one
+ *  return: 0 on success, -1 if there is none
+ */
+static int8_t _find (char *found, int8_t is_newest) {
+    char key[SEGMENT_PATH_SIZE];
+    struct dirent *entry;
+    DIR *dp = opendir(dir);
+
+    if (dp == NULL) {
+        LOG_ERROR("Error: segment reader opendir %s | (%d) %s\n",
+            dir, errno, strerror(errno));
+        return -1;
+    }
+    found[0] = '\0';
+    while ((entry = readdir(dp)) != NULL) {
+        if (_get_key(entry->d_name, key) != 0) {
+            continue;
+        }
+        if (is_newest == 1) {
+            if (strcmp(key, found) > 0) {
+                memcpy(found, key, SEGMENT_PATH_SIZE);
+            }
+        }
+        else if (strcmp(key, name) > 0 &&
+                (found[0] == '\0' || strcmp(key, found) < 0)) {
+            memcpy(found, key, SEGMENT_PATH_SIZE);
+        }
+    }
+    closedir(dp);
+    return (found[0] == '\0') ? -1 : 0;
+}
+
+/*  Get segment's name without compressed extension, skip other files
+ *  (indexes, temporary files).
+ *   p1: file name
+ *   p2: where name is returned
+ *  return: 0 for a segment, -1 for other files
+ */
+static int8_t _get_key (const char *entry, char *key) {
+    size_t len = strlen(prefix) + SEGMENT_TIME_LEN + strlen(ext);
+
+    /* Prefix, start time, extension (and compressed extension) */
+    if (strlen(entry) < len || len >= SEGMENT_PATH_SIZE ||
+            strncmp(entry, prefix, strlen(prefix)) != 0 ||
+            strncmp(&entry[len - strlen(ext)], ext, strlen(ext)) != 0 ||
+            (entry[len] != '\0' &&
+            strcmp(&entry[len], SEGMENT_COMPRESS_EXT) != 0)) {
+        return -1;
+    }
+    memcpy(key, entry, len);
+    key[len] = '\0';
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef SEGMENT_READER_H
+#define SEGMENT_READER_H
+
+/*
+ *  Sequential reader of measurement segments (see 'segment/segment.h'),
+ *  used to upload straight from the measurements log. Lines are read in
+ *  the order they were stored, across segments, and only complete lines
+ *  are returned (storage may be writing the current segment meanwhile).
+ *
+ *  Several lines can be peeked and released together (batch upload), then
+ *  cursor is saved once per batch.
+ *
+ *  Position of the oldest line, which is not yet released (acknowledged),
+ *  is kept in a cursor file ('<segment name> <offset>', offset within
+ *  uncompressed segment), so reading resumes there after restart. Cursor
+ *  is replaced atomically (temporary file, rename) on every release.
+ *
+ *  Without cursor file, reading starts with segments stored from now on.
+ *  Segments deleted by retention before they were read are skipped (and
+ *  reported), so backlog is limited by SEGMENT_RETENTION_BYTES.
+ *
+ *  Single reader, use from one thread only.
+ */
+
+#include <stdint.h>         /* Data types */
+
+
+/* Read buffer, max line length (longer lines are skipped) */
+#define SEGMENT_READER_BUF_SIZE             (64 * 1024)
+
+
+/*  Set segment names, load cursor and open segment it points to.
+ *   p1: base path of segments, same as given to 'segment_init'
+ *   p2: cursor file path
+ *  return: 0 on success, -1 on error
+ */
+int8_t segment_reader_init (const char *path, const char *cursor_path);
+
+/*  Get oldest line, which is not released yet (same line until released).
+ *   p1: where line length is returned (without '\n')
+ *  return: pointer to '\0' terminated line, valid until release, NULL if
+ *          there is no complete line yet
+ */
+char *segment_reader_peek (uint32_t *len);
+
+/*  Get line after the ones peeked since 'segment_reader_peek' (or still
+ *  peeked after release), within the same segment. Lines returned earlier
+ *  are moved (copy them before).
+ *   p1: max line length, longer line is not peeked (left for later)
+ *   p2: where line length is returned (without '\n')
+ *  return: pointer to line (not '\0' terminated), NULL if there is no
+ *          complete line yet (or it's too long)
+ */
+char *segment_reader_peek_next (uint32_t max_len, uint32_t *len);
+
+/*  Move past oldest peeked lines and save cursor, the rest stay peeked.
+ *   p1: number of lines, the one returned by 'segment_reader_peek' and
+ *       following ones returned by 'segment_reader_peek_next' (1 if only
+ *       peeked)
+ *  return: 0 on success, 1 if no line was peeked, -1 if cursor wasn't
+ *          saved (reader moved on anyway)
+ */
+int8_t segment_reader_release (uint32_t count);
+
+
+#endif
@@ -0,0 +1,332 @@
+#include "aggregate_task.h"
+#include "../task.h"
+#include "../../fifo/fifo.h"
+#include "../../timestamp/timestamp.h"
+#include "../../scheduler/scheduler.h"
+#include "../../anemo_record/anemo_record.h"
+#include "../../log/log.h"
+
+#include <stdio.h>          /* Standard input/output definitions */
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* memset, strncmp */
+
+
+/* Window length [ns] */
+#define _WINDOW_NS                  \
+    ((uint64_t)AGGREGATE_TASK_WINDOW_S * 1000000000ULL)
+
+
+/* Sums of single sensor value within window */
+struct _aggregate_value {
+    uint32_t count;
+    /* Min and max as received (mantissa and decimals, see 'anemo_record') */
+    int32_t min;
+    int32_t max;
+    uint8_t min_decimals;
+    uint8_t max_decimals;
+    /* Most decimals of any value */
+    uint8_t decimals;
+    double sum;
+};
+
+/* Sums of single station within window */
+struct _aggregate_station {
+    char station[ANEMO_RECORD_STATION_SIZE];
+    uint32_t count;
+    struct _aggregate_value values[ANEMO_RECORD_NUM_OF_KEYS];
+};
+
+typedef struct _aggregate_value aggregate_value_t;
+typedef struct _aggregate_station aggregate_station_t;
+
+
+/* LOCALS *********************************************************************/
+
+/* Raw measurements, read by aggregation (reader 0) and data storage */
+static str_fifo_t raw_fifo = {
+	0,
+	0,
+	AGGREGATE_FIFO_BUF_SIZE,
+	AGGREGATE_FIFO_STR_SIZE,
+	NULL
+};
+
+/* Requests fifo, gets summaries */
+static str_fifo_t *output_fifo;
+
+/* Current window (number of windows since Unix Epoch) and its sums */
+static uint64_t window;
+static int8_t is_window_open = 0;
+static aggregate_station_t stations[AGGREGATE_TASK_MAX_STATIONS];
+static uint8_t num_of_stations = 0;
+/* Summaries of closing window, which are already written (rest waits for
+ * space in requests fifo) */
+static uint8_t num_of_summaries = 0;
+
+/* Ends window, if no measurement of the next one arrives */
+static scheduler_timer_t window_timer;
+
+/* Summary JSON of single station */
+static char summary[AGGREGATE_TASK_JSON_SIZE];
+
+/* Decimal mantissa to value */
+static const double decimal_divisors[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+
+/* PROTOTYPES *****************************************************************/
+
+static void _open_window (uint64_t _window);
+static int8_t _close_window (void);
+static void _add_record (const anemo_record_t *record);
+static aggregate_station_t *_get_station (const char *station);
+static int _write_summary (aggregate_station_t *station);
+static double _get_value (int32_t mantissa, uint8_t decimals);
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Set up raw measurements fifo, keep requests fifo for summaries.
+ */
+int8_t aggregate_task_init_fifo (str_fifo_t **_fifo, str_fifo_t *_output_fifo) {
+    output_fifo = _output_fifo;
+    /* Set outer pointer to point to fifo local struct */
+    *_fifo = &raw_fifo;
+
+    int8_t fifo_status = setup_str_fifo(
+        &raw_fifo, AGGREGATE_FIFO_BUF_SIZE, AGGREGATE_FIFO_STR_SIZE);
+    if (fifo_status == 0) {
+        fifo_status = str_fifo_set_overflow(&raw_fifo,
+            AGGREGATE_FIFO_OVERFLOW, NULL);
+    }
+    return fifo_status;
+}
+
+/*  Get requests fifo.
+ */
+str_fifo_t *aggregate_task_get_output_fifo (void) {
+    return output_fifo;
+}
+
+/*  Create window timer, stopped until first measurement.
+ */
+int8_t aggregate_task_init_events (void) {
+    int8_t error_control = 0;
+    error_control += scheduler_timer_init(&window_timer);
+    error_control += scheduler_timer_stop(&window_timer);
+    return (error_control == 0) ? 0 : -1;
+}
+
+/*  Sum up raw measurements in arrival order. Measurement of a later window
+ *  (or window timer) closes current window.
+ */
+int8_t aggregate_task_run (void) {
+    const anemo_record_t *record;
+    char *data;
+    uint64_t record_window;
+    uint16_t num_of_entries;
+
+    /* Window ended without newer measurements */
+    if (is_window_open == 1 && scheduler_timer_has_ended(&window_timer) == 0 &&
+            _close_window() != 0) {
+        return TASK_STATUS_IDLE;
+    }
+
+    for (num_of_entries = 0; num_of_entries < AGGREGATE_TASK_DRAIN_BUDGET;
+            num_of_entries++) {
+        /* If available, get raw measurement from fifo (no copy) */
+        data = str_fifo_peek(&raw_fifo);
+        if (data == NULL) {
+            return TASK_STATUS_IDLE;
+        }
+
+        /* JSON, which doesn't fit the schema, only goes to data storage */
+        if (anemo_record_is_record(data, str_fifo_get_len(data)) == 1) {
+            record = (const anemo_record_t *)data;
+            record_window = record->arrival_ns / _WINDOW_NS;
+
+            /* Summary of current window goes first, keep measurement if it
+             * has to wait. Late measurements count in current window. */
+            if (is_window_open == 1 && record_window > window &&
+                    _close_window() != 0) {
+                return TASK_STATUS_IDLE;
+            }
+            if (is_window_open == 0) {
+                _open_window(record_window);
+            }
+            _add_record(record);
+        }
+
+        /* Done with measurement (freed, once storage is done with it) */
+        str_fifo_release(&raw_fifo);
+    }
+
+    /* Budget used up, more measurements are waiting */
+    if (str_fifo_peek(&raw_fifo) != NULL) {
+        return TASK_STATUS_BUSY;
+    }
+    return TASK_STATUS_IDLE;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Reset sums and start timer, which ends window (after grace time).
+ *   p1: window (number of windows since Unix Epoch)
+ */
+static void _open_window (uint64_t _window) {
+    uint64_t now_ns = get_timestamp_ns();
+    uint64_t end_ns = (_window + 1) * _WINDOW_NS;
+    uint32_t time_ms = AGGREGATE_TASK_GRACE_MS;
+
+    if (end_ns > now_ns) {
+        time_ms += (end_ns - now_ns) / 1000000;
+    }
+
+    memset(stations, 0, sizeof(stations));
+    num_of_stations = 0;
+    num_of_summaries = 0;
+    window = _window;
+    is_window_open = 1;
+
+    scheduler_timer_start(&window_timer, time_ms);
+}
+
+/*  Write summary of each station in window to requests fifo.
+ *  return: 0 when window is closed, 1 if summary waits for space
+ */
+static int8_t _close_window (void) {
+    int len;
+
+    while (num_of_summaries < num_of_stations) {
+        len = _write_summary(&stations[num_of_summaries]);
+        if (len < 0) {
+            LOG_ERROR("Error: aggregate summary too long (%s), dropped\n",
+                stations[num_of_summaries].station);
+        }
+        else if (str_fifo_write_stamped(output_fifo, summary, len,
+                window * _WINDOW_NS) == FIFO_WRITE_FULL) {
+            return 1;
+        }
+        num_of_summaries++;
+    }
+
+    is_window_open = 0;
+    scheduler_timer_stop(&window_timer);
+    return 0;
+}
+
+/*  Add record's values to its station's sums.
+ */
+static void _add_record (const anemo_record_t *record) {
+    aggregate_station_t *station = _get_station(record->station);
+    aggregate_value_t *value;
+    double x;
+    int i;
+
+    if (station == NULL) {
+        LOG_ERROR("Error: aggregate stations full, %s not summed\n",
+            record->station);
+        return;
+    }
+    station->count++;
+
+    for (i=0; i<record->num_of_values; i++) {
+        value = &station->values[record->keys[i]];
+        x = _get_value(record->values[i], record->decimals[i]);
+
+        if (value->count == 0 ||
+                x < _get_value(value->min, value->min_decimals)) {
+            value->min = record->values[i];
+            value->min_decimals = record->decimals[i];
+        }
+        if (value->count == 0 ||
+                x > _get_value(value->max, value->max_decimals)) {
+            value->max = record->values[i];
+            value->max_decimals = record->decimals[i];
+        }
+        if (record->decimals[i] > value->decimals) {
+            value->decimals = record->decimals[i];
+        }
+        value->sum += x;
+        value->count++;
+    }
+}
+
+/*  Get station's sums, add station if it's new in window.
+ *  return: pointer to sums, NULL if there is no space left
+ */
+static aggregate_station_t *_get_station (const char *station) {
+    int i;
+    for (i=0; i<num_of_stations; i++) {
+        if (strncmp(stations[i].station, station,
+                ANEMO_RECORD_STATION_SIZE) == 0) {
+            return &stations[i];
+        }
+    }
+    if (num_of_stations == AGGREGATE_TASK_MAX_STATIONS) {
+        return NULL;
+    }
+    memcpy(stations[num_of_stations].station, station,
+        ANEMO_RECORD_STATION_SIZE);
+    return &stations[num_of_stations++];
+}
+
+/*  Write station's summary JSON to 'summary'.
+ *  return: JSON length (without '\0'), -1 if it doesn't fit
+ */
+static int _write_summary (aggregate_station_t *station) {
+    aggregate_value_t *value;
+    int8_t is_first = 1;
+    int pos = 1;
+    int len;
+    int i;
+
+    /* Timestamp of window start */
+    summary[0] = '{';
+    if (get_timestamp_json_w_comma_at(&summary[pos],
+            window * _WINDOW_NS) != 0) {
+        return -1;
+    }
+    pos += TIMESTAMP_JSON_W_COMMA_LEN;
+
+    len = snprintf(&summary[pos], AGGREGATE_TASK_JSON_SIZE - pos,
+        AGGREGATE_TASK_HEAD_FORMAT, AGGREGATE_TASK_WINDOW_S,
+        station->station, station->count);
+    if (len < 0 || len >= AGGREGATE_TASK_JSON_SIZE - pos) {
+        return -1;
+    }
+    pos += len;
+
+    for (i=0; i<ANEMO_RECORD_NUM_OF_KEYS; i++) {
+        value = &station->values[i];
+        if (value->count == 0) {
+            continue;
+        }
+        if (is_first == 0) {
+            summary[pos++] = ',';
+        }
+        is_first = 0;
+
+        len = snprintf(&summary[pos], AGGREGATE_TASK_JSON_SIZE - pos,
+            AGGREGATE_TASK_VALUE_FORMAT, anemo_record_get_key(i),
+            value->min_decimals, _get_value(value->min, value->min_decimals),
+            value->max_decimals, _get_value(value->max, value->max_decimals),
+            value->decimals + AGGREGATE_TASK_MEAN_DECIMALS,
+            value->sum / value->count, value->count);
+        /* Keep space for comma or closing braces */
+        if (len < 0 || len >= AGGREGATE_TASK_JSON_SIZE - pos - 2) {
+            return -1;
+        }
+        pos += len;
+    }
+
+    memcpy(&summary[pos], "}}", 3);
+    return pos + 2;
+}
+
+/*  Get value of decimal mantissa (2105, 2 -> 21.05).
+ */
+static double _get_value (int32_t mantissa, uint8_t decimals) {
+    return mantissa / decimal_divisors[decimals];
+}
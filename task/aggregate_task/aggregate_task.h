@@ -0,0 +1,83 @@
+#ifndef AGGREGATE_TASK
+#define AGGREGATE_TASK
+
+/*
+ *  Optional edge aggregation, between buffer task and requests. Raw
+ *  measurements (binary records) go to a fifo read by data storage and this
+ *  task. Per time window and station, this task keeps min, max, mean and
+ *  count of each sensor value, and writes one summary JSON per window into
+ *  the requests fifo. Memory is fixed (AGGREGATE_TASK_MAX_STATIONS).
+ *
+ *  Build with 'make AGGREGATE=1' to enable (implies binary records).
+ */
+
+#include "../../fifo/fifo.h"
+#include "../buffer_task/buffer_task.h"
+
+#include <stdint.h>         /* Data types */
+
+
+#ifndef AGGREGATE_TASK_ENABLED
+#define AGGREGATE_TASK_ENABLED              (0)
+#endif
+
+#if (AGGREGATE_TASK_ENABLED == 1 && BUFFER_TASK_BINARY_RECORDS != 1)
+#error "Aggregation needs binary records (BUFFER_TASK_BINARY_RECORDS)"
+#endif
+
+/* Window length [s], windows are aligned to wall clock (UTC) */
+#ifndef AGGREGATE_TASK_WINDOW_S
+#define AGGREGATE_TASK_WINDOW_S             (60)
+#endif
+/* Wait for late measurements after window's end [ms] */
+#define AGGREGATE_TASK_GRACE_MS             (1000)
+
+/* Max stations per window, measurements of further ones are not summed */
+#define AGGREGATE_TASK_MAX_STATIONS         (4)
+/* Decimals of mean, on top of the most precise value in window */
+#define AGGREGATE_TASK_MEAN_DECIMALS        (1)
+
+/* Max raw measurements handled in one run */
+#define AGGREGATE_TASK_DRAIN_BUDGET         (32)
+
+/* Raw measurements fifo, read by aggregation (reader 0) and storage */
+#define AGGREGATE_FIFO_BUF_SIZE             (1024)
+#define AGGREGATE_FIFO_STR_SIZE             (FIFO_STRING_SIZE)
+/* Both readers are local, old data gets dropped (FIFO_OVERFLOW_...) */
+#define AGGREGATE_FIFO_OVERFLOW             (FIFO_OVERFLOW_DROP_OLDEST)
+
+/* Summary JSON, including '\0'. Timestamp (window start) is followed by
+ * head, and a value object for each sensor value key in window. */
+#define AGGREGATE_TASK_JSON_SIZE            (FIFO_STRING_SIZE)
+#define AGGREGATE_TASK_HEAD_FORMAT          \
+    "\"window_s\":%u,\"station\":\"%s\",\"count\":%u,\"data\":{"
+#define AGGREGATE_TASK_VALUE_FORMAT         \
+    "\"%s\":{\"min\":%.*f,\"max\":%.*f,\"mean\":%.*f,\"count\":%u}"
+
+
+/*  Set up raw measurements fifo and attach to requests fifo.
+ *   p1: pointer to where raw fifo's address is written
+ *   p2: requests fifo, gets summaries (may be the same as *p1 on input)
+ *  return: 0 on success, -1 on error
+ */
+int8_t aggregate_task_init_fifo (str_fifo_t **_fifo, str_fifo_t *_output_fifo);
+
+/*  Get requests fifo, which gets summaries.
+ *  return: pointer to fifo struct
+ */
+str_fifo_t *aggregate_task_get_output_fifo (void);
+
+/*  Create window timer (call after 'scheduler_init').
+ *  return: 0 on success, -1 on error
+ */
+int8_t aggregate_task_init_events (void);
+
+/*  Sum up raw measurements (up to AGGREGATE_TASK_DRAIN_BUDGET), write
+ *  summary once window ends.
+ *  return: 0 when fifo was drained (or summary waits for space), 1 when
+ *  more measurements are waiting, -1 on error
+ */
+int8_t aggregate_task_run (void);
+
+
+#endif
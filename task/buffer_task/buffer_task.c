@@ -1,6 +1,10 @@
 #include "buffer_task.h"
+#include "../task.h"
 #include "../../fifo/fifo.h"
 #include "../../timestamp/timestamp.h"
+#include "../../json_framer/json_framer.h"
+#include "../../anemo_record/anemo_record.h"
+#include "../../log/log.h"
 //#include "../../serial/serial.h"
 
 #include <stdint.h>         /* Data types */
@@ -11,38 +15,45 @@
 
 /* LOCALS *********************************************************************/
 
-/* Local copy of pointer to three fifo buffers
+/* Local copy of pointer to two fifo buffers
  *  1: Raw incoming UART data
- *  2: Data storage buffer
- *  3: Requests buffer
+ *  2: Measurements buffer, read by both data storage and requests
  */
-static str_fifo_t *fifo_buffers[3];
+static str_fifo_t *fifo_buffers[2];
 
-/* Store oldest entry from raw serial fifo buffer */
-static char tmp_serial_buffer[FIFO_STRING_SIZE];
+/* Oldest entry in raw serial fifo buffer (read in place) */
+static char *tmp_serial_buffer;
+/* Scan position within oldest entry (it can hold several JSON objects) */
+static uint32_t tmp_serial_offset = 0;
 
-/* Save incoming JSON data to buffer */
-static struct Json_incoming json_incoming;
+/* Incoming JSON data, framed across raw serial entries */
+static json_framer_t json_framer;
 
-/* Check that all levels (nested objects) of JSON object were noticed */
-static int8_t json_depth_valid = -1;
+/* Message for measurements fifo: framed JSON with added fields (within
+ * framer's buffer, not terminated), or binary record */
+static char *message;
+static uint32_t message_len = 0;
 
+#if (BUFFER_TASK_BINARY_RECORDS == 1)
+/* Decoded measurement */
+static anemo_record_t record;
+#endif
 
-/* PROTOTYPES *****************************************************************/
+/* JSON waits for space in measurements fifo (blocking policy) */
+static int8_t is_json_pending = 0;
 
-static int8_t _get_json_from_raw (void);
-static int8_t _reset_json_incoming_str_buffer(void);
 
-static void _set_json_incoming_status_to_copy (void);
-static void _set_json_incoming_status_to_copy_stop (void);
-static void _set_json_incoming_status_to_idle (void);
+/* PROTOTYPES *****************************************************************/
 
-static int8_t _is_json_string_copy(void);
-static int8_t _is_json_string_buffer_full(void);
-static int8_t _is_json_string_copy_stop(void);
+static int8_t _publish_message (void);
+static void _print_fifo_stats (void);
 
+static int8_t _prepare_message (void);
 //static int8_t _refresh_timestamp (void);
-static int8_t _add_timestamp_to_json (void);
+static int8_t _add_timestamp_to_json (uint64_t now_ns);
+#if (BUFFER_TASK_BINARY_RECORDS == 1)
+static int8_t _add_timestamp_to_record (uint64_t now_ns);
+#endif
 
 
 /* FUNCTIONS (GLOBAL) *********************************************************/
@@ -50,25 +61,14 @@ static int8_t _add_timestamp_to_json (void);
 /*  Get latest row of raw serial data, look for JSON and if present, copy to
  *  local storage and requests buffer.
  */
-int8_t buffer_task_init (str_fifo_t *_fifo_buffers[3]) {
+int8_t buffer_task_init (str_fifo_t *_fifo_buffers[2]) {
     /* Point to buffers */
     int i;
-    for (i=0; i<3; i++) {
+    for (i=0; i<2; i++) {
         fifo_buffers[i] = _fifo_buffers[i];
-        //printf("-Address: %p, %d\n", (void *)&_fifo_buffers[i], i);
-        //printf("-Address: %p, %d\n", (void *)_fifo_buffers[i], i);
-        //printf("-Address: %p, %d\n", (void *)&fifo_buffers[i], i);
-        /*printf("-Address: %p, %d\n", (void *)fifo_buffers[i], i);
-        printf("%p, %p, %p, %p, %p\n",
-			(void *)&(fifo_buffers[i]->read_idx),
-			(void *)&(fifo_buffers[i]->write_idx),
-			(void *)&(fifo_buffers[i]->buf_size),
-			(void *)&(fifo_buffers[i]->str_size),
-			(void *)&(fifo_buffers[i]->buffer));*/
     }
 
-    json_incoming.num_of_nested_obj = 0;
-    _set_json_incoming_status_to_idle();
+    json_framer_init(&json_framer);
 
     return 0;
 }
@@ -78,206 +78,175 @@ int8_t buffer_task_init (str_fifo_t *_fifo_buffers[3]) {
  */
 int8_t buffer_task_run (void) {
 	//printf("BUFFER TASK\n");
-    /* Clear serial buffer */
-    memset(tmp_serial_buffer, 0, FIFO_STRING_SIZE);
-    /* If available, read raw string from fifo buffer */
-    if (str_fifo_read_auto_inc(fifo_buffers[0], tmp_serial_buffer) == 0) {
-        /* Check for JSON format */
-        if (_get_json_from_raw() == 0) {
-            //printf("%s\n", json_incoming.str_buffer.buffer);
-
-            /* Add system timestamp to JSON string */
-            if (_add_timestamp_to_json() != 0) {
-                printf ("Error: _add_timestamp_to_json\n");
-                return -1;
-            }
-
-
-            //printf("***%s***\n", json_incoming.str_buffer.buffer);
-
-            /* Write JSON data to data storage buffer */
-            str_fifo_write(fifo_buffers[1], json_incoming.str_buffer.buffer);
+    uint16_t num_of_entries;
 
-            /* Write JSON data to requests buffer */
-            str_fifo_write(fifo_buffers[2], json_incoming.str_buffer.buffer);
-            
-            printf("buffer task - fifo indexes:\n"
-                "%u, %u | %u, %u | %u, %u\n",
-                fifo_buffers[0]->read_idx,
-                fifo_buffers[0]->write_idx,
-                fifo_buffers[1]->read_idx,
-                fifo_buffers[1]->write_idx,
-                fifo_buffers[2]->read_idx,
-                fifo_buffers[2]->write_idx);
-
-            _reset_json_incoming_str_buffer();
-        }
+    /* Don't parse any further, until previous JSON gets written */
+    if (is_json_pending == 1 && _publish_message() != 0) {
+        return TASK_STATUS_IDLE;
     }
-    return 0;
-}
-
-
-/* FUNCTIONS (LOCAL) **********************************************************/
 
-/* JSON ***********************************************************************/
+    for (num_of_entries = 0; num_of_entries < BUFFER_TASK_DRAIN_BUDGET;
+            num_of_entries++) {
+        /* If available, get raw string from fifo buffer (no copy) */
+        tmp_serial_buffer = str_fifo_peek(fifo_buffers[0]);
+        if (tmp_serial_buffer == NULL) {
+            return TASK_STATUS_IDLE;
+        }
 
-/*  Get JSON string by reading strings strored in raw serial fifo buffer.
- *  Copy oldest row from fifo serial buffer and look for JSON format. If JSON
- *  format is present, save it to JSON buffer for later use.
- */
-static int8_t _get_json_from_raw (void) {
+        /* Get every complete JSON object from raw string */
+        while (json_framer_feed(&json_framer, tmp_serial_buffer,
+                str_fifo_get_len(tmp_serial_buffer), &tmp_serial_offset,
+                str_fifo_get_stamp(tmp_serial_buffer)) == 0) {
+            LOG_DEBUG("---%s---\n", JSON_FRAMER_OBJECT(&json_framer));
 
-    /* Iterate string in raw serial fifo buffer */
-    int i;
-    for (i=0; i<FIFO_STRING_SIZE; i++) {
-        /* Get JSON opening braces */
-        if (tmp_serial_buffer[i] == '{') {
-            /* Increment number of nested objects */
-            json_incoming.num_of_nested_obj++;
-            /* Whole JSON object was noticed */
-            if (json_incoming.num_of_nested_obj == EXPECTED_JSON_DEPTH) {
-                json_depth_valid = 0;
-            }
-            /* Outer JSON braces */
-            if (json_incoming.num_of_nested_obj == 1) {
-                json_depth_valid = -1;
-                _set_json_incoming_status_to_copy();
-                /* Reset JSON buffer */
-                _reset_json_incoming_str_buffer();
-            }
-        }
-        /* Get JSON closing braces */
-        else if (tmp_serial_buffer[i] == '}') {
-            /* Opening braces were not already found */
-            if (json_incoming.num_of_nested_obj <= 0) {
-                _set_json_incoming_status_to_idle();
-                _reset_json_incoming_str_buffer();
-                return 1;
+            /* Add receive timestamp and delay to JSON string (or record) */
+            int8_t timestamp_status = _prepare_message();
+            if (timestamp_status == -1) {
+                LOG_ERROR("Error: _prepare_message\n");
+                return -1;
             }
-            /* Decrement number of nested objects */
-            json_incoming.num_of_nested_obj--;
-            /* Reached end of JSON */
-            if (json_incoming.num_of_nested_obj == 0) {
-                /* Only inner JSON object was copied */
-                if (json_depth_valid != 0) {
-                    _set_json_incoming_status_to_idle();
-                    _reset_json_incoming_str_buffer();
-                    return 1;
-                }
-                _set_json_incoming_status_to_copy_stop();
+            if (timestamp_status != 0) {
+                LOG_WARN("Error: incoming too long for timestamp, dropped\n");
+                continue;
             }
-        }
-        /* Serial buffer is zero padded at the end */
-        else if (tmp_serial_buffer[i] == 0) {
-            return 1;
-        }
 
-        /* Copy char to JSON buffer */
-        if (_is_json_string_copy() == 0) {
-            json_incoming.str_buffer.buffer
-                [json_incoming.str_buffer.current_write_idx] =
-                tmp_serial_buffer[i];
-            json_incoming.str_buffer.current_write_idx++;
-        }
+            //printf("***%.*s***\n", (int)message_len, message);
 
-        /* Check, that space for null specifier is still available */
-        if (_is_json_string_buffer_full() == 0) {
-            printf("Error: incoming too long, json buffer full\n");
-            _set_json_incoming_status_to_idle();
-            _reset_json_incoming_str_buffer();
+            /* Write JSON data once, for data storage and requests. Keep raw
+             * string, if JSON has to wait. */
+            if (_publish_message() != 0) {
+                return TASK_STATUS_IDLE;
+            }
         }
+        /* Done with raw string, free fifo slot */
+        str_fifo_release(fifo_buffers[0]);
+        tmp_serial_offset = 0;
+    }
 
-        /* Finished, return to idle mode */
-        if (_is_json_string_copy_stop() == 0) {
-            /* Add null at end */
-            json_incoming.str_buffer.buffer
-                [json_incoming.str_buffer.current_write_idx] = '\0';
-            printf("---%s---\n", json_incoming.str_buffer.buffer);
-            _set_json_incoming_status_to_idle();
-            memset(tmp_serial_buffer, 0, FIFO_STRING_SIZE);
-            return 0;
-        }
+    /* Budget used up, more entries are waiting */
+    if (str_fifo_peek(fifo_buffers[0]) != NULL) {
+        return TASK_STATUS_BUSY;
     }
-    return 1;
+    return TASK_STATUS_IDLE;
 }
 
 
-/* Reset JSON buffer
- *
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Write message to measurements fifo. If fifo is full (blocking policy),
+ *  keep it and try again on next run.
+ *  return: 0 on success (or drop), 1 if message is still pending
  */
-int8_t _reset_json_incoming_str_buffer (void) {
-    memset(json_incoming.str_buffer.buffer, 0, FIFO_STRING_SIZE);
-    json_incoming.str_buffer.current_write_idx = 0;
-    //json_incoming.str_buffer.start_write_idx = 0;
+static int8_t _publish_message (void) {
+    if (str_fifo_write_stamped(fifo_buffers[1], message,
+            message_len, json_framer.arrival_ns) == FIFO_WRITE_FULL) {
+        is_json_pending = 1;
+        return 1;
+    }
+    is_json_pending = 0;
+
+    _print_fifo_stats();
     return 0;
 }
 
-/* Set JSON status
+/*  Print fifo counters (depth, high water mark, drops, spills)
  */
-static void _set_json_incoming_status_to_copy (void) {
-    json_incoming.status |= JSON_INCOMING_COPY_MASK;
-}
-static void _set_json_incoming_status_to_copy_stop (void) {
-    json_incoming.status |= JSON_INCOMING_STOP_COPY_MASK;
-}
-static void _set_json_incoming_status_to_idle (void) {
-    json_incoming.status = JSON_INCOMING_IDLE_MASK;
+static void _print_fifo_stats (void) {
+    str_fifo_stats_t stats[2];
+    int i;
+    for (i=0; i<2; i++) {
+        str_fifo_get_stats(fifo_buffers[i], &stats[i]);
+    }
+    LOG_DEBUG("buffer task - fifo depth/high/drops (spilled):\n"
+        "%u/%u/%u | %u/%u/%u (%u)\n",
+        stats[0].depth, stats[0].high_water, stats[0].drops,
+        stats[1].depth, stats[1].high_water, stats[1].drops,
+        stats[1].spill_depth);
 }
 
-/* Check JSON status
+
+/* TIMESTAMP ******************************************************************/
+
+/*  Prepare framed JSON for measurements fifo: decode it into binary record
+ *  (if enabled and JSON fits the schema), or add timestamp fields to JSON.
+ *  return: 0 on success, 1 if JSON would get too long, -1 on error
  */
-static int8_t _is_json_string_copy(void){
-    return (!(
-        json_incoming.status & JSON_INCOMING_COPY_MASK
-    ));
-}
-static int8_t _is_json_string_buffer_full(void){
-    return (!(
-        json_incoming.str_buffer.current_write_idx >=
-        FIFO_STRING_SIZE - 1
-    ));
-}
-static int8_t _is_json_string_copy_stop(void){
-    return (!(
-        json_incoming.status & JSON_INCOMING_STOP_COPY_MASK
-    ));
-}
+static int8_t _prepare_message (void) {
+    uint64_t now_ns = get_timestamp_ns();
 
+    /* Chunk was written without receive time */
+    if (json_framer.arrival_ns == 0 || json_framer.arrival_ns > now_ns) {
+        json_framer.arrival_ns = now_ns;
+    }
 
-/* TIMESTAMP ******************************************************************/
+#if (BUFFER_TASK_BINARY_RECORDS == 1)
+    if (_add_timestamp_to_record(now_ns) == 0) {
+        return 0;
+    }
+#endif
+
+    return _add_timestamp_to_json(now_ns);
+}
 
 /*  Add to system's timestamp to JSON format. Add it outside of 'data', so that
  *  Linux and possible measuring station timestamps are kept separate.
+ *  Timestamp is the arrival time of JSON's first byte, followed by the delay
+ *  until now (time spent in serial fifo and framing).
+ *  Fields are written into framer's headroom, in front of the object, whose
+ *  opening braces get replaced by the last comma. Result is pointed to by
+ *  'message' (no copy of the object).
+ *  return: 0 on success, 1 if JSON would get too long, -1 on error
  */
-static int8_t _add_timestamp_to_json (void) {
-    char tmp_json[FIFO_STRING_SIZE] = {0};
-    char timestamp [TIMESTAMP_JSON_STRING_SIZE] = {0};
-
-    /* Get JSON formatted timestamp */
-    if (get_timestamp_json_w_comma(timestamp) != 0) {
-        printf("Error: get_timestamp_json_w_comma\n");
+static int8_t _add_timestamp_to_json (uint64_t now_ns) {
+    char delay[JSON_DELAY_STRING_SIZE];
+    char *object = JSON_FRAMER_OBJECT(&json_framer);
+
+    /* Delay is the only field of variable length */
+    int delay_len = snprintf(delay, JSON_DELAY_STRING_SIZE,
+        JSON_DELAY_FORMAT_W_COMMA,
+        (unsigned long long)((now_ns - json_framer.arrival_ns) / 1000));
+    if (delay_len < 0 || delay_len >= JSON_DELAY_STRING_SIZE) {
         return -1;
     }
 
-    int tmp_write_idx = 0;
-    int buf_write_idx = 0;
+    /* '{' + fields take place of the original '{' */
+    int fields_len = TIMESTAMP_JSON_W_COMMA_LEN + delay_len;
+    if (fields_len > JSON_FRAMER_HEADROOM ||
+            json_framer.len + fields_len > JSON_FRAMER_BUFFER_SIZE - 1) {
+        return 1;
+    }
+    message = object - fields_len;
+    message_len = json_framer.len + fields_len;
 
-    /* Add opening braces '{' to temporary buffer */
-    tmp_json[tmp_write_idx] = json_incoming.str_buffer.buffer[buf_write_idx];
-    tmp_write_idx++;
-    buf_write_idx++;
+    /* Add timestamp (its '\0' termination gets overwritten by delay) */
+    if (get_timestamp_json_w_comma_at(&message[1],
+            json_framer.arrival_ns) != 0) {
+        LOG_ERROR("Error: get_timestamp_json_w_comma_at\n");
+        return -1;
+    }
+
+    /* Add delay, ending with comma in place of object's opening braces */
+    memcpy(&message[1 + TIMESTAMP_JSON_W_COMMA_LEN], delay, delay_len);
+    message[0] = '{';
 
-    /* Add timestamp (don't include '/0' termination) */
-    memcpy(&tmp_json[tmp_write_idx], timestamp, strlen(timestamp));
-    tmp_write_idx += strlen(timestamp);
+    return 0;
+}
 
-    /* Add received JSON data */
-    memcpy(&tmp_json[tmp_write_idx],
-        &json_incoming.str_buffer.buffer[buf_write_idx],
-        strlen(json_incoming.str_buffer.buffer));
+#if (BUFFER_TASK_BINARY_RECORDS == 1)
+/*  Decode JSON into binary record, with its arrival time and delay.
+ *  return: 0 on success, 1 if JSON doesn't fit the schema
+ */
+static int8_t _add_timestamp_to_record (uint64_t now_ns) {
+    if (anemo_record_parse(&record, JSON_FRAMER_OBJECT(&json_framer),
+            json_framer.len) != 0) {
+        return 1;
+    }
+    record.arrival_ns = json_framer.arrival_ns;
+    record.delay_us = (now_ns - json_framer.arrival_ns) / 1000;
 
-    /* Overwrite incoming JSON data with temporary buffer */
-    memcpy(json_incoming.str_buffer.buffer, tmp_json, strlen(tmp_json) + 1);
+    message = (char *)&record;
+    message_len = sizeof(anemo_record_t);
 
     return 0;
 }
+#endif
@@ -7,38 +7,31 @@
 #include <stdint.h>
 
 
-#define JSON_INCOMING_IDLE_MASK             (0x00)
-#define JSON_INCOMING_COPY_MASK             (0x01)
-#define JSON_INCOMING_STOP_COPY_MASK        (0x02)
-
-#define EXPECTED_JSON_DEPTH                 (2)
-
-
-/* JSON string buffer */
-struct Json_str_buffer {
-    char buffer[FIFO_STRING_SIZE] ;
-    uint16_t current_write_idx;
-    //uint16_t start_write_idx;
-};
+/* Time from arrival of JSON's first byte, until it was handled [us] */
+#define JSON_DELAY_FORMAT_W_COMMA           "\"delay_us\":%llu,"
+#define JSON_DELAY_STRING_SIZE              (32)
+
+/* Decode measurements into binary records (see 'anemo_record.h'), JSON which
+ * doesn't fit the schema is passed on as is */
+#ifndef BUFFER_TASK_BINARY_RECORDS
+#define BUFFER_TASK_BINARY_RECORDS          (0)
+#endif
 
-/* JSON incoming data */
-struct Json_incoming {
-    struct Json_str_buffer str_buffer;
-    uint8_t num_of_nested_obj;
-    uint8_t status;
-};
+/* Max raw serial entries handled in one run */
+#define BUFFER_TASK_DRAIN_BUDGET            (16)
 
 
 /*  Get latest row of raw serial data, look for JSON and if present, copy to
- *  local storage and requests buffer.
- *   p1: pointer to array of fifo struct pointers
+ *  measurements buffer (read by local storage and requests).
+ *   p1: pointer to array of fifo struct pointers (serial, measurements)
  *  return: 0 on success, -1 on error
  */
-int8_t buffer_task_init (str_fifo_t *_fifo_buffers[3]);
+int8_t buffer_task_init (str_fifo_t *_fifo_buffers[2]);
 
-/*  Get latest row of raw serial data, look for JSON and if present, copy to
- *  local storage and requests buffer.
- *  return: 0 on success, -1 on error
+/*  Get oldest rows of raw serial data (up to BUFFER_TASK_DRAIN_BUDGET), look
+ *  for JSON and if present, copy to local storage and requests buffer.
+ *  return: 0 when raw fifo was drained (or JSON waits for space), 1 when
+ *  more rows are waiting, -1 on error
  */
 int8_t buffer_task_run (void);
 
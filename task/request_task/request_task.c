@@ -2,6 +2,12 @@
 #include "../task.h"
 #include "../../fifo/fifo.h"
 #include "../../timestamp/timestamp.h"
+#include "../../scheduler/scheduler.h"
+#include "../../anemo_record/anemo_record.h"
+#include "../../log/log.h"
+#include "../../segment/segment.h"
+#include "../../segment_reader/segment_reader.h"
+#include "../../http_response/http_response.h"
 
 #include <stdio.h> 			/* printf, sprintf */
 #include <stdint.h> 		/* data types */
@@ -14,38 +20,135 @@
 #include <netdb.h> 			/* struct hostent, gethostbyname */
 #include <fcntl.h>			/* File (socket) control - used for setting async */
 #include <errno.h>			/* Socket error reporting */
+#include <time.h>			/* clock_gettime */
+
+
+/* Longest data row, which is sent (longer one fails building request) */
+#define REQUEST_DATA_MAX_LEN			(REQUEST_BUF_SIZE)
+
+/* Request slot states */
+#define _SLOT_QUEUED					0	/* Built, no connection took it */
+#define _SLOT_SENT						1	/* In connection's pipeline */
+#define _SLOT_ACKED						2	/* Acknowledged, not released yet */
+#define _SLOT_REJECTED					3	/* Batch rejected, sent again row by
+											 * row once it's the oldest one */
+
+/* Number of request slots (every connection can fill its window) */
+#define _NUM_OF_SLOTS					\
+	(REQUEST_TASK_CONNECTIONS * REQUEST_TASK_WINDOW)
+
+/* Request, which is not acknowledged yet */
+struct _request_slot {
+	/* Request including headers, body ... */
+	char buf[REQUEST_BUF_SIZE];
+	/* Request length (without '\0') */
+	ssize_t len;
+	/* Number of data rows (released together on acknowledge) */
+	uint32_t data_count;
+	/* _SLOT_... */
+	int8_t state;
+};
+typedef struct _request_slot request_slot_t;
+
+/* Upload connection, with its own socket state machine */
+struct _request_conn {
+	/* Current socket state */
+	int8_t socket_state;
+	/* Connection is used (first one always, others while catching up) */
+	int8_t is_active;
+
+	/* Socket file descriptor (-1 when closed) */
+	int32_t sockfd;
+	/* Socket is connected, kept open between requests */
+	int8_t is_connected;
+	/* Connection already carried a request (server may have closed it
+	 * since) */
+	int8_t is_reused;
+	/* Socket registered with scheduler */
+	int8_t is_socket_registered;
+	/* Epoll events the socket is currently registered for */
+	uint32_t socket_events;
+	/* Start of current connection attempt */
+	uint64_t connect_start_us;
+
+	/* Slots of requests in flight (indexes), oldest one is answered first,
+	 * number of them and how many were sent */
+	uint32_t pipeline[REQUEST_TASK_WINDOW];
+	uint32_t pipeline_head;
+	uint32_t num_of_pipelined;
+	uint32_t num_of_sent;
+
+	/* Received bytes, parsed up to 'read_offset' (rest belongs to following
+	 * responses) */
+	char read_buf[RESPONSE_BUF_SIZE];
+	uint32_t read_len;
+	uint32_t read_offset;
+	/* Oldest response, parsed as it arrives */
+	http_response_t response;
+	/* Read/write byte counters (of request being sent) */
+	ssize_t bytes_sent;
+	/* Server closes connection after response */
+	int8_t is_close_requested;
+
+	/* Used to measure time in single state */
+	scheduler_timer_t state_timer;
+	/* Used to delay retry after closing the socket */
+	scheduler_timer_t retry_timer;
+	/* Used to close connection, which was idle for too long */
+	scheduler_timer_t keepalive_timer;
+};
+typedef struct _request_conn request_conn_t;
 
 
 /* LOCALS *********************************************************************/
 
-/* Current socket state */
-static int8_t socket_state;
-
-/* Socket file descriptor */
-static int32_t sockfd;
+/* Upload connections, and the one, which state machine is running */
+static request_conn_t request_conns[REQUEST_TASK_CONNECTIONS];
+static request_conn_t *conn = &request_conns[0];
 /* Struct with addres and port */
 static struct sockaddr_in serv_addr;
 
 /* Hostname string  */
 static char host[HOST_ADDR_BUF_SIZE];
 
-/* Request including headers, body ... */
-static char request_buf[REQUEST_BUF_SIZE];
-/* Response including headers, body ... */
-static char response_buf[RESPONSE_BUF_SIZE];
+/* Requests, which are not acknowledged, in order of their data rows (shared
+ * by connections). Rows are released from the oldest slot on, once it's
+ * acknowledged. */
+static request_slot_t request_slots[_NUM_OF_SLOTS];
+/* Oldest slot and number of slots in use */
+static uint32_t slot_head = 0;
+static uint32_t num_of_slots = 0;
+/* Last data row in newest slot (next slot continues after it), NULL if
+ * fifo overflow dropped it */
+static char *request_data_last;
+#if (REQUEST_TASK_DISK_UPLOAD == 0)
+/* Data rows dropped on fifo overflow, which are taken out of slots already */
+static uint32_t request_data_drops = 0;
+#endif
+/* Request body length (without '\0') */
+static uint32_t request_data_len;
+/* Request body written from binary record */
+static char request_data_json[REQUEST_DATA_BUF_SIZE];
+/* Number of data rows in request (released together on acknowledge) */
+static uint32_t request_data_count;
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+/* Request body with batch of data rows (JSON array) */
+static char request_batch[REQUEST_TASK_BATCH_BYTES];
+/* Data rows, which are sent one by one (after batch was rejected) */
+static uint32_t num_of_single = 0;
+#endif
 
-/* Read/write byte counters */
-static ssize_t bytes_sent;
-/* Read bytes amount, or 'response_buf' write ptr */
-static ssize_t bytes_read;
-/* Previous amount of bytes, that were read */
-static ssize_t prev_read_result;
+/* Connections made, requests sent, time spent connecting */
+static uint32_t num_of_connects = 0;
+static uint32_t num_of_requests = 0;
+static uint64_t connect_time_us = 0;
 
 
 /* GLOBALS ********************************************************************/
 
-/* Bears only the JSON data (request body) */
-char request_data_buf[REQUEST_FIFO_STR_SIZE];
+/* Bears only the JSON data (request body), points to oldest fifo slot, to
+ * 'request_data_json' for binary records, or to batch of data rows */
+char *request_data_buf;
 
 /* Fifo for data storage */
 str_fifo_t request_fifo = {
@@ -59,11 +162,12 @@ str_fifo_t request_fifo = {
 /* Timestamp - gets written externally. Static to avoid linkage conflicts. */
 static char timestamp[TIMESTAMP_RAW_STRING_SIZE];
 
-/* Used to measure time in single state */
-static long int state_change_time = 0;
-
-/* Used to measure time in single state */
-static long int retry_time = 0;
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+/* Used to check log, after storage has written new measurements */
+static scheduler_timer_t disk_timer;
+/* Log may have new lines (checked on start) */
+static int8_t is_disk_pending = 1;
+#endif
 
 
 /* PROTOTYPES *****************************************************************/
@@ -78,9 +182,22 @@ int8_t _write_socket(void);
 int8_t _read_socket(void);
 int8_t _evaluate_socket(void);
 int8_t _close_socket(void);
-int8_t _clear_request_buffers(void);
+int8_t _add_request_slot(void);
+int8_t _run_connection(void);
 
+int8_t _has_pending_data (void);
 int8_t _check_fifo_for_new_data (void);
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+void _drain_notifications (void);
+#endif
+#if (REQUEST_TASK_DISK_UPLOAD == 0)
+int8_t _forget_dropped_data (void);
+#endif
+char *_peek_data (void);
+char *_peek_next_data (char *data, uint32_t max_len);
+int8_t _release_data (void);
+char *_get_data_json (char *data, uint32_t *len);
+int8_t _add_batch_data (char *data);
 
 void _report_socket_errno(void);
 
@@ -88,10 +205,29 @@ int8_t _has_max_state_timer_ended(void);
 int8_t _has_retry_timer_ended(void);
 void _state_timer_reset_all(void);
 void _state_timer_reset_max(void);
+void _state_timer_stop_max(void);
 void _timer_reset_retry(void);
 void _report_max_state_timer_ended (void);
 
-void _reset_static_vars(void);
+int32_t _find_queued_slot(void);
+int32_t _build_slot(void);
+int32_t _take_slot(void);
+int8_t _release_slots(void);
+void _reset_slots(void);
+void _reset_pipeline(void);
+#if (REQUEST_TASK_CONNECTIONS > 1)
+uint32_t _count_queued_slots(void);
+int8_t _update_pool(void);
+void _leave_connection(void);
+#endif
+
+int8_t _disconnect_socket(void);
+int8_t _is_connection_lost(void);
+int8_t _lose_socket(void);
+static void _report_connect(void);
+uint64_t _get_time_us(void);
+
+void _update_socket_events(void);
 
 
 /* FUNCTIONS ******************************************************************/
@@ -104,6 +240,10 @@ int8_t request_task_init_fifo (str_fifo_t **_fifo) {
     /* Set up memory for fifo struct and return success/error */
     int8_t fifo_status = setup_str_fifo(
         &request_fifo, REQUEST_FIFO_BUF_SIZE, REQUEST_FIFO_STR_SIZE);
+    if (fifo_status == 0) {
+        fifo_status = str_fifo_set_overflow(&request_fifo,
+            REQUEST_FIFO_OVERFLOW, CURDIR REQUEST_FIFO_SPILL_FILENAME);
+    }
 
 #if(DEBUG_REQUEST==1)
 	printf("*\tREQUEST FIFO INITIATED\n");
@@ -113,6 +253,24 @@ int8_t request_task_init_fifo (str_fifo_t **_fifo) {
 }
 
 
+/*  Open measurements log at acknowledged position.
+ */
+int8_t request_task_init_log (const char *path) {
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+    char log_path[SEGMENT_PATH_SIZE];
+
+    if (snprintf(log_path, sizeof(log_path), "%s%s", CURDIR, path) >=
+            (int)sizeof(log_path)) {
+        return -1;
+    }
+    return segment_reader_init(log_path,
+        CURDIR REQUEST_TASK_CURSOR_FILENAME);
+#else
+    return 0;
+#endif
+}
+
+
 /*  Init socket using host address and port.s
  */
 int8_t request_task_init_socket(char *_host, int16_t portno) {
@@ -134,7 +292,7 @@ int8_t request_task_init_socket(char *_host, int16_t portno) {
     server = gethostbyname(host);
 
 	if (server == NULL) {
-		socket_state = SOCKET_STATE_UNKNOWN_HOST;
+		conn->socket_state = SOCKET_STATE_UNKNOWN_HOST;
     	/* Refresh local timestamp variable and report error */
 		get_timestamp_raw(timestamp);
 		printf("SOCKET FATAL: UNKNOWN HOST | %s\n", timestamp);
@@ -147,10 +305,13 @@ int8_t request_task_init_socket(char *_host, int16_t portno) {
     serv_addr.sin_port = htons(portno);
     memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
 
-    _state_timer_reset_max();
-
-    /* Set socket state variable */
-	socket_state = SOCKET_STATE_IDLE;
+    /* Set socket state variables, first connection is always used */
+	for (uint32_t i = 0; i < REQUEST_TASK_CONNECTIONS; i++) {
+		request_conns[i].socket_state = SOCKET_STATE_IDLE;
+		request_conns[i].sockfd = -1;
+		http_response_init(&request_conns[i].response);
+	}
+	request_conns[0].is_active = 1;
 
 #if(DEBUG_REQUEST==1)
 	printf("*\tSOCKET INITIATED\n");
@@ -162,16 +323,87 @@ int8_t request_task_init_socket(char *_host, int16_t portno) {
 }
 
 
-/*  Check for data, create and enable socket, write, read and evaluate.
+/*  Create state timers (call after 'scheduler_init').
+ */
+int8_t request_task_init_events (void) {
+	int8_t error_control = 0;
+	for (uint32_t i = 0; i < REQUEST_TASK_CONNECTIONS; i++) {
+		conn = &request_conns[i];
+		error_control += scheduler_timer_init(&conn->state_timer);
+		error_control += scheduler_timer_init(&conn->retry_timer);
+		error_control += scheduler_timer_init(&conn->keepalive_timer);
+		error_control += scheduler_timer_stop(&conn->keepalive_timer);
+		/* Idle is not time bound */
+		error_control += scheduler_timer_stop(&conn->state_timer);
+	}
+	conn = &request_conns[0];
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	error_control += scheduler_timer_init(&disk_timer);
+	error_control += scheduler_timer_stop(&disk_timer);
+#endif
+	return error_control;
+}
+
+
+/*  Run state machine of every used connection, adjust number of them.
  */
 int8_t request_task_run(void) {
+	int8_t status = TASK_STATUS_IDLE;
+	int8_t conn_status;
+	int8_t is_dropped = 0;
+
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	/* Keep up with storage, also while connections are busy */
+	_drain_notifications();
+#else
+	/* Fifo may have overwritten rows of requests, since last run */
+	is_dropped = _forget_dropped_data();
+#endif
 
+	for (uint32_t i = 0; i < REQUEST_TASK_CONNECTIONS; i++) {
+		if (request_conns[i].is_active == 0) {
+			continue;
+		}
+		conn = &request_conns[i];
+		conn_status = _run_connection();
+		if (conn_status == TASK_STATUS_ERROR) {
+			return TASK_STATUS_ERROR;
+		}
+		if (conn_status == TASK_STATUS_BUSY) {
+			status = TASK_STATUS_BUSY;
+		}
+	}
+
+#if (REQUEST_TASK_CONNECTIONS > 1)
+	/* New connection starts on next run. Pool doesn't grow, while overflow
+	 * takes rows of requests (slots were just cut back), until a run goes
+	 * without drops. */
+	if (is_dropped == 0 && _update_pool() == 1) {
+		status = TASK_STATUS_BUSY;
+	}
+#else
+	/* Single connection, drops only change slots */
+	(void)is_dropped;
+#endif
+	return status;
+}
+
+
+/*  Check for data, create and enable socket, write, read and evaluate
+ *  (current connection).
+ *
+ *  return:
+ *  	TASK_STATUS_...
+ */
+int8_t _run_connection(void) {
+
+	/* Retry timer wakes up the scheduler once it expires */
 	if (_has_retry_timer_ended() != 0) {
-		return TASK_STATUS_BUSY;
+		return TASK_STATUS_IDLE;
 	}
 
 #if(DEBUG_REQUEST==1)
-	printf("REQUEST TASK, state: %d\n", socket_state);
+	printf("REQUEST TASK, state: %d\n", conn->socket_state);
 #endif
 
 
@@ -184,6 +416,15 @@ int8_t request_task_run(void) {
     /* Call socket state function and save status output */
     int8_t status = state_fun_ptr();
 
+    /* Wait for events matching the new state */
+    _update_socket_events();
+
+    /* Connection was left (pool shrinks), it must not wake up anymore */
+    if (conn->is_active == 0) {
+    	_state_timer_stop_max();
+    	return (status == SOCKET_ERROR) ? TASK_STATUS_ERROR : TASK_STATUS_BUSY;
+    }
+
     switch (status) {
     case SOCKET_ERROR:
     	return TASK_STATUS_ERROR;
@@ -196,17 +437,27 @@ int8_t request_task_run(void) {
     	/* Close socket if timer has elepsed */
 		if (_has_max_state_timer_ended() == 0) {
 			_report_max_state_timer_ended();
-			socket_state = SOCKET_STATE_CLOSE;
+			conn->socket_state = SOCKET_STATE_CLOSE;
 			return TASK_STATUS_BUSY;
 		}
     	return TASK_STATUS_BUSY;
     	break;
+    case SOCKET_WAIT:
+    	/* Close socket if timer has elepsed */
+		if (_has_max_state_timer_ended() == 0) {
+			_report_max_state_timer_ended();
+			conn->socket_state = SOCKET_STATE_CLOSE;
+			return TASK_STATUS_BUSY;
+		}
+		/* Socket event or state timer wakes up the scheduler */
+    	return TASK_STATUS_IDLE;
+    	break;
     case SOCKET_IDLE:
-    	_state_timer_reset_max();		/* Idle is not time bound */
+    	_state_timer_stop_max();		/* Idle is not time bound */
     	return TASK_STATUS_IDLE;
     	break;
     default:
-    	printf("Unknown socket status\n");
+    	LOG_ERROR("Unknown socket status\n");
     	return TASK_STATUS_ERROR;
     	break;
     }
@@ -224,10 +475,10 @@ int8_t (*_get_socket_state_funciton(void))(void) {
     int8_t (*state_fun_ptr) (void);
 
 #if(DEBUG_REQUEST==1)
-    printf("Socket state: %d\n", socket_state);
+    printf("Socket state: %d\n", conn->socket_state);
 #endif
 
-    switch (socket_state) {
+    switch (conn->socket_state) {
     case SOCKET_STATE_IDLE:
     	state_fun_ptr = &_idle_socket;
         break;
@@ -261,10 +512,13 @@ int8_t (*_get_socket_state_funciton(void))(void) {
 }
 
 
-/* 	Check, if fifo contains new request data.
+/* 	Check for requests to send (new data rows, or requests of a lost
+ * 	connection). Close kept open connection, when server closed it, or it
+ * 	was idle for too long. Additional connection is left, once caught up.
  *
  *  Next state:
  *  	SOCKET_STATE_CREATE
+ *  	SOCKET_STATE_ADD_DATA - connection is kept open
  *
  *  return:
  *  	-1: error
@@ -272,13 +526,36 @@ int8_t (*_get_socket_state_funciton(void))(void) {
  *		 2: idle
  */
 int8_t _idle_socket(void) {
-	if (_check_fifo_for_new_data() == 0) {
+	if (conn->is_connected == 1) {
+		if (_is_connection_lost() == 0) {
+			LOG_INFO("Server closed idle connection\n");
+			_disconnect_socket();
+		} else if (scheduler_timer_has_ended(&conn->keepalive_timer) == 0) {
+			_disconnect_socket();
+		}
+	}
+	int8_t pending = _has_pending_data();
+
+	if (pending == -1) {
+		return -1;
+	}
+	if (pending == 0) {
 #if(DEBUG_REQUEST==1)
 		printf("*\tSOCKET FIFO DATA DETECTED\n");
 #endif
-        socket_state = SOCKET_STATE_CREATE;
+		if (conn->is_connected == 1) {
+			scheduler_timer_stop(&conn->keepalive_timer);
+			conn->socket_state = SOCKET_STATE_ADD_DATA;
+		} else {
+			conn->socket_state = SOCKET_STATE_CREATE;
+		}
         return 0;
 	}
+#if (REQUEST_TASK_CONNECTIONS > 1)
+	if (conn != &request_conns[0]) {
+		_leave_connection();
+	}
+#endif
 	return 2;
 }
 
@@ -299,10 +576,11 @@ int8_t _create_socket(void) {
      *  SOCK_STREAM - Provides sequenced, reliable, two-way streams
      *  0 - default protocol selector
      */
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    conn->connect_start_us = _get_time_us();
+    conn->sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
 #if(DEBUG_REQUEST==1)
-	printf("socket(): %d\n", sockfd);
+	printf("socket(): %d\n", conn->sockfd);
     printf("errno: %d | %s\n", errno, strerror(errno));
 #endif
 
@@ -310,10 +588,10 @@ int8_t _create_socket(void) {
      * Normal: EINPROGRESS is thrown in non blocking operations
      */
     //if (sockfd == -1 && errno != EINPROGRESS) {
-    if (sockfd == -1) {
+    if (conn->sockfd == -1) {
     	if (errno != EINPROGRESS) {
 			_report_socket_errno();
-			socket_state = SOCKET_STATE_CLOSE;
+			conn->socket_state = SOCKET_STATE_CLOSE;
     	}
         return 0;
     }
@@ -321,17 +599,23 @@ int8_t _create_socket(void) {
     /* Catch refused error, because socket() returns positive on refused. */
     /*if (errno == ECONNREFUSED) {
 		_report_socket_errno();
-        socket_state = SOCKET_STATE_CLOSE;
+        conn->socket_state = SOCKET_STATE_CLOSE;
         return 0;
     }*/
 
     /* Set to non blocking */
-    int flags = fcntl(sockfd, F_GETFL, 0);
-    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    int flags = fcntl(conn->sockfd, F_GETFL, 0);
+    fcntl(conn->sockfd, F_SETFL, flags | O_NONBLOCK);
     //fcntl(sockfd, F_SETFL, flags);
 
+    /* Wake up on connect (socket becomes writable) */
+    if (scheduler_add_fd(conn->sockfd, EPOLLOUT) == 0) {
+    	conn->is_socket_registered = 1;
+    	conn->socket_events = EPOLLOUT;
+    }
+
     /* Set socket state variable */
-    socket_state = SOCKET_STATE_CONNECT;
+    conn->socket_state = SOCKET_STATE_CONNECT;
 
 #if(DEBUG_REQUEST==1)
 	printf("*\tSOCKET CREATED\n");
@@ -349,12 +633,13 @@ int8_t _create_socket(void) {
  *  returns:
  *  	-1: error connecting
  *		 0: successfully connected
+ *		 3: connection in progress
  */
 int8_t _connect_socket(void){
 
     /* Connect the socket to the previously defined address */
 	int connected =
-		connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+		connect(conn->sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
 
 #if(DEBUG_REQUEST==1)
 	printf("connect(): %d\n", connected);
@@ -366,13 +651,17 @@ int8_t _connect_socket(void){
     if (connected == -1) {
     	if (errno != EINPROGRESS && errno != EALREADY) {
 			_report_socket_errno();
-			socket_state = SOCKET_STATE_CLOSE;
+			conn->socket_state = SOCKET_STATE_CLOSE;
+			return 0;
     	}
-        return 0;
+        return SOCKET_WAIT;
     }
 
     /* Set socket state variable */
-	socket_state = SOCKET_STATE_ADD_DATA;
+	conn->socket_state = SOCKET_STATE_ADD_DATA;
+	conn->is_connected = 1;
+	conn->is_reused = 0;
+	_report_connect();
 
 #if(DEBUG_REQUEST==1)
 	printf("*\tSOCKET CONNECTED\n");
@@ -382,62 +671,139 @@ int8_t _connect_socket(void){
 }
 
 
-/*	Take data from fifo and copy to request buffer.
+/*	Take requests, until window is full (or there are none): requests of a
+ *	lost connection first, then new ones built of data rows after the ones
+ *	in flight.
  *
  *  Next state:
- *  	SOCKET_STATE_WRITE
+ *  	SOCKET_STATE_WRITE - requests to send
+ *  	SOCKET_STATE_READ - all sent, waiting for responses
+ *  	SOCKET_STATE_IDLE - nothing in flight, fifo empty
  *
  *  returns:
  *  	-1: error
  *		 0: success
  */
 int8_t _add_request_data(void) {
-	/* Reset read/write byte counters */
-	_reset_static_vars();
-	/* Clear all buffers */
-    _clear_request_buffers();
-    /* Get row of data from fifo buffer */
-    str_fifo_read(&request_fifo, request_data_buf);
+	int32_t idx;
+
+	while (conn->num_of_pipelined < REQUEST_TASK_WINDOW) {
+		idx = _take_slot();
+		if (idx == -2) {
+			return -1;
+		}
+		if (idx == -1) {
+			break;
+		}
+		conn->pipeline[(conn->pipeline_head + conn->num_of_pipelined) %
+			REQUEST_TASK_WINDOW] = idx;
+		conn->num_of_pipelined++;
+	}
+
+#if (REQUEST_TASK_CONNECTIONS > 1)
+	/* Requests waiting beyond the window tell, that another connection
+	 * would help */
+	while (conn->num_of_pipelined == REQUEST_TASK_WINDOW &&
+			_count_queued_slots() < REQUEST_TASK_POOL_BACKLOG) {
+		idx = _build_slot();
+		if (idx == -2) {
+			return -1;
+		}
+		if (idx == -1) {
+			break;
+		}
+	}
+#endif
+
+	if (conn->num_of_sent < conn->num_of_pipelined) {
+		conn->socket_state = SOCKET_STATE_WRITE;
+	} else if (conn->num_of_pipelined > 0) {
+		conn->socket_state = SOCKET_STATE_READ;
+	} else {
+		/* Keep connection for next data */
+		if (SOCKET_KEEPALIVE_TIME_MS == 0) {
+			_disconnect_socket();
+		} else {
+			scheduler_timer_start(&conn->keepalive_timer, SOCKET_KEEPALIVE_TIME_MS);
+		}
+		conn->socket_state = SOCKET_STATE_IDLE;
+	}
+	return 0;
+}
+
+
+/*	Build request of peeked data row (and following ones in batch mode) in
+ *	next free slot (queued, no connection took it yet).
+ *
+ *  returns:
+ *  	-1: error
+ *		 0: success
+ */
+int8_t _add_request_slot(void) {
+	request_slot_t *slot =
+		&request_slots[(slot_head + num_of_slots) % _NUM_OF_SLOTS];
+	request_data_last = request_data_buf;
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+    /* Following rows go to the same request */
+    if (_add_batch_data(request_data_buf) != 0) {
+        return -1;
+    }
+#else
+    /* Binary records are sent as JSON */
+    request_data_buf = _get_data_json(request_data_buf, &request_data_len);
+    if (request_data_buf == NULL) {
+        return -1;
+    }
+    request_data_count = 1;
+#endif
     /* Add request data to request buffer */
-    sprintf(request_buf, REQUEST_FMT,
-		host, (long unsigned int)strlen(request_data_buf), request_data_buf);
-    /* Set socket state variable */
-    socket_state = SOCKET_STATE_WRITE;
+    slot->len = snprintf(slot->buf, REQUEST_BUF_SIZE, REQUEST_FMT,
+		host, (long unsigned int)request_data_len, (int)request_data_len,
+		request_data_buf);
+    if (slot->len < 0 || slot->len > REQUEST_BUF_SIZE-1) {
+        LOG_ERROR("Error: request too long\n");
+        return -1;
+    }
+    slot->data_count = request_data_count;
+    slot->state = _SLOT_QUEUED;
+    num_of_slots++;
+    num_of_requests++;
 
 #if(DEBUG_REQUEST==1)
 	printf("\tADDED REQUEST DATA (%lu):\n%s\n",
-		(long unsigned int)strlen(request_buf), request_buf);
+		(long unsigned int)slot->len, slot->buf);
 #endif
 
     return 0;
 }
 
 
-/*	Take request buffer and write it to the socket.
+/*	Write requests, which are not sent yet, to the socket.
  *
  *  Next state:
  *  	SOCKET_STATE_READ
  *
  *  returns:
  *  	-1: error
- *		 0: finished
+ *		 0: finished, earlier responses are buffered already
  *		 1: still writing
+ *		 3: socket busy, or finished (waiting for response)
  */
 int8_t _write_socket(void) {
-
-    /* Only write the bytes containing data (string) */
-    ssize_t request_len = strlen(request_buf);
+	request_slot_t *slot = &request_slots[conn->pipeline[
+		(conn->pipeline_head + conn->num_of_sent) % REQUEST_TASK_WINDOW]];
 
     /* Write and get amount of bytes, that were written
      * 	-1: can't write
      * 	 0: nothing to write
      * 	>0: number of bytes written
+     * Connection closed by server is reported as error (no SIGPIPE).
      */
-    size_t result =
-		write(sockfd, request_buf + bytes_sent, request_len - bytes_sent);
+    ssize_t result = send(conn->sockfd, slot->buf + conn->bytes_sent,
+		slot->len - conn->bytes_sent, MSG_NOSIGNAL);
 
 #if(DEBUG_REQUEST==1)
-	printf("write(): %ld, %ld, %ld\n", (long int)result, (long int)bytes_sent, (long int)request_len);
+	printf("write(): %ld, %ld, %ld\n", (long int)result, (long int)conn->bytes_sent, (long int)slot->len);
     printf("errno: %d | %s\n", errno, strerror(errno));
 #endif
 
@@ -445,191 +811,204 @@ int8_t _write_socket(void) {
     if (result == -1) {
     	/* Normal: EINPROGRESS, EAGAIN is thrown in non blocking operations */
     	if (errno != EINPROGRESS && errno != EAGAIN) {
-			_report_socket_errno();
-			socket_state = SOCKET_STATE_CLOSE;
+			return _lose_socket();
     	}
-		return 0;
+		return SOCKET_WAIT;
 	}
 
-    /* Increment bytes_read ('request_buf' idx pointer) */
-	bytes_sent += result;
+    /* Increment bytes_sent ('slot->buf' idx pointer) */
+	conn->bytes_sent += result;
 
     /* Finished writing (writen everything, nonthing else left) */
-    if (request_len == bytes_sent || result == 0) {
+    if (slot->len == conn->bytes_sent || result == 0) {
 #if(DEBUG_REQUEST==1)
     	printf("*\tREQUEST WRITTEN (%lu): \n%s\n",
-			(long unsigned int)request_len, request_buf);
+			(long unsigned int)slot->len, slot->buf);
 #endif
+		conn->bytes_sent = 0;
+		conn->num_of_sent++;
+		/* Next one without waiting for response */
+		if (conn->num_of_sent < conn->num_of_pipelined) {
+			return 1;
+		}
         /* Set socket state variable */
-        socket_state = SOCKET_STATE_READ;
-
-        return 0;
+        conn->socket_state = SOCKET_STATE_READ;
+        if (conn->read_offset < conn->read_len) {
+        	return 0;
+        }
+        /* Response can't be there yet, read once socket is readable */
+        _state_timer_reset_max();
+        return SOCKET_WAIT;
     }
 
     return 1;
 }
 
 
-/*	Read from socket and write to response buffer.
- * 	Wait for a full response.
+/*	Read from socket and parse oldest response, as it arrives. It's complete
+ *	with its last byte (Content-Length, last chunk), or when server closes
+ *	connection, if its body isn't delimited otherwise. Following responses
+ *	stay in read buffer.
  *
  *  Next state:
  *  	SOCKET_STATE_EVAL_RESPONSE
+ *  	SOCKET_STATE_CLOSE - malformed response
  *
  * 	return:
  *  	-1: error
  *		 0: finished
- *		 1: still reading
+ *		 3: waiting for (more) data
  */
 int8_t _read_socket(void) {
-
-    /* Read and get amount of bytes, that were read
-     * 	-1: nothing new
-     * 	 0: can't access read data
-     * 	>0: number of bytes read
-     */
-    ssize_t result =
-    		read(sockfd, response_buf + bytes_read, RESPONSE_BUF_SIZE - bytes_read);
+	ssize_t result;
+	int8_t status;
+
+	/* Parse following responses, which arrived already, first */
+	if (conn->read_offset == conn->read_len) {
+	    /* Read and get amount of bytes, that were read
+	     * 	-1: nothing new
+	     * 	 0: connection closed by server
+	     * 	>0: number of bytes read
+	     */
+	    result = read(conn->sockfd, conn->read_buf, RESPONSE_BUF_SIZE);
 
 #if(DEBUG_REQUEST==1)
-	printf("read(): %ld, %ld, %d\n", (long int)result, (long int)bytes_read, RESPONSE_BUF_SIZE);
-	printf("read(): \n%s\n", response_buf);
-    printf("errno: %d | %s\n", errno, strerror(errno));
-//	printf("%d | %d | %d | %d | %d | %d | %d | %d \n",
-//		EAGAIN, EWOULDBLOCK, EBADF, EFAULT, EINTR, EINVAL, EIO, EISDIR);
+		printf("read(): %ld, %d\n", (long int)result, RESPONSE_BUF_SIZE);
+	    printf("errno: %d | %s\n", errno, strerror(errno));
 #endif
 
-    /* Check for socket error */
-    //if (errno == ENOTCONN || errno == EBADF)
-    //if (result == 0) {
-    if (result == 0 && errno != EINPROGRESS) {
-		_report_socket_errno();
-        socket_state = SOCKET_STATE_CLOSE;
-        return 0;
-    }
-
-    /* If read successfull, increment bytes_read ('response_buf' idx pointer) */
-    if (result > 0) {
-        bytes_read += result;
-    }
-
-    /* Reached end of buffer */
-    if (bytes_read == RESPONSE_BUF_SIZE-1) {
-    	/* Refresh local timestamp variable and report error */
-		get_timestamp_raw(timestamp);
-		printf("SOCKET FATAL: RESPONSE BUFFER TOO LONG | %s\n", timestamp);
-        //socket_state = SOCKET_STATE_CLOSE;
-	    return -1;
+	    if (result == -1) {
+	    	/* Check for socket error */
+	    	if (errno != EAGAIN && errno != EINTR) {
+				return _lose_socket();
+	    	}
+	    	return SOCKET_WAIT;
+	    }
+	    /* Closed by server: ends response, which isn't delimited otherwise */
+	    if (result == 0) {
+	    	if (http_response_close(&conn->response) != 0) {
+				return _lose_socket();
+	    	}
+	        conn->socket_state = SOCKET_STATE_EVAL_RESPONSE;
+	        return 0;
+	    }
+	    conn->read_len = result;
+	    conn->read_offset = 0;
 	}
 
-#if(DEBUG_REQUEST==1)
-    printf("Previous, current, total read(): %ld, %ld, %ld\n",
-		(long int)prev_read_result, (long int)result, (long int)bytes_read);
-#endif
+	status = http_response_feed(&conn->response, conn->read_buf,
+		conn->read_len, &conn->read_offset);
+	if (status == -1) {
+		LOG_WARN("\nReceived malformed response, closing connection.\n\n");
+		conn->socket_state = SOCKET_STATE_CLOSE;
+		return 0;
+	}
+	/* Whole buffer was taken, wait for more data */
+	if (status == 1) {
+		return SOCKET_WAIT;
+	}
 
-	/* Check for end of response */
-    if (prev_read_result > 0) {		/* Previously read something */
-    	if (result == -1) {		/* Nothing new was read */
 #if(DEBUG_REQUEST==1)
-			printf("*\tRESPONSE RECEIVED (%ld):\n%s\n",
-				(long int)bytes_read, response_buf);
+	printf("*\tRESPONSE RECEIVED (%lu): %u\n",
+		(long unsigned int)conn->response.len, conn->response.status);
 #endif
-            socket_state = SOCKET_STATE_EVAL_RESPONSE;
-
-    		return 0;
-    	}
-    }
-
-    /* Set for next function call */
-	prev_read_result = result;
-
-    return 1;
+    conn->socket_state = SOCKET_STATE_EVAL_RESPONSE;
+    return 0;
 }
 
 
-/*	Read response buffer and compare with sent data.
- *  On successful evaluation, increment fifo read pointer.
+/*	Evaluate status code of oldest response, which answers oldest request
+ *	in flight: 2xx acknowledges it, 4xx rejects it (not sent again), other
+ *	codes (5xx, timeouts) retry it. On acknowledge (or rejection), increment
+ *	fifo read pointer (once requests before it, sent on other connections,
+ *	are acknowledged too).
  *
  *  Next state:
- *  	SOCKET_STATE_ADD_DATA - fifo contains more data
- *  	SOCKET_STATE_CLOSE - fifo empty
+ *  	SOCKET_STATE_ADD_DATA - connection is kept open
+ *  	SOCKET_STATE_READ - interim response, final one follows
+ *  	SOCKET_STATE_IDLE - server closed connection
+ *  	SOCKET_STATE_CLOSE - retry
  *
  * 	return:
  *  	-1: error
  *		 0: data OK
- *		 1: still evaluating
  */
 int8_t _evaluate_socket(void) {
-
-    /* Pointer to 'request_data_buf' substring inside of 'response_buf' */
-    char *request_ok = strstr(response_buf, request_data_buf);
-    char *request_200 = strstr(response_buf, "200 OK");
-    char *request_400 = strstr(response_buf, "400 Bad Request");
+	request_slot_t *slot =
+		&request_slots[conn->pipeline[conn->pipeline_head]];
+	uint16_t status = conn->response.status;
 
 #if(DEBUG_REQUEST==1)
-		printf("*\tEVALUATING\n%s\n", response_buf);
-		printf("*\tWITH\n%s\n", request_data_buf);
+		printf("*\tEVALUATING %u\n%s\n", status, conn->response.body);
 #endif
 
+	/* Interim response (100 Continue) */
+	if (status < 200) {
+		http_response_init(&conn->response);
+		conn->socket_state = SOCKET_STATE_READ;
+		return 0;
+	}
+	conn->is_close_requested = conn->response.is_close;
 
-
-	if (request_200 != NULL) {
-		printf( "\nReceived response code 200, continue with next request.\n\n");
+	if (status < 300) {
+		LOG_INFO("\nReceived response code %u, continue with next request.\n\n",
+			status);
+		slot->state = _SLOT_ACKED;
 	} else {
-    	/* Check if JSON syntax s correct.
-		 * The first request after starting the app may contain missing chars.
-		 * The missing chars are usually in the region 40-80 (hash-error) */
-		if (request_400 != NULL) {
-			printf( "\nReceived response code 400, "
-					"skip and continue with next request.\n\n");
+		/* Request timeout and rate limit pass, client errors don't */
+		if (status >= 400 && status < 500 && status != 408 && status != 429) {
+	    	/* Check if JSON syntax s correct.
+			 * The first request after starting the app may contain missing
+			 * chars. The missing chars are usually in the region 40-80
+			 * (hash-error) */
+			LOG_WARN("\nReceived response code %u, "
+					"skip and continue with next request.\n\n", status);
+			slot->state = _SLOT_ACKED;
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+			/* Find bad data row, by resending batch one by one */
+			if (slot->data_count > 1) {
+				slot->state = _SLOT_REJECTED;
+			}
+#endif
 		} else {
-			printf("\nReceived non-200, non-400 response code - retry write.\n\n");
+			LOG_WARN("\nReceived response code %u - retry write.\n\n", status);
 		}
-		printf(
+		/* Whole request and start of response only on debug level (cut to
+		 * log record size) */
+		LOG_DEBUG(
 			"\tOriginal request:\n%s\n"
 			"\tResponse:\n%s\n",
-			request_buf, response_buf);
+			slot->buf, conn->response.body);
     }
 
-    /* Check, if match in string comparison exists */
-	if (request_ok != NULL){
-#if(DEBUG_REQUEST==1)
-		printf("*\tRESPONSE OK\n");
-#endif
-	}
-
-    /* Check for response */
-	if (request_ok != NULL || request_400 != NULL){
-		/* Increment read pointer, means next data row can be sent */
-		if (fifo_increment_read_idx(&request_fifo) != 0) {
-			/* Is this error possible (?) */
-	    	/* Refresh local timestamp variable and report error */
-			get_timestamp_raw(timestamp);
-			printf("SOCKET FATAL: INCREMENT EMPTY FIFO | %s\n", timestamp);
-			//return 0;
-			return -1;
-		}
-		if (_check_fifo_for_new_data() == 0) {
-	        socket_state = SOCKET_STATE_ADD_DATA;
-		} else {
-	        socket_state = SOCKET_STATE_CLOSE;
-		}
-
+	/* Close and try reconnecting */
+	if (slot->state == _SLOT_SENT) {
+	    conn->socket_state = SOCKET_STATE_CLOSE;
 		return 0;
 	}
 
-    //return 1;
-
-	/* If no match was found in response, close and try reconnecting */
-#if(DEBUG_REQUEST==1)
-		printf("SOCKET EVALUATION FAILED\n");
-#endif
-    socket_state = SOCKET_STATE_CLOSE;
+	/* Next request in flight waits for next response */
+	conn->pipeline_head = (conn->pipeline_head + 1) % REQUEST_TASK_WINDOW;
+	conn->num_of_pipelined--;
+	conn->num_of_sent--;
+	http_response_init(&conn->response);
+	conn->is_reused = 1;
+	/* Release fifo slots, means next data rows can be sent */
+	if (_release_slots() != 0) {
+		return -1;
+	}
+	if (conn->is_close_requested == 1) {
+		/* Requests in flight are sent again on new connection */
+		_disconnect_socket();
+	}
+	/* Fill window again (rejected batch may have closed connection) */
+    conn->socket_state = (conn->is_connected == 1) ?
+		SOCKET_STATE_ADD_DATA : SOCKET_STATE_IDLE;
 	return 0;
 }
 
 
-/*	Close the socket and destroy file descriptor.
+/*	Close the socket and destroy file descriptor, after an error.
  *
  *  Next state:
  *  	SOCKET_STATE_IDLE
@@ -637,28 +1016,20 @@ int8_t _evaluate_socket(void) {
  * 	return:
  *  	-1: error
  *		 0: success
- *		 1: retry
  */
 int8_t _close_socket(void) {
 
 	/* Every time when closing, reset retry timer.
-	 *  In normal operation 60 s will pass between incoming packages, so the
-	 * wait amount is negegible. If there is data in the FIFO for syncing,
-	 * close() will only get called at the end of the process.
-	 *  In the case of an error (disconnect), the all states are redirected
-	 * to CLOSE, so the execution will get slowed down, as desired. */
+	 *  In normal operation the connection is kept open between requests,
+	 * so close() only gets called on an error (disconnect), or when a
+	 * response couldn't be evaluated. All states are redirected to CLOSE,
+	 * so the execution will get slowed down, as desired. */
 	_timer_reset_retry();
 
-    if (close(sockfd) != 0) {
+    if (_disconnect_socket() != 0) {
 		_report_socket_errno();
-        /* Common error when trying to close unopened socket */
-		if (errno == EBADF) {
-			socket_state = SOCKET_STATE_IDLE;
-	        return 0;
-		}
-        return 1;
     }
-    socket_state = SOCKET_STATE_IDLE;
+    conn->socket_state = SOCKET_STATE_IDLE;
 #if(DEBUG_REQUEST==1)
 		printf("*\tSOCKET CLOSED\n");
 #endif
@@ -666,6 +1037,189 @@ int8_t _close_socket(void) {
 }
 
 
+/*	Stop waking up on the socket and close it (without retry delay).
+ *
+ * 	return:
+ *  	-1: error closing
+ *		 0: success, or socket was not open
+ */
+int8_t _disconnect_socket(void) {
+	int result = 0;
+
+	if (conn->is_socket_registered == 1) {
+		scheduler_del_fd(conn->sockfd);
+		conn->is_socket_registered = 0;
+		conn->socket_events = 0;
+	}
+	if (conn->sockfd != -1) {
+		result = close(conn->sockfd);
+		conn->sockfd = -1;
+	}
+	conn->is_connected = 0;
+	conn->is_reused = 0;
+	scheduler_timer_stop(&conn->keepalive_timer);
+	_reset_pipeline();
+	return (result == 0) ? 0 : -1;
+}
+
+
+/*	Check if idle connection was closed by server (or reset), without
+ *	taking any data.
+ *
+ * 	return:
+ * 		0: connection lost (or server sent unexpected data)
+ * 		1: connection still open
+ */
+int8_t _is_connection_lost(void) {
+	char c;
+	ssize_t result = recv(conn->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	if (result == -1 && (errno == EAGAIN || errno == EINTR)) {
+		return 1;
+	}
+	return 0;
+}
+
+
+/*	Handle connection, which failed while sending request or reading
+ *	response. Kept open connection may have been closed by server just
+ *	before it was reused, in that case reconnect right away.
+ *
+ *  Next state:
+ *  	SOCKET_STATE_CREATE - reused connection, no response yet
+ *  	SOCKET_STATE_CLOSE - otherwise
+ *
+ * 	return:
+ *		 0: always (state changed)
+ */
+int8_t _lose_socket(void) {
+	if (conn->is_reused == 1 && conn->response.len == 0) {
+		LOG_INFO("Server closed kept open connection, reconnecting\n");
+		_disconnect_socket();
+		conn->socket_state = SOCKET_STATE_CREATE;
+		return 0;
+	}
+	_report_socket_errno();
+	conn->socket_state = SOCKET_STATE_CLOSE;
+	return 0;
+}
+
+
+/*	Count new connection and report, how much keeping connections open saves.
+ */
+static void _report_connect(void) {
+	num_of_connects++;
+	connect_time_us += _get_time_us() - conn->connect_start_us;
+	/* Average is worked out within arguments, compiled out with message */
+	LOG_INFO("Connected to server: %lu connects for %lu requests, "
+		"%lu us per connect, ~%lu ms saved by keep-alive\n",
+		(long unsigned int)num_of_connects,
+		(long unsigned int)num_of_requests,
+		(long unsigned int)(connect_time_us / num_of_connects),
+		(long unsigned int)(num_of_requests > num_of_connects ?
+			(num_of_requests - num_of_connects) *
+			(connect_time_us / num_of_connects) / 1000 : 0));
+	return;
+}
+
+
+/*	Get monotonic time in us (connect time measurement).
+ */
+uint64_t _get_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*	Check for requests to send: requests of a lost connection, or data rows
+ *	after the ones in flight (a request is built of them right away).
+ *
+ *  return:
+ *  	-1: error
+ *		 0: requests to send
+ *		 1: nothing new
+ */
+int8_t _has_pending_data (void) {
+	int32_t idx;
+
+	if (_find_queued_slot() != -1) {
+		return 0;
+	}
+	if (num_of_slots == 0) {
+		return _check_fifo_for_new_data();
+	}
+	/* Rows in flight are peeked, only following ones can be checked */
+	idx = _build_slot();
+	if (idx == -2) {
+		return -1;
+	}
+	return (idx == -1) ? 1 : 0;
+}
+
+
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+/*	Take storage notifications: measurements come from the log, fifo only
+ *	tells they arrived (it must not fill up, while connections are busy).
+ */
+void _drain_notifications (void) {
+	if (str_fifo_peek(&request_fifo) != NULL) {
+		while (str_fifo_release(&request_fifo) == 0);
+		scheduler_timer_start(&disk_timer, REQUEST_TASK_DISK_POLL_MS);
+		is_disk_pending = 1;
+	}
+	return;
+}
+#endif
+
+
+#if (REQUEST_TASK_DISK_UPLOAD == 0)
+/*	Take data rows, which fifo overflow dropped (DROP_OLDEST overwrite, the
+ *	oldest rows first), out of slots. Requests keep their copy of the rows,
+ *	so they are still sent, only the rows are not released again. If every
+ *	row in slots was dropped, next request starts at the oldest row in fifo.
+ *	Rows of rejected batch, which follow the slots, count the drops too.
+ *
+ *  return:
+ *  	0: no rows of requests were dropped
+ *  	1: rows were taken out of slots
+ */
+int8_t _forget_dropped_data (void) {
+	uint32_t drops = str_fifo_get_reader_drops(&request_fifo, 0) -
+		request_data_drops;
+	uint32_t num_of_rows = 0;
+	uint32_t count;
+	uint32_t i;
+	request_slot_t *slot;
+
+	if (drops == 0) {
+		return 0;
+	}
+	request_data_drops += drops;
+
+	for (i = 0; i < num_of_slots; i++) {
+		num_of_rows +=
+			request_slots[(slot_head + i) % _NUM_OF_SLOTS].data_count;
+	}
+	if (drops >= num_of_rows) {
+		request_data_last = NULL;
+	}
+	for (i = 0; i < num_of_slots && drops > 0; i++) {
+		slot = &request_slots[(slot_head + i) % _NUM_OF_SLOTS];
+		count = (drops < slot->data_count) ? drops : slot->data_count;
+		slot->data_count -= count;
+		drops -= count;
+	}
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+	count = (drops < num_of_single) ? drops : num_of_single;
+	num_of_single -= count;
+#endif
+	return (num_of_rows > 0) ? 1 : 0;
+}
+#endif
+
+
 /*	Check if fifo has any pending data.
  *
  *  return:
@@ -675,32 +1229,438 @@ int8_t _close_socket(void) {
  */
 int8_t _check_fifo_for_new_data (void) {
 
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	if (scheduler_timer_has_ended(&disk_timer) == 0) {
+		scheduler_timer_stop(&disk_timer);
+		is_disk_pending = 1;
+	}
+	/* Avoid reading the log, while nothing could have been added */
+	if (is_disk_pending == 0) {
+		return 1;
+	}
+#endif
+
 	/* Check for pending data */
-    if (str_fifo_read(&request_fifo, request_data_buf) == 0) {
+    if (_peek_data() != NULL) {
         return 0;
     }
 
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	is_disk_pending = 0;
+#endif
 	return 1;
 }
 
 
-/* Reset read/write byte counters (on error, or timer elapsed)
+/*	Get oldest data row, which is not acknowledged yet (fifo or log), and
+ *	set 'request_data_len'.
+ *
+ *  return:
+ *  	pointer to data row, NULL if there is none
  */
-void _reset_static_vars(void){
-	 bytes_sent = 0;
-	 bytes_read = 0;
-	 prev_read_result = 0;
-	 return;
+char *_peek_data (void) {
+	char *data;
+
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	data = segment_reader_peek(&request_data_len);
+#else
+	data = str_fifo_peek(&request_fifo);
+	if (data != NULL) {
+		/* Length is kept in fifo */
+		request_data_len = str_fifo_get_len(data);
+	}
+#endif
+	return data;
 }
 
 
-/* 	Write zeroes to request, response and request data buffers.
+/*	Get data row after the given one (not acknowledged either), and set
+ *	'request_data_len'.
+ *	 p1: data row returned by '_peek_data' or this function
+ *	 p2: max data row length, longer row is left for next request
+ *
+ *  return:
+ *  	pointer to data row (may not be '\0' terminated), NULL if there is
+ *  	none (or it's too long)
  */
-int8_t _clear_request_buffers(void) {
-    memset(request_buf, 0, REQUEST_BUF_SIZE);
-    memset(request_data_buf, 0, REQUEST_FIFO_STR_SIZE);
-    memset(response_buf, 0, RESPONSE_BUF_SIZE);
-    return 0;
+char *_peek_next_data (char *data, uint32_t max_len) {
+	char *next;
+
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	/* Log reader keeps track of peeked rows itself */
+	(void)data;
+	next = segment_reader_peek_next(max_len, &request_data_len);
+#else
+	next = str_fifo_peek_next(&request_fifo, data);
+	if (next != NULL) {
+		if (str_fifo_get_len(next) > max_len) {
+			return NULL;
+		}
+		request_data_len = str_fifo_get_len(next);
+	}
+#endif
+	return next;
+}
+
+
+/*	Release data rows of the request, after they were acknowledged.
+ *
+ *  return:
+ *  	-1: error (cursor not saved, log reader moved on)
+ *		 0: success
+ *		 1: nothing to release
+ */
+int8_t _release_data (void) {
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+	/* Cursor is saved once */
+	return segment_reader_release(request_data_count);
+#else
+	uint32_t i;
+
+	/* Rows dropped on fifo overflow are not counted anymore, the rest is
+	 * still in fifo */
+	for (i = 0; i < request_data_count; i++) {
+		if (str_fifo_release(&request_fifo) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+#endif
+}
+
+
+/*	Get JSON of data row, binary records are written to 'request_data_json'.
+ *	 p1: data row
+ *	 p2: data row length, replaced with JSON length
+ *
+ *  return:
+ *  	pointer to JSON, NULL on error
+ */
+char *_get_data_json (char *data, uint32_t *len) {
+	int json_len;
+
+	if (anemo_record_is_record(data, *len) != 1) {
+		return data;
+	}
+	json_len = anemo_record_to_json((anemo_record_t *)data,
+		request_data_json, REQUEST_DATA_BUF_SIZE);
+	if (json_len < 0) {
+		LOG_ERROR("Error: request anemo_record_to_json\n");
+		return NULL;
+	}
+	*len = json_len;
+	return request_data_json;
+}
+
+
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+/*	Pack oldest data row and the ones after it into JSON array (request
+ *	body), up to REQUEST_TASK_BATCH_RECORDS rows or REQUEST_TASK_BATCH_BYTES.
+ *	Set request data buffer, length and count.
+ *	 p1: oldest data row, returned by '_peek_data'
+ *
+ *  return:
+ *  	-1: error (data row doesn't fit)
+ *		 0: success
+ */
+int8_t _add_batch_data (char *data) {
+	uint32_t max_count = REQUEST_TASK_BATCH_RECORDS;
+	uint32_t len = 1;
+	uint32_t json_len;
+	char *json;
+
+	/* Rows of rejected batch go one by one */
+	if (num_of_single > 0) {
+		num_of_single--;
+		max_count = 1;
+	}
+	request_batch[0] = '[';
+	request_data_count = 0;
+	while (data != NULL && request_data_count < max_count) {
+		json_len = request_data_len;
+		json = _get_data_json(data, &json_len);
+		if (json == NULL) {
+			return -1;
+		}
+		/* Separator, closing bracket and '\0' */
+		if (len + json_len + 3 > REQUEST_TASK_BATCH_BYTES) {
+			if (request_data_count == 0) {
+				LOG_ERROR("Error: request data row too long\n");
+				return -1;
+			}
+			break;
+		}
+		if (request_data_count > 0) {
+			request_batch[len++] = ',';
+		}
+		memcpy(&request_batch[len], json, json_len);
+		len += json_len;
+		request_data_count++;
+		request_data_last = data;
+		if (request_data_count < max_count) {
+			/* Separator, closing bracket and '\0' */
+			data = _peek_next_data(data, REQUEST_TASK_BATCH_BYTES - len - 3);
+		}
+	}
+	request_batch[len++] = ']';
+	request_batch[len] = '\0';
+
+	request_data_buf = request_batch;
+	request_data_len = len;
+	return 0;
+}
+#endif
+
+
+/*	Find oldest request, which no connection took (lost connection's one).
+ *
+ *  return:
+ *  	slot index, -1 if there is none
+ */
+int32_t _find_queued_slot(void) {
+	uint32_t i;
+	uint32_t idx;
+
+	for (i = 0; i < num_of_slots; i++) {
+		idx = (slot_head + i) % _NUM_OF_SLOTS;
+		if (request_slots[idx].state == _SLOT_QUEUED) {
+			return idx;
+		}
+	}
+	return -1;
+}
+
+
+/*	Build request of data rows after the ones in slots (queued).
+ *
+ *  return:
+ *  	slot index, -1 if there is no data row (or free slot), -2 on error
+ */
+int32_t _build_slot(void) {
+	uint32_t idx = (slot_head + num_of_slots) % _NUM_OF_SLOTS;
+
+	if (num_of_slots == _NUM_OF_SLOTS) {
+		return -1;
+	}
+    /* Get row of data (in place, released on response) */
+	if (num_of_slots == 0 || request_data_last == NULL) {
+		request_data_buf = _peek_data();
+	} else {
+		request_data_buf = _peek_next_data(request_data_last,
+			REQUEST_DATA_MAX_LEN);
+	}
+	if (request_data_buf == NULL) {
+		return -1;
+	}
+	if (_add_request_slot() != 0) {
+		return -2;
+	}
+	return idx;
+}
+
+
+/*	Take oldest queued request, or build new one, for current connection.
+ *
+ *  return:
+ *  	slot index, -1 if there is none, -2 on error
+ */
+int32_t _take_slot(void) {
+	int32_t idx = _find_queued_slot();
+
+	if (idx == -1) {
+		idx = _build_slot();
+	}
+	if (idx >= 0) {
+		request_slots[idx].state = _SLOT_SENT;
+	}
+	return idx;
+}
+
+
+/*	Release data rows of acknowledged requests, from the oldest one on.
+ *	Rejected batch (once it's the oldest one) is sent again row by row.
+ *
+ *  return:
+ *  	-1: error
+ *		 0: success
+ */
+int8_t _release_slots(void) {
+	request_slot_t *slot;
+
+	while (num_of_slots > 0) {
+		slot = &request_slots[slot_head];
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+		if (slot->state == _SLOT_REJECTED) {
+			num_of_single = slot->data_count;
+			_reset_slots();
+			return 0;
+		}
+#endif
+		if (slot->state != _SLOT_ACKED) {
+			return 0;
+		}
+		/* Log cursor errors are reported by log reader */
+		request_data_count = slot->data_count;
+		if (_release_data() == 1) {
+			/* Is this error possible (?) */
+	    	/* Refresh local timestamp variable and report error */
+			get_timestamp_raw(timestamp);
+			LOG_ERROR("SOCKET FATAL: INCREMENT EMPTY FIFO | %s\n", timestamp);
+			return -1;
+		}
+		slot_head = (slot_head + 1) % _NUM_OF_SLOTS;
+		num_of_slots--;
+	}
+	return 0;
+}
+
+
+/*	Forget all requests, they are built again from oldest data row, which
+ *	is not acknowledged. Connections with requests in flight are closed
+ *	(their responses couldn't be matched anymore).
+ */
+void _reset_slots(void) {
+	request_conn_t *current = conn;
+	uint32_t i;
+
+	for (i = 0; i < REQUEST_TASK_CONNECTIONS; i++) {
+		conn = &request_conns[i];
+		if (conn->num_of_pipelined > 0) {
+			_disconnect_socket();
+			conn->socket_state = SOCKET_STATE_IDLE;
+		}
+	}
+	conn = current;
+	slot_head = 0;
+	num_of_slots = 0;
+	return;
+}
+
+
+/*	Forget requests in flight on current connection and its responses (on
+ *	new connection), they are queued again for any connection.
+ */
+void _reset_pipeline(void) {
+	uint32_t i;
+
+	for (i = 0; i < conn->num_of_pipelined; i++) {
+		request_slots[conn->pipeline[(conn->pipeline_head + i) %
+			REQUEST_TASK_WINDOW]].state = _SLOT_QUEUED;
+	}
+	conn->pipeline_head = 0;
+	conn->num_of_pipelined = 0;
+	conn->num_of_sent = 0;
+	conn->bytes_sent = 0;
+	conn->read_len = 0;
+	conn->read_offset = 0;
+	http_response_init(&conn->response);
+	conn->is_close_requested = 0;
+	return;
+}
+
+
+#if (REQUEST_TASK_CONNECTIONS > 1)
+/*	Count requests, which no connection took.
+ */
+uint32_t _count_queued_slots(void) {
+	uint32_t count = 0;
+	uint32_t i;
+
+	for (i = 0; i < num_of_slots; i++) {
+		if (request_slots[(slot_head + i) % _NUM_OF_SLOTS].state ==
+				_SLOT_QUEUED) {
+			count++;
+		}
+	}
+	return count;
+}
+
+
+/*	Start using another connection, when requests are waiting although
+ *	windows of all connections are full.
+ *
+ *  return:
+ *  	0: no change
+ *  	1: connection added
+ */
+int8_t _update_pool(void) {
+	request_conn_t *next = NULL;
+	uint32_t num_of_active = 0;
+	uint32_t i;
+
+	if (_count_queued_slots() < REQUEST_TASK_POOL_BACKLOG) {
+		return 0;
+	}
+	for (i = 0; i < REQUEST_TASK_CONNECTIONS; i++) {
+		if (request_conns[i].is_active == 0) {
+			if (next == NULL) {
+				next = &request_conns[i];
+			}
+			continue;
+		}
+		/* Connecting one (or one waiting to retry) takes its share first */
+		if (request_conns[i].is_connected == 0 ||
+				request_conns[i].num_of_pipelined < REQUEST_TASK_WINDOW) {
+			return 0;
+		}
+		num_of_active++;
+	}
+	if (next == NULL) {
+		return 0;
+	}
+	next->is_active = 1;
+	next->socket_state = SOCKET_STATE_IDLE;
+	LOG_INFO("Upload backlog, using %lu connections\n",
+		(long unsigned int)num_of_active + 1);
+	return 1;
+}
+
+
+/*	Stop using current connection (not the first one), after it caught up.
+ */
+void _leave_connection(void) {
+	_disconnect_socket();
+	scheduler_timer_stop(&conn->retry_timer);
+	conn->socket_state = SOCKET_STATE_IDLE;
+	conn->is_active = 0;
+	return;
+}
+#endif
+
+
+/*	Register socket for events, which the current state is waiting for.
+ */
+void _update_socket_events(void) {
+	uint32_t events;
+
+	if (conn->is_socket_registered == 0) {
+		return;
+	}
+
+	switch (conn->socket_state) {
+	case SOCKET_STATE_CONNECT:
+	case SOCKET_STATE_WRITE:
+		events = EPOLLOUT;
+		break;
+	case SOCKET_STATE_READ:
+		events = EPOLLIN;
+		break;
+	case SOCKET_STATE_IDLE:
+		/* Kept open connection, wake up if server closes it */
+		events = EPOLLIN;
+		break;
+	default:
+		/* Not waiting for the socket (errors are always reported) */
+		events = 0;
+		break;
+	}
+
+	/* Avoid system call, if nothing changed */
+	if (events != conn->socket_events) {
+		scheduler_mod_fd(conn->sockfd, events);
+		conn->socket_events = events;
+	}
+	return;
 }
 
 
@@ -708,11 +1668,11 @@ int8_t _clear_request_buffers(void) {
  */
 void _report_socket_errno(void) {
     get_timestamp_raw(timestamp);
-    printf("Socket internal error: \n"
+    LOG_ERROR("Socket internal error: \n"
 		"\t State: %d \n"
 		"\t Error: (%d) %s \n"
 		"\t Time: %s\n",
-		socket_state, errno, strerror(errno), timestamp);
+		conn->socket_state, errno, strerror(errno), timestamp);
     return;
 }
 
@@ -724,9 +1684,7 @@ void _report_socket_errno(void) {
  * 		1: timer still running
  */
 int8_t _has_max_state_timer_ended(void) {
-	long int timer_now;
-	get_timestamp_epoch(&timer_now);
-	if (timer_now - state_change_time > SOCKET_MAX_STATE_TIME_S) {
+	if (scheduler_timer_has_ended(&conn->state_timer) == 0) {
 //      get_timestamp_raw(timestamp);
 //		printf("MAX ALLOWED SOCKET TIME REACHED: %d | %s\n",
 //				socket_state, timestamp);
@@ -745,14 +1703,7 @@ int8_t _has_max_state_timer_ended(void) {
  * 		1: timer still running
  */
 int8_t _has_retry_timer_ended(void) {
-	long int timer_now;
-	get_timestamp_epoch(&timer_now);
-	if (timer_now - retry_time > SOCKET_RETRY_STATE_TIME_S) {
-		/* Reset timer */
-    	//_timer_reset_retry();
-		return 0;
-	}
-	return 1;
+	return scheduler_timer_has_ended(&conn->retry_timer);
 }
 
 
@@ -768,7 +1719,15 @@ void _state_timer_reset_all(void) {
 /*	Reset max state timer.
  */
 void _state_timer_reset_max(void) {
-	get_timestamp_epoch(&state_change_time);
+	scheduler_timer_start(&conn->state_timer, SOCKET_MAX_STATE_TIME_MS);
+	return;
+}
+
+
+/*	Stop max state timer (idle state is not time bound).
+ */
+void _state_timer_stop_max(void) {
+	scheduler_timer_stop(&conn->state_timer);
 	return;
 }
 
@@ -776,7 +1735,7 @@ void _state_timer_reset_max(void) {
 /*	Reset retry state timer.
  */
 void _timer_reset_retry(void) {
-	get_timestamp_epoch(&retry_time);
+	scheduler_timer_start(&conn->retry_timer, SOCKET_RETRY_STATE_TIME_MS);
 	return;
 }
 
@@ -784,7 +1743,7 @@ void _timer_reset_retry(void) {
 /*	Prints max timer elapsed error.
  */
 void _report_max_state_timer_ended (void) {
-	printf("SOCKET TIME ELAPSED\n");
+	LOG_ERROR("SOCKET TIME ELAPSED\n");
 	_report_socket_errno();
 	return;
 }
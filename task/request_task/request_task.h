@@ -46,33 +46,117 @@
 #define SOCKET_CHANGE_STATE				0
 #define SOCKET_NO_CHANGE				1
 #define SOCKET_IDLE						2
+#define SOCKET_WAIT						3
 
-/* Max seconds in individual socket state */
+/* Max ms in individual socket state, and delay before next connection
+ * (monotonic clock, not affected by NTP steps) */
 //#define SOCKET_MAX_ALLOWED_STATE_TIME_S		15
-#define SOCKET_MAX_STATE_TIME_S				15
-#define SOCKET_RETRY_STATE_TIME_S			3
+#define SOCKET_MAX_STATE_TIME_MS			15000
+#define SOCKET_RETRY_STATE_TIME_MS			3000
+/* Connection is kept open between requests (HTTP keep-alive) and closed
+ * after this many ms without requests (0 closes it, once fifo is empty).
+ * Servers closing idle connections sooner are detected while idle, or on
+ * reuse, and reconnected without retry delay. */
+#define SOCKET_KEEPALIVE_TIME_MS			120000
+
+
+/* Upload straight from measurements log (make DISK_UPLOAD=1), instead of
+ * keeping pending measurements in memory. Position of the last uploaded
+ * measurement is kept on disk, so restart resumes there and backlog is
+ * limited by log retention (see 'segment_reader/segment_reader.h'). */
+#ifndef REQUEST_TASK_DISK_UPLOAD
+#define REQUEST_TASK_DISK_UPLOAD           (0)
+#endif
+/* Acknowledged position in measurements log (relative to CURDIR) */
+#define REQUEST_TASK_CURSOR_FILENAME       "/measurement/upload.cursor"
+/* Log is checked this long after measurements arrive (storage writes them
+ * meanwhile) */
+#define REQUEST_TASK_DISK_POLL_MS          (20)
+
+/* Upload up to this many measurements per request (make BATCH=<n>), sent
+ * as JSON array (even if only one is pending). Server acknowledges the
+ * whole batch, a batch rejected with 400 is resent one by one, so only
+ * the bad measurement is skipped. 1 sends single JSON objects. */
+#ifndef REQUEST_TASK_BATCH_RECORDS
+#define REQUEST_TASK_BATCH_RECORDS         (1)
+#endif
+/* Max request body with batches (response echoes it) */
+#define REQUEST_TASK_BATCH_BYTES           (16 * 1024)
+
+/* Requests kept in flight on the connection (make WINDOW=<n>), sent
+ * without waiting for responses (HTTP pipelining), so round trip time
+ * doesn't limit upload rate. Responses come in request order, measurements
+ * are released in the same order, once acknowledged. On error, requests
+ * without response are built and sent again from the oldest measurement,
+ * which is not acknowledged (server may get some twice). 1 waits for each
+ * response before sending next request. */
+#ifndef REQUEST_TASK_WINDOW
+#define REQUEST_TASK_WINDOW                (1)
+#endif
 
+/* Max upload connections (make CONNECTIONS=<n>), each with its own window.
+ * Another one is opened, while REQUEST_TASK_POOL_BACKLOG requests wait
+ * although windows of all open ones are full, and it's closed again once
+ * caught up. Requests are spread over connections in measurement order,
+ * measurements are released in that order. Requests of a failed connection
+ * go to the other ones. 1 keeps single connection. */
+#ifndef REQUEST_TASK_CONNECTIONS
+#define REQUEST_TASK_CONNECTIONS           (1)
+#endif
+
+/* Waiting requests, which open another connection */
+#ifndef REQUEST_TASK_POOL_BACKLOG
+#define REQUEST_TASK_POOL_BACKLOG          (REQUEST_TASK_WINDOW)
+#endif
 
-/* Request buffer (actual size is number of entries + 1)
- * 4096 R, 1 R = 1/2 kB -> 68 h of measurements, 2Mb total space
+/* Request buffer, also read by data storage (requests are reader 0).
+ * 4096 R, 1 R = 1/2 kB -> 2Mb total space, variable length records of
+ * ~100 B -> ~20k measurements
+ * With disk upload it only wakes up requests, records are released on
+ * arrival, so it only has to hold storage's backlog.
  */
 /* Possible number of kept strings in fifo */
+#if (REQUEST_TASK_DISK_UPLOAD == 1)
+#define REQUEST_FIFO_BUF_SIZE              (256)
+#else
 #define REQUEST_FIFO_BUF_SIZE              (4096)
+#endif
 /* Size of string to be kept in fifo */
 #define REQUEST_FIFO_STR_SIZE              (FIFO_STRING_SIZE)
+/* On long server outage, oldest measurements are dropped for upload only
+ * (FIFO_OVERFLOW_...). Storage reads the same fifo, so it must not spill:
+ * spilled records would reach storage only after uploads catch up. Use disk
+ * upload (make DISK_UPLOAD=1) to keep the backlog.
+ * Requests read rows in place (BATCH, WINDOW and CONNECTIONS hold several).
+ * Single threaded, DROP_OLDEST overwrites them: their requests are still
+ * sent (copy), dropped rows are counted off before release (reader drops).
+ * Threaded, the newest rows are dropped instead. BLOCK stalls serial input
+ * behind the upload. */
+#define REQUEST_FIFO_OVERFLOW              (FIFO_OVERFLOW_DROP_OLDEST)
+#if (REQUEST_FIFO_OVERFLOW == FIFO_OVERFLOW_SPILL)
+#error "Request fifo is read by storage, it must not spill"
+#endif
+/* Secondary store, with FIFO_OVERFLOW_SPILL (relative to CURDIR) */
+#define REQUEST_FIFO_SPILL_FILENAME        "/measurement/request_spill.bin"
 
 
 #define REQUEST_FMT                        					\
     "POST /api/v1.0/measurement/ HTTP/1.1\r\n" 						\
     "Host: %s\r\n" 											\
     "Content-Type: application/json; charset=utf-8\r\n" 	\
-    "Content-Length: %lu\r\n\r\n" 							\
-    "%s\r\n\r\n"
-
-/* Requset, request data and response buffer sizes */
+    "Content-Length: %lu\r\n" 								\
+    "Connection: keep-alive\r\n\r\n" 						\
+    "%.*s"
+
+/* Requset, request data and response read buffer sizes (responses are
+ * parsed as they arrive, any length fits) */
+#if (REQUEST_TASK_BATCH_RECORDS > 1)
+#define REQUEST_BUF_SIZE 				(REQUEST_TASK_BATCH_BYTES + 1024)
+#else
 #define REQUEST_BUF_SIZE 				1024
-#define REQUEST_DATA_BUF_SIZE 			1024
+#endif
 #define RESPONSE_BUF_SIZE 				4096
+#define REQUEST_DATA_BUF_SIZE 			1024
 
 /* Host addres buffer size */
 #define HOST_ADDR_BUF_SIZE       		64
@@ -88,6 +172,16 @@
  */
 int8_t request_task_init_fifo (str_fifo_t **_fifo);
 
+/*  Continue uploading from measurements log, where last run stopped (only
+ *  with REQUEST_TASK_DISK_UPLOAD).
+ *   p1: path relative to base dir, same as 'storage_task_init_file' gets
+ *
+ *  return:
+ *  	-1: error
+ *  	 0: success
+ */
+int8_t request_task_init_log (const char *path);
+
 /*  Create socket. Will not try connecting, returns OK, even if host is down.
  *   p1: hostname string
  *   p2: port number
@@ -98,6 +192,14 @@ int8_t request_task_init_fifo (str_fifo_t **_fifo);
  */
 int8_t request_task_init_socket (char *_host, int16_t portno);
 
+/*  Create state timers and register them with scheduler.
+ *
+ *  return:
+ *  	-1: error
+ *  	 0: success
+ */
+int8_t request_task_init_events (void);
+
 /*  Check for data, create and enable socket, write, read and evaluate.
  *
  *  return:
@@ -1,6 +1,8 @@
 
 #include "serial.h"
 #include "../../fifo/fifo.h"
+#include "../../scheduler/scheduler.h"
+#include "../../log/log.h"
 
 #include <stdio.h>          /* Standard input/output definitions */
 #include <unistd.h>         /* UNIX standard function definitions */
@@ -28,6 +30,9 @@ int fd;
 /* Absolute path to port */
 static char portname[PORTNAME_STRING_LEN];
 
+/* Port registered with scheduler */
+static int8_t is_port_registered = 0;
+
 /* Length of received data */
 int rx_length = 0;
 /* Received serial data, copied on interrupt to raw buffer */
@@ -54,6 +59,7 @@ int8_t serial_init_fifo(str_fifo_t **_fifo){
     *_fifo = &serial_raw_fifo;
     //setup_str_fifo(&serial_raw_fifo, SERIAL_FIFO_BUFFER_SIZE, RAW_FIFO_STRING_SIZE);
     setup_str_fifo(&serial_raw_fifo, SERIAL_FIFO_BUFFER_SIZE, SERIAL_FIFO_STRING_SIZE);
+    str_fifo_set_overflow(&serial_raw_fifo, SERIAL_FIFO_OVERFLOW, NULL);
     return 0;
 }
 
@@ -77,6 +83,17 @@ int8_t serial_open_port (void) {
     return error_control;
 }
 
+/*  Register serial port with scheduler, so that incoming data wakes up
+ *  the main loop.
+ */
+int8_t serial_init_events (void) {
+    if (scheduler_add_fd(fd, EPOLLIN) != 0) {
+        return -1;
+    }
+    is_port_registered = 1;
+    return 0;
+}
+
 
 /* SIGNAL HANDLER *************************************************************/
 void signal_handler_IO (int status)
@@ -100,25 +117,38 @@ void signal_handler_IO (int status)
 /*	Check for data in serial buffer (pooling based)
  */
 int8_t serial_task_run (void) {
-    /* Clear temporary string buffer */
-    memset(rx_buffer, 0, RAW_FIFO_STRING_SIZE);
-    /* Read incoming to temporary string buffer */
-	rx_length = read(fd, (void*)rx_buffer, RAW_FIFO_STRING_SIZE-1);
+    /* Read incoming directly to free fifo space (no copy) */
+    char *rx_slot = str_fifo_reserve(&serial_raw_fifo);
+    /* Fifo full (blocking policy), leave data in port's buffer */
+    if (rx_slot == NULL) {
+        return 0;
+    }
+	rx_length = read(fd, (void*)rx_slot, RAW_FIFO_STRING_SIZE-1);
 	/* Check for error (not try again later) */
     if (rx_length == -1 && errno != EAGAIN) {
-	    printf("errno: %d | %s\n", errno, strerror(errno));
+	    LOG_ERROR("errno: %d | %s\n", errno, strerror(errno));
 		return -1;
         return 0;
     }
+    /* End of file (port hang-up), stop waking up on it */
+    if (rx_length == 0 && is_port_registered == 1) {
+        LOG_WARN("Serial port hang-up\n");
+        scheduler_del_fd(fd);
+        is_port_registered = 0;
+        return 0;
+    }
     /* Write to buffer */
 	if (rx_length > 0) {
-		str_fifo_write(&serial_raw_fifo, rx_buffer);
+		/* Publish record (adds '\0') with receive time, overflow is
+		 * handled by fifo */
+		str_fifo_commit_stamped(&serial_raw_fifo, rx_length,
+			get_timestamp_ns());
 		/*printf("serial handler - serial_raw_fifo:\n"
 				"%u\n"
 				"%u\n",
 				serial_raw_fifo.read_idx,
 				serial_raw_fifo.write_idx);
-		printf("buffer: %s\n", rx_buffer);*/
+		printf("buffer: %s\n", rx_slot);*/
 	}
 	return 0;
 }
@@ -19,6 +19,9 @@
 /* In pooling based task, reserve space for more incoming data */
 #define SERIAL_FIFO_STRING_SIZE				(1024)
 
+/* Raw data is useless, once it's old (FIFO_OVERFLOW_...) */
+#define SERIAL_FIFO_OVERFLOW                (FIFO_OVERFLOW_DROP_OLDEST)
+
 
 /* Include space for later added timestamp */
 #define RAW_FIFO_STRING_SIZE                \
@@ -43,6 +46,12 @@ int8_t serial_init_port (char *_portname);
  */
 int8_t serial_open_port (void);
 
+/*  Register serial port with scheduler (call after 'scheduler_init').
+ *
+ *  return: 0 on success, -1 on error
+ */
+int8_t serial_init_events (void);
+
 /*	Check for data in serial buffer (pooling based).
  *
  *	return: 0 on success, -1 on error
@@ -1,46 +1,116 @@
 
 #include "storage_task.h"
+#include "../task.h"
 #include "../../fifo/fifo.h"
+#include "../../scheduler/scheduler.h"
+#include "../../segment/segment.h"
+#include "../../timestamp/timestamp.h"
+#include "../../anemo_record/anemo_record.h"
+#include "../../log/log.h"
+#include "../../uring/uring.h"
 
 #include <stdio.h>      /* Standard input/output definitions */
 #include <stdint.h>     /* Data types */
 #include <time.h>       /* For timestamp */
 #include <string.h>     /* For memcpy, strlen */
+#include <errno.h>      /* Error number definitions */
+#include <unistd.h>     /* fdatasync, close */
+#include <sys/uio.h>    /* writev */
 
 
+/* Lines per 'writev', each line is synced on its own with RECORD policy */
+#define _BATCH_LINES                \
+	((STORAGE_TASK_SYNC_POLICY == STORAGE_TASK_SYNC_RECORD) ? \
+	1 : STORAGE_TASK_DRAIN_BUDGET)
+
+/* io_uring completion tags */
+#define _URING_WRITE                (1)
+#define _URING_SYNC                 (2)
+
 
 /* LOCALS *********************************************************************/
 
-/* Fifo for data storage */
-static str_fifo_t fifo = {
-	0,
-	0,
-	STORAGE_FIFO_BUF_SIZE,
-	STORAGE_FIFO_STR_SIZE,
-	NULL
-};
+/* Fifo with data for storage (shared with other readers) */
+static str_fifo_t *fifo;
+/* Own reader id in shared fifo */
+static uint8_t fifo_reader;
 
 static char filename[FILENAME_STRING_LEN];
 
-/* temporary string used for storing one 'line' of data on fifo read/write */
-char data_save_str[STORAGE_FIFO_STR_SIZE];
+/* One 'line' of data, read in place from fifo */
+static char *data_save_str;
+/* Lines written from binary records (one per line of batch) */
+static char data_save_json[STORAGE_TASK_DRAIN_BUDGET][ANEMO_RECORD_JSON_SIZE];
+
+/* Batch of lines for 'writev' (line and '\n' each), kept in fifo until
+ * written */
+static struct iovec batch[2 * STORAGE_TASK_DRAIN_BUDGET];
+static int batch_len;
+static char line_end[] = "\n";
+
+/* Segment kept open between runs, -1 until opened (again) */
+static int ofd = -1;
+
+/* Lines written since last sync, and timer, which limits their age */
+static uint32_t unsynced_lines = 0;
+static scheduler_timer_t sync_timer;
+
+/* Writes and syncs are submitted to io_uring (else synchronous) */
+static int8_t is_uring = 0;
+/* Lines of the write in flight (kept in fifo), 0 if none */
+static uint16_t write_lines = 0;
+/* Rest of the write in flight (after short write) */
+static struct iovec *write_iov;
+static int write_iov_count;
+static size_t write_left;
+/* Write waits for free queue entry (submitted on next run) */
+static int8_t is_write_pending = 0;
+/* Syncs in flight */
+static uint8_t num_of_syncs = 0;
+
+
+/* PROTOTYPES *****************************************************************/
 
-/* file currently in use */
-FILE *ofp;
+static int8_t _open_file (void);
+static void _close_file (void);
+static void _add_line (char *str, uint16_t batch_line);
+static int8_t _write_batch (void);
+static void _add_unsynced (uint16_t num_of_lines);
+static void _sync (void);
+static int8_t _run_uring (void);
+static void _reap (void);
+static void _complete_write (int32_t result);
+static int8_t _submit_write (void);
+static int8_t _submit_sync (void);
 
 
 /* FUNCTIONS (GLOBAL) *********************************************************/
 
-/*  Point outer pointer to local fifo struct and init storage for fifo
- *   p1: pointer to pointer, pointing to fifo struct
+/*  Attach to shared fifo as additional reader
+ *   p1: pointer to fifo struct
  *  return: 0 on success, -1 on error
  */
-int8_t storage_task_init_fifo (str_fifo_t **_fifo) {
-    /* Set outer pointer to point to fifo local struct */
-    *_fifo = &fifo;
-    /* Set up memory for fifo struct and return success/error */
-    return setup_str_fifo(
-        &fifo, STORAGE_FIFO_BUF_SIZE, STORAGE_FIFO_STR_SIZE);
+int8_t storage_task_init_fifo (str_fifo_t *_fifo) {
+    int8_t reader;
+
+    /* Spilled records would bypass storage, until other readers catch up */
+    if (_fifo->overflow_policy == FIFO_OVERFLOW_SPILL) {
+        LOG_ERROR("Storage: fifo must not spill on overflow\n");
+        return -1;
+    }
+    reader = str_fifo_add_reader(_fifo);
+    if (reader == -1) {
+        return -1;
+    }
+    fifo = _fifo;
+    fifo_reader = reader;
+    return 0;
+}
+
+/*  Get own reader id in shared fifo.
+ */
+uint8_t storage_task_get_fifo_reader (void) {
+    return fifo_reader;
 }
 
 
@@ -55,19 +125,407 @@ int8_t storage_task_init_file (char *_filename) {
 	/* Copy measurement relative path (offset and including '/0') */
     memcpy(filename+  strlen(CURDIR), _filename, strlen(_filename)+1);
 
-    return 0;
+    /* File name is the base of segment names */
+    return segment_init(filename);
+}
+
+
+/*  Create sync timer, stopped until lines are written. Set up io_uring
+ *  (when enabled), its completions wake up the task.
+ */
+int8_t storage_task_init_events (void) {
+	int8_t error_control = 0;
+	error_control += scheduler_timer_init(&sync_timer);
+	error_control += scheduler_timer_stop(&sync_timer);
+
+	/* Overwritten oldest records can't be in flight */
+	if (URING_ENABLED == 1 && fifo->overflow_policy ==
+			FIFO_OVERFLOW_DROP_OLDEST && fifo->is_spsc == 0) {
+		LOG_WARN("Storage: fifo drops oldest, writing synchronously\n");
+	}
+	else if (URING_ENABLED == 1) {
+		if (uring_init(STORAGE_TASK_URING_ENTRIES) != 0) {
+			LOG_WARN("Storage: no io_uring (%s), writing synchronously\n",
+				strerror(errno));
+		}
+		else {
+			error_control += scheduler_add_fd(uring_get_fd(), EPOLLIN);
+			is_uring = 1;
+			LOG_INFO("Storage: writing through io_uring\n");
+		}
+	}
+	return (error_control == 0) ? 0 : -1;
 }
 
 
 int8_t storage_task_run (void) {
 	//printf("STORAGE TASK\n");
-	if (str_fifo_read_auto_inc(&fifo, data_save_str) == 0) {
-		ofp = fopen(filename, "a");
-		// -- move to output buffer and flush immediately
-		fprintf(ofp, "%s\n", data_save_str);
-		fflush(ofp);
-		fclose(ofp);
+	uint16_t num_of_lines = 0;
+	uint16_t batch_lines;
+	uint16_t i;
+	char *str;
+
+	if (is_uring == 1) {
+		return _run_uring();
+	}
+
+	/* Oldest unsynced line has waited long enough */
+	if (unsynced_lines > 0 && scheduler_timer_has_ended(&sync_timer) == 0) {
+		_sync();
+	}
+
+	data_save_str = str_fifo_peek_reader(fifo, fifo_reader);
+	if (data_save_str == NULL) {
+		return TASK_STATUS_IDLE;
+	}
+
+	/* Segment ends with its time window or size, next one is opened */
+	if (segment_is_due(get_timestamp_ns()) == 1) {
+		if (unsynced_lines > 0) {
+			_sync();
+		}
+		_close_file();
+	}
+
+	/* Lines are kept in fifo, until file can be opened */
+	if (ofd == -1 && _open_file() != 0) {
+		return TASK_STATUS_IDLE;
+	}
+
+	while (data_save_str != NULL && num_of_lines < STORAGE_TASK_DRAIN_BUDGET) {
+		/* Collect lines in place, without releasing them */
+		batch_len = 0;
+		batch_lines = 0;
+		str = data_save_str;
+		while (str != NULL && batch_lines < _BATCH_LINES &&
+				num_of_lines + batch_lines < STORAGE_TASK_DRAIN_BUDGET) {
+			_add_line(str, batch_lines);
+			batch_lines++;
+			str = str_fifo_peek_next(fifo, str);
+		}
+
+		/* Lines are kept in fifo, written part of them is cut off, file is
+		 * opened again next time */
+		if (_write_batch() != 0) {
+			segment_discard();
+			_close_file();
+			return TASK_STATUS_IDLE;
+		}
+
+		/* Index entries follow lines, index errors are not fatal */
+		segment_commit();
+
+		/* Done with records (freed, once all readers are done) */
+		for (i=0; i<batch_lines; i++) {
+			str_fifo_release_reader(fifo, fifo_reader);
+		}
+		num_of_lines += batch_lines;
+		_add_unsynced(batch_lines);
+		data_save_str = str_fifo_peek_reader(fifo, fifo_reader);
+	}
+
+	/* Budget used up, more lines are waiting */
+	if (data_save_str != NULL) {
+		return TASK_STATUS_BUSY;
+	}
+	return TASK_STATUS_IDLE;
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+/*  Open new segment for appending (kept open).
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _open_file (void) {
+	ofd = segment_open(get_timestamp_ns());
+	return (ofd == -1) ? -1 : 0;
+}
+
+/*  Close segment when it's due, or after error (unsynced lines are synced
+ *  with compressed segment, or lost).
+ */
+static void _close_file (void) {
+	segment_close();
+	ofd = -1;
+	unsynced_lines = 0;
+	scheduler_timer_stop(&sync_timer);
+}
+
+/*  Add line and its '\n' to batch.
+ *   p1: line, read in place from fifo
+ *   p2: line's position in batch
+ */
+static void _add_line (char *str, uint16_t batch_line) {
+	/* Length and arrival time are kept in fifo, no need to look for '\0' */
+	int len = str_fifo_get_len(str);
+	uint64_t time_ns = str_fifo_get_stamp(str);
+
+	/* Binary records are stored as JSON */
+	if (anemo_record_is_record(str, len) == 1) {
+		len = anemo_record_to_json((anemo_record_t *)str,
+			data_save_json[batch_line], ANEMO_RECORD_JSON_SIZE);
+		str = data_save_json[batch_line];
+		if (len < 0) {
+			LOG_ERROR("Error: storage anemo_record_to_json\n");
+			return;
+		}
+	}
+	/* Line is indexed by arrival time */
+	segment_add_line(time_ns, len + 1);
+
+	batch[batch_len].iov_base = str;
+	batch[batch_len].iov_len = len;
+	batch[batch_len + 1].iov_base = line_end;
+	batch[batch_len + 1].iov_len = 1;
+	batch_len += 2;
+}
+
+/*  Write whole batch to file (continue after short writes).
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _write_batch (void) {
+	struct iovec *iov = batch;
+	int iov_count = batch_len;
+	ssize_t result;
+
+	while (iov_count > 0) {
+		result = writev(ofd, iov, iov_count);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_ERROR("Error: storage writev | (%d) %s\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		/* Skip what was written */
+		while (iov_count > 0 && (size_t)result >= iov->iov_len) {
+			result -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+		if (iov_count > 0) {
+			iov->iov_base = (char *)iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+	return 0;
+}
+
+/*  Count written lines and sync according to durability policy.
+ *   p1: number of lines written
+ */
+static void _add_unsynced (uint16_t num_of_lines) {
+	if (STORAGE_TASK_SYNC_POLICY == STORAGE_TASK_SYNC_NONE) {
+		return;
+	}
+	if (STORAGE_TASK_SYNC_POLICY == STORAGE_TASK_SYNC_RECORD) {
+		_sync();
+		return;
+	}
+
+	/* Age of unsynced lines counts from the first one */
+	if (unsynced_lines == 0) {
+		scheduler_timer_start(&sync_timer, STORAGE_TASK_SYNC_MS);
+	}
+	unsynced_lines += num_of_lines;
+	if (unsynced_lines >= STORAGE_TASK_SYNC_LINES) {
+		_sync();
+	}
+}
+
+/*  Flush written lines and their index to storage (data only).
+ */
+static void _sync (void) {
+	if (ofd != -1 && is_uring == 1) {
+		/* Queue full, try again on next run */
+		if (_submit_sync() != 0) {
+			return;
+		}
+	}
+	else if (ofd != -1 && segment_sync() != 0) {
+		LOG_ERROR("Error: storage fdatasync | (%d) %s\n",
+			errno, strerror(errno));
+	}
+	unsynced_lines = 0;
+	scheduler_timer_stop(&sync_timer);
+}
+
+/*  Same as 'storage_task_run', but file is never waited for. One batch is
+ *  written at a time, its lines are released once the write completes (fifo
+ *  keeps new lines meanwhile). Syncs run alongside, in-flight requests hold
+ *  their file, so segment can be closed without waiting for them.
+ *  return: 0 (completions wake up the task), 1 while write waits for queue
+ */
+static int8_t _run_uring (void) {
+	uint16_t batch_lines = 0;
+	char *str;
+	int i;
+
+	/* Requests, which kernel didn't take yet, and completions */
+	if (uring_submit() != 0) {
+		LOG_ERROR("Error: storage io_uring submit | (%d) %s\n",
+			errno, strerror(errno));
+	}
+	_reap();
+
+	/* Queue was full, write (the rest of) batch now */
+	if (is_write_pending == 1 && _submit_write() != 0) {
+		return TASK_STATUS_BUSY;
+	}
+
+	/* With RECORD policy, each line is synced before the next one */
+	if (write_lines > 0 || (STORAGE_TASK_SYNC_POLICY ==
+			STORAGE_TASK_SYNC_RECORD && num_of_syncs > 0)) {
+		return TASK_STATUS_IDLE;
+	}
+
+	/* Oldest unsynced line has waited long enough */
+	if (unsynced_lines > 0 && scheduler_timer_has_ended(&sync_timer) == 0) {
+		_sync();
 	}
 
+	data_save_str = str_fifo_peek_reader(fifo, fifo_reader);
+	if (data_save_str == NULL) {
+		return TASK_STATUS_IDLE;
+	}
+
+	/* Segment ends with its time window or size, next one is opened */
+	if (segment_is_due(get_timestamp_ns()) == 1) {
+		if (unsynced_lines > 0) {
+			_sync();
+		}
+		_close_file();
+	}
+
+	/* Lines are kept in fifo, until file can be opened */
+	if (ofd == -1 && _open_file() != 0) {
+		return TASK_STATUS_IDLE;
+	}
+
+	/* Collect lines in place, without releasing them */
+	batch_len = 0;
+	str = data_save_str;
+	while (str != NULL && batch_lines < _BATCH_LINES) {
+		_add_line(str, batch_lines);
+		batch_lines++;
+		str = str_fifo_peek_next(fifo, str);
+	}
+	write_iov = batch;
+	write_iov_count = batch_len;
+	write_left = 0;
+	for (i=0; i<batch_len; i++) {
+		write_left += batch[i].iov_len;
+	}
+	write_lines = batch_lines;
+
+	if (_submit_write() != 0) {
+		return TASK_STATUS_BUSY;
+	}
+	return TASK_STATUS_IDLE;
+}
+
+/*  Handle completed writes and syncs.
+ */
+static void _reap (void) {
+	uint64_t tag;
+	int32_t result;
+
+	while (uring_reap(&tag, &result) == 0) {
+		if (tag == _URING_WRITE) {
+			_complete_write(result);
+		}
+		else {
+			num_of_syncs--;
+			if (result < 0) {
+				LOG_ERROR("Error: storage fdatasync | (%d) %s\n",
+					-result, strerror(-result));
+			}
+		}
+	}
+}
+
+/*  Release lines of completed write, or write the rest of them.
+ *   p1: result of write (bytes written, -errno on error)
+ */
+static void _complete_write (int32_t result) {
+	uint16_t i;
+
+	/* Nothing written, writing the rest again would not help */
+	if (result == 0 && write_left > 0) {
+		result = -EIO;
+	}
+	if (result < 0) {
+		LOG_ERROR("Error: storage writev | (%d) %s\n",
+			-result, strerror(-result));
+		/* Lines are kept in fifo, written part of them is cut off, file is
+		 * opened again next time */
+		write_lines = 0;
+		segment_discard();
+		_close_file();
+		return;
+	}
+
+	/* Skip what was written, write the rest */
+	write_left -= result;
+	if (write_left > 0) {
+		while ((size_t)result >= write_iov->iov_len) {
+			result -= write_iov->iov_len;
+			write_iov++;
+			write_iov_count--;
+		}
+		write_iov->iov_base = (char *)write_iov->iov_base + result;
+		write_iov->iov_len -= result;
+		/* Queue full, submitted on next run */
+		_submit_write();
+		return;
+	}
+
+	/* Index entries follow lines, index errors are not fatal */
+	segment_commit();
+
+	/* Done with records (freed, once all readers are done) */
+	for (i=0; i<write_lines; i++) {
+		str_fifo_release_reader(fifo, fifo_reader);
+	}
+	_add_unsynced(write_lines);
+	write_lines = 0;
+}
+
+/*  Queue and submit write of (the rest of) current batch.
+ *  return: 0 on success, -1 if queue is full (write stays pending)
+ */
+static int8_t _submit_write (void) {
+	if (uring_writev(ofd, write_iov, write_iov_count, _URING_WRITE) != 0) {
+		is_write_pending = 1;
+		return -1;
+	}
+	is_write_pending = 0;
+	/* Requests, which kernel didn't take, are submitted on next run */
+	if (uring_submit() != 0) {
+		LOG_ERROR("Error: storage io_uring submit | (%d) %s\n",
+			errno, strerror(errno));
+	}
+	return 0;
+}
+
+/*  Queue and submit fdatasync of segment and its index.
+ *  return: 0 on success, -1 if queue is full
+ */
+static int8_t _submit_sync (void) {
+	int index_fd = segment_get_index_fd();
+
+	if (uring_fdatasync(ofd, _URING_SYNC) != 0) {
+		return -1;
+	}
+	num_of_syncs++;
+	if (index_fd != -1 && uring_fdatasync(index_fd, _URING_SYNC) == 0) {
+		num_of_syncs++;
+	}
+	if (uring_submit() != 0) {
+		LOG_ERROR("Error: storage io_uring submit | (%d) %s\n",
+			errno, strerror(errno));
+	}
 	return 0;
 }
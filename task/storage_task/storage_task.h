@@ -15,24 +15,62 @@
 #include <stdint.h>     /* Data types */
 
 
-#define STORAGE_FIFO_BUF_SIZE       (10)
-#define STORAGE_FIFO_STR_SIZE       (FIFO_STRING_SIZE)
 #define FILENAME_STRING_LEN         128
 
+/* Max lines stored in one run (one 'writev' per run) */
+#define STORAGE_TASK_DRAIN_BUDGET   (32)
 
-/*  Init raw serial data fifo.
- *   p1: pointer to fifo struct pointer
+/* Durability policies (file is kept open, lines are written in batches)
+ *  NONE   - no sync, kernel writes lines back on its own (~30 s)
+ *  GROUP  - fdatasync after STORAGE_TASK_SYNC_LINES lines, or
+ *           STORAGE_TASK_SYNC_MS after the oldest unsynced line
+ *  RECORD - fdatasync after each line (one write per line, slowest)
+ */
+#define STORAGE_TASK_SYNC_NONE      (0)
+#define STORAGE_TASK_SYNC_GROUP     (1)
+#define STORAGE_TASK_SYNC_RECORD    (2)
+
+#ifndef STORAGE_TASK_SYNC_POLICY
+#define STORAGE_TASK_SYNC_POLICY    (STORAGE_TASK_SYNC_GROUP)
+#endif
+#define STORAGE_TASK_SYNC_LINES     (64)
+#define STORAGE_TASK_SYNC_MS        (5000)
+
+/* With io_uring (make URING=1), writes and syncs are submitted and their
+ * completions reaped later, so a slow disk never blocks the task (lines
+ * wait in fifo meanwhile). Falls back to synchronous writes on kernels
+ * without io_uring. Max requests in flight: */
+#define STORAGE_TASK_URING_ENTRIES  (16)
+
+
+/*  Attach to shared fifo (as additional reader), no copy of data is kept.
+ *  Fifo must not spill on overflow.
+ *   p1: pointer to fifo struct
  *  return: 0 on success, -1 on error
  */
-int8_t storage_task_init_fifo (str_fifo_t **_fifo);
+int8_t storage_task_init_fifo (str_fifo_t *_fifo);
 
-/*  Init filename.
- *   p1: pointer to fifo struct pointer
+/*  Get own reader id in shared fifo.
+ *  return: reader id
+ */
+uint8_t storage_task_get_fifo_reader (void);
+
+/*  Init filename, base of segment names (see 'segment.h').
+ *   p1: path relative to base dir ('/measurement/data.json')
  *  return: 0 on success, -1 on error
  */
 int8_t storage_task_init_file (char *filename);
 
 
+/*  Create sync timer (call after 'scheduler_init').
+ *  return: 0 on success, -1 on error
+ */
+int8_t storage_task_init_events (void);
+
+/*  Store oldest lines from fifo to file (up to STORAGE_TASK_DRAIN_BUDGET).
+ *  return: 0 when fifo was drained, 1 when more lines are waiting, -1 on
+ *  error
+ */
 int8_t storage_task_run (void);
 
 #endif
@@ -11,6 +11,24 @@
 
 /* Calendar time (Epoch time) - usually signed int */
 static time_t time_epoch;
+
+/* Cached timestamp prefix (date and hour) and the hour it belongs to. Kept
+ * per thread, since tasks may run on separate threads. */
+static __thread time_t prefix_hour = -1;
+static __thread char prefix[TIMESTAMP_UTC_PREFIX_SIZE + 1];
+
+/* Two digit strings "00" - "99", so each pair is a single copy */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
 /* Pointer to time structure, for specifications view 'ctime' at 'man7' */
 //static struct tm *time_human;
 /* Space for temporary timestamp */
@@ -19,6 +37,8 @@ static time_t time_epoch;
 
 /* PROTOTYPES *****************************************************************/
 static int8_t _refresh_timestamp (void);
+static int _format_timestamp (char *_timestamp, struct timespec *time_spec);
+static char *_write_digit_pair (char *dst, uint32_t value);
 
 
 /* FUNCTIONS (GLOBALS) ********************************************************/
@@ -31,16 +51,20 @@ int8_t get_timestamp_raw (char *_timestamp) {
         return -1;
     }
 
-    _refresh_timestamp ();
-
     // -- convert to standardised timestamp
     /*sprintf(_timestamp, TIMESTAMP_RAW_FORMAT,
         time_human->tm_year+1900, time_human->tm_mon+1, time_human->tm_mday,
         time_human->tm_hour, time_human->tm_min);*/
 
-    /* Convert to UTC and format ISO 8601 */
-    strftime(_timestamp, TIMESTAMP_JSON_STRING_SIZE,
-		TIMESTAMP_UTC_RAW_FORMAT, gmtime(&time_epoch));
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0) {
+        return -1;
+    }
+
+    /* Format ISO 8601 (UTC) */
+    if (_format_timestamp(_timestamp, &now) < 0) {
+        return -1;
+    }
 
     return 0;
 }
@@ -54,21 +78,46 @@ int8_t get_timestamp_json_w_comma (char *_timestamp) {
         return -1;
     }
 
-    _refresh_timestamp ();
-
     // -- convert to standardised timestamp
     /*sprintf(_timestamp, TIMESTAMP_JSON_FORMAT_W_COMMA,
         time_human->tm_year+1900, time_human->tm_mon+1, time_human->tm_mday,
         time_human->tm_hour, time_human->tm_min);*/
 
-    /* Convert to UTC and format ISO 8601 */
-    strftime(_timestamp, TIMESTAMP_JSON_STRING_SIZE,
-		TIMESTAMP_UTC_JSON_FORMAT_W_COMMA, gmtime(&time_epoch));
+    return get_timestamp_json_w_comma_at(_timestamp, get_timestamp_ns());
+}
+
 
+/*  Get JSON formated timestamp of given time with succeeding comma symbol.
+ */
+int8_t get_timestamp_json_w_comma_at (char *_timestamp, uint64_t _time_ns) {
+    struct timespec time_spec;
+    time_spec.tv_sec = (time_t)(_time_ns / 1000000000ULL);
+    time_spec.tv_nsec = (long)(_time_ns % 1000000000ULL);
+
+    /* "timestamp":"<ISO 8601 (UTC)>", */
+    int len = sizeof(TIMESTAMP_JSON_KEY) - 1;
+    memcpy(_timestamp, TIMESTAMP_JSON_KEY, len);
+    int timestamp_len = _format_timestamp(&_timestamp[len], &time_spec);
+    if (timestamp_len < 0) {
+        return -1;
+    }
+    len += timestamp_len;
+    memcpy(&_timestamp[len], "\",", 3);
 
     return 0;
 }
 
+
+/*  Get current time (CLOCK_REALTIME) in ns since Unix Epoch.
+ */
+uint64_t get_timestamp_ns (void) {
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
 int8_t get_timestamp_epoch(long int *_time_epoch) {
 	_refresh_timestamp();
 //	/* Make sure 'time_t' is equal to 'long int' */
@@ -90,3 +139,61 @@ static int8_t _refresh_timestamp (void) {
 
     return 0;
 }
+
+/*  Format UTC time as "YYYY-MM-DDTHH:MM:SS[.fff[fff]]Z". Date and hour get
+ *  formatted by 'strftime' only when the hour changes, minutes, seconds and
+ *  fractions are written from digit pair table.
+ *  return: timestamp length (without '\0'), -1 on error
+ */
+static int _format_timestamp (char *_timestamp, struct timespec *time_spec) {
+    struct timespec now = *time_spec;
+    struct tm time_human;
+    uint32_t seconds_in_hour;
+    char *dst;
+
+    /* New hour (or clock was set), refresh cached prefix */
+    if (now.tv_sec / 3600 != prefix_hour) {
+        if (gmtime_r(&now.tv_sec, &time_human) == NULL ||
+                strftime(prefix, sizeof(prefix), TIMESTAMP_UTC_PREFIX_FORMAT,
+                    &time_human) != TIMESTAMP_UTC_PREFIX_SIZE) {
+            prefix_hour = -1;
+            return -1;
+        }
+        prefix_hour = now.tv_sec / 3600;
+    }
+
+    memcpy(_timestamp, prefix, TIMESTAMP_UTC_PREFIX_SIZE);
+    dst = &_timestamp[TIMESTAMP_UTC_PREFIX_SIZE];
+
+    /* Minutes and seconds */
+    seconds_in_hour = (uint32_t)(now.tv_sec % 3600);
+    dst = _write_digit_pair(dst, seconds_in_hour / 60);
+    *dst++ = ':';
+    dst = _write_digit_pair(dst, seconds_in_hour % 60);
+
+    /* Second fractions */
+#if (TIMESTAMP_FRACTION_DIGITS == 3)
+    uint32_t ms = (uint32_t)now.tv_nsec / 1000000;
+    *dst++ = '.';
+    dst = _write_digit_pair(dst, ms / 10);
+    *dst++ = '0' + ms % 10;
+#elif (TIMESTAMP_FRACTION_DIGITS == 6)
+    uint32_t us = (uint32_t)now.tv_nsec / 1000;
+    *dst++ = '.';
+    dst = _write_digit_pair(dst, us / 10000);
+    dst = _write_digit_pair(dst, (us / 100) % 100);
+    dst = _write_digit_pair(dst, us % 100);
+#endif
+
+    *dst++ = 'Z';
+    *dst = '\0';
+    return (int)(dst - _timestamp);
+}
+
+/*  Write two digits (value 0 - 99).
+ *  return: pointer past written digits
+ */
+static char *_write_digit_pair (char *dst, uint32_t value) {
+    memcpy(dst, &digit_pairs[value * 2], 2);
+    return dst + 2;
+}
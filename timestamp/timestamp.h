@@ -16,19 +16,56 @@
 #define TIMESTAMP_UTC_JSON_FORMAT_W_COMMA      \
     "\"timestamp\":\"%FT%TZ\","
 
+/* Digits of second fractions: 0, 3 (ms) or 6 (us) */
+#ifndef TIMESTAMP_FRACTION_DIGITS
+#define TIMESTAMP_FRACTION_DIGITS               (3)
+#endif
+
+/* Cached part of timestamp, changes once per hour ("%Y-%m-%dT%H:") */
+#define TIMESTAMP_UTC_PREFIX_FORMAT             "%FT%H:"
+#define TIMESTAMP_UTC_PREFIX_SIZE               (14)
+
+#define TIMESTAMP_JSON_KEY                      "\"timestamp\":\""
+
+/* Length of formatted timestamps (without '\0'), "YYYY-MM-DDTHH:MM:SS" is
+ * followed by '.' and fraction digits, and 'Z' */
+#if (TIMESTAMP_FRACTION_DIGITS > 0)
+#define TIMESTAMP_UTC_LEN                       \
+    (19 + 1 + TIMESTAMP_FRACTION_DIGITS + 1)
+#else
+#define TIMESTAMP_UTC_LEN                       (19 + 1)
+#endif
+#define TIMESTAMP_JSON_W_COMMA_LEN              \
+    (sizeof(TIMESTAMP_JSON_KEY) - 1 + TIMESTAMP_UTC_LEN + 2)
+
 
-/*  Get latest raw formated timestamp.
+/*  Get latest raw formated timestamp (UTC, ISO 8601 with second fractions).
+ *  Uses CLOCK_REALTIME, date and hour are formatted only once per hour.
  *   p1: pointer to where timestamp should be written
  *  return: 0 on success, -1 on error
  */
 int8_t get_timestamp_raw (char *_timestamp);
 
-/*  Get latest JSON formated timestamp with succeeding comma symbol.
+/*  Get latest JSON formated timestamp with succeeding comma symbol (same
+ *  format as raw timestamp).
  *   p1: pointer to where timestamp should be written
  *  return: 0 on success, -1 on error
  */
 int8_t get_timestamp_json_w_comma (char *_timestamp);
 
+/*  Get JSON formated timestamp of given time, with succeeding comma symbol.
+ *  Always TIMESTAMP_JSON_W_COMMA_LEN chars long (followed by '\0').
+ *   p1: pointer to where timestamp should be written
+ *   p2: time in ns since Unix Epoch (see 'get_timestamp_ns')
+ *  return: 0 on success, -1 on error
+ */
+int8_t get_timestamp_json_w_comma_at (char *_timestamp, uint64_t _time_ns);
+
+/*  Get current time (CLOCK_REALTIME) with ns resolution.
+ *  return: ns since Unix Epoch, 0 on error
+ */
+uint64_t get_timestamp_ns (void);
+
 int8_t get_timestamp_epoch(long int *_time_epoch);
 
 
@@ -0,0 +1,252 @@
+#include "uring.h"
+
+#include <stdint.h>         /* Data types */
+#include <string.h>         /* memset */
+#include <errno.h>          /* Error number definitions */
+#include <unistd.h>         /* syscall, close */
+#include <sys/uio.h>        /* struct iovec */
+#if (URING_ENABLED == 1)
+#include <sys/mman.h>       /* mmap */
+#include <sys/syscall.h>    /* __NR_io_uring_setup, __NR_io_uring_enter */
+#include <linux/io_uring.h> /* Ring layout, opcodes */
+#endif
+
+
+/* Indexes are shared with kernel */
+#define _LOAD_ACQUIRE(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define _STORE_RELEASE(ptr, val)    __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+
+/* LOCALS *********************************************************************/
+
+static int ring_fd = -1;
+
+#if (URING_ENABLED == 1)
+/* Submission queue ring (indexes of entries) and its entries */
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static unsigned sq_entries;
+static struct io_uring_sqe *sqes;
+/* Queued, not yet submitted entries */
+static unsigned num_of_queued = 0;
+
+/* Completion queue ring */
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+#endif
+
+
+/* PROTOTYPES *****************************************************************/
+
+#if (URING_ENABLED == 1)
+static int8_t _map_rings (const struct io_uring_params *params);
+static struct io_uring_sqe *_get_sqe (void);
+static void _queue_sqe (void);
+#endif
+
+
+/* FUNCTIONS (GLOBAL) *********************************************************/
+
+/*  Set up ring and map its queues.
+ */
+int8_t uring_init (uint32_t entries) {
+#if (URING_ENABLED == 1)
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd == -1) {
+        return -1;
+    }
+    if (_map_rings(&params) != 0) {
+        /* Mappings go with the process, ring is not used */
+        close(ring_fd);
+        ring_fd = -1;
+        return -1;
+    }
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*  Get ring's file descriptor.
+ */
+int uring_get_fd (void) {
+    return ring_fd;
+}
+
+/*  Queue write at current position (offset -1).
+ */
+int8_t uring_writev (int fd, const struct iovec *iov, int iov_count,
+        uint64_t user_data) {
+#if (URING_ENABLED == 1)
+    struct io_uring_sqe *sqe = _get_sqe();
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)-1;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iov_count;
+    sqe->user_data = user_data;
+    _queue_sqe();
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*  Queue fdatasync (fsync without metadata).
+ */
+int8_t uring_fdatasync (int fd, uint64_t user_data) {
+#if (URING_ENABLED == 1)
+    struct io_uring_sqe *sqe = _get_sqe();
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = user_data;
+    _queue_sqe();
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*  Hand queued entries over to kernel, without waiting for completions.
+ *  Entries, which kernel didn't take (busy), go with next submit.
+ */
+int8_t uring_submit (void) {
+#if (URING_ENABLED == 1)
+    long result;
+
+    while (num_of_queued > 0) {
+        result = syscall(__NR_io_uring_enter, ring_fd, num_of_queued, 0, 0,
+            NULL, 0);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                return 0;
+            }
+            return -1;
+        }
+        num_of_queued -= result;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*  Take oldest completion from completion queue.
+ */
+int8_t uring_reap (uint64_t *user_data, int32_t *result) {
+#if (URING_ENABLED == 1)
+    unsigned head = *cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == _LOAD_ACQUIRE(cq_tail)) {
+        return 1;
+    }
+    cqe = &cqes[head & *cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    /* Slot is reused by kernel after this */
+    _STORE_RELEASE(cq_head, head + 1);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+
+/* FUNCTIONS (LOCAL) **********************************************************/
+
+#if (URING_ENABLED == 1)
+/*  Map submission and completion queues of new ring.
+ *  return: 0 on success, -1 on error
+ */
+static int8_t _map_rings (const struct io_uring_params *params) {
+    size_t sq_size;
+    size_t cq_size;
+    char *sq_ptr;
+    char *cq_ptr;
+
+    /* Both rings are one mapping on newer kernels */
+    sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    cq_size = params->cq_off.cqes +
+        params->cq_entries * sizeof(struct io_uring_cqe);
+    if ((params->features & IORING_FEAT_SINGLE_MMAP) != 0 &&
+            cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        return -1;
+    }
+    if ((params->features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        cq_ptr = sq_ptr;
+    }
+    else {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            return -1;
+        }
+    }
+    sqes = mmap(NULL, params->sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return -1;
+    }
+
+    sq_head = (unsigned *)(sq_ptr + params->sq_off.head);
+    sq_tail = (unsigned *)(sq_ptr + params->sq_off.tail);
+    sq_mask = (unsigned *)(sq_ptr + params->sq_off.ring_mask);
+    sq_array = (unsigned *)(sq_ptr + params->sq_off.array);
+    sq_entries = params->sq_entries;
+    cq_head = (unsigned *)(cq_ptr + params->cq_off.head);
+    cq_tail = (unsigned *)(cq_ptr + params->cq_off.tail);
+    cq_mask = (unsigned *)(cq_ptr + params->cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq_ptr + params->cq_off.cqes);
+    return 0;
+}
+
+/*  Get next free submission entry (cleared).
+ *  return: entry, NULL if submission queue is full
+ */
+static struct io_uring_sqe *_get_sqe (void) {
+    unsigned tail = *sq_tail;
+    unsigned idx;
+
+    if (tail - _LOAD_ACQUIRE(sq_head) >= sq_entries) {
+        return NULL;
+    }
+    idx = tail & *sq_mask;
+    memset(&sqes[idx], 0, sizeof(struct io_uring_sqe));
+    sq_array[idx] = idx;
+    return &sqes[idx];
+}
+
+/*  Publish entry, taken with '_get_sqe', to kernel.
+ */
+static void _queue_sqe (void) {
+    _STORE_RELEASE(sq_tail, *sq_tail + 1);
+    num_of_queued++;
+}
+#endif
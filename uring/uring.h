@@ -0,0 +1,69 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+ *  Minimal io_uring wrapper (raw system calls, no liburing) for file
+ *  writes and syncs, which must not block the calling thread. Requests are
+ *  queued, submitted together, and completions are reaped without waiting.
+ *  Ring's file descriptor becomes readable, when completions are waiting,
+ *  so it can be registered with the scheduler.
+ *
+ *  Single ring, use from one thread at a time.
+ *
+ *	Useful links:
+ *		io_uring: https://kernel.dk/io_uring.pdf
+ */
+
+#include <stdint.h>         /* Data types */
+#include <sys/uio.h>        /* struct iovec */
+
+
+/* Build with io_uring support (make URING=1), else 'uring_init' fails */
+#ifndef URING_ENABLED
+#define URING_ENABLED                       (0)
+#endif
+
+
+/*  Create ring. Fails on kernels without io_uring (or when it's disabled).
+ *   p1: max number of queued requests
+ *  return: 0 on success, -1 on error (errno is set)
+ */
+int8_t uring_init (uint32_t entries);
+
+/*  Get ring's file descriptor (readable while completions are waiting).
+ *  return: file descriptor, -1 without ring
+ */
+int uring_get_fd (void);
+
+/*  Queue write of buffers at current file position (appends with
+ *  O_APPEND). Buffers and 'iov' have to stay valid until completion.
+ *   p1: file descriptor
+ *   p2: buffers
+ *   p3: number of buffers
+ *   p4: value returned with completion
+ *  return: 0 on success, -1 if queue is full
+ */
+int8_t uring_writev (int fd, const struct iovec *iov, int iov_count,
+    uint64_t user_data);
+
+/*  Queue fdatasync.
+ *   p1: file descriptor
+ *   p2: value returned with completion
+ *  return: 0 on success, -1 if queue is full
+ */
+int8_t uring_fdatasync (int fd, uint64_t user_data);
+
+/*  Submit queued requests to kernel (does not wait for them).
+ *  return: 0 on success, -1 on error
+ */
+int8_t uring_submit (void);
+
+/*  Get next completion, if there is one (does not wait).
+ *   p1: where value given with request is returned
+ *   p2: where result is returned (as system call's, -errno on error)
+ *  return: 0 on completion, 1 if there is none
+ */
+int8_t uring_reap (uint64_t *user_data, int32_t *result);
+
+
+#endif